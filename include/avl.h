@@ -8,6 +8,13 @@
 #ifndef _AVL_TREE_H_
 #define _AVL_TREE_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 
 /*
  * avl_compare_fn() - Comparison function template for comparing two avl nodes.
@@ -56,13 +63,151 @@ typedef void (*avl_free_fn) (void *n);
 typedef int (*avl_walker_fn) (void *n, void *ctx);
 
 
+/*
+ * avl_augment_fn() - Augmentation function: recompute the aggregate kept in
+ * a node's user data (e.g. the max interval end or the sum of a field over
+ * its subtree) from the node itself and the aggregates of its children.
+ * Called bottom-up by insert, remove and every rotation.
+ * 
+ *     Argument: void *n
+ *          IN   Avl node or user data whose aggregate to recompute
+ * 
+ *     Argument: void *left, void *right
+ *          IN   Children of n (avl node or user data), NULL if missing
+ * 
+ *     Argument: void *ctx
+ *          IN   Context given to avl_set_augment()
+ */
+typedef void (*avl_augment_fn) (void *n, void *left, void *right, void *ctx);
+
+
+/*
+ * avl_span_fn() - Callback for avl_aggregate().
+ * 
+ *     Argument: void *n
+ *          IN   Avl node or user data
+ * 
+ *     Argument: int subtree
+ *          IN   1 if the whole subtree rooted at n is in range (use the
+ *               aggregate of n), 0 if only n itself is
+ * 
+ *     Argument: void *ctx
+ *          IN   Context passed to avl_aggregate()
+ *
+ *       Return: int
+ *               AVL_SUCCESS to continue, AVL_ERROR to stop
+ */
+typedef int (*avl_span_fn) (void *n, int subtree, void *ctx);
+
+
+/*
+ * avl_prune_fn() - Callback for avl_stab(): tell from the aggregate of n
+ * whether the subtree rooted at n can hold a match.
+ * 
+ *       Return: int
+ *               Non-zero if the subtree must be searched
+ */
+typedef int (*avl_prune_fn) (void *n, void *ctx);
+
+
+/*
+ * avl_prefix_fn() - Key prefix function for prefix-caching trees.  Maps user
+ * data to a 64-bit value that preserves the tree order: if prefix(a) <
+ * prefix(b) then a must compare less than b.  Equal prefixes say nothing and
+ * the compare function decides.  For strings, avl_prefix_bytes() of the key
+ * does this.
+ * 
+ *     Argument: void *data
+ *          IN   User data (a tree element or a lookup key)
+ * 
+ *       Return: uint64_t
+ *               Order preserving key prefix
+ */
+typedef uint64_t (*avl_prefix_fn) (void *data);
+
+
+/*
+ * avl_hash_fn() - Hash function for the hash side-index of a tree.  Elements
+ * that compare equal must hash equal.
+ * 
+ *     Argument: void *data
+ *          IN   User data (a tree element or a lookup key)
+ * 
+ *       Return: uint64_t
+ *               Hash of the key of data
+ */
+typedef uint64_t (*avl_hash_fn) (void *data);
+
+
+/*
+ * avl_diff_fn() - Callback for avl_diff(), called once per difference.
+ * 
+ *     Argument: void *a, void *b
+ *          IN   The element of each tree; a is NULL if the key is only in
+ *               the second tree, b is NULL if it is only in the first, and
+ *               both are set if the key is in both with different contents
+ * 
+ *     Argument: void *ctx
+ *          IN   Context passed to avl_diff()
+ */
+typedef void (*avl_diff_fn) (void *a, void *b, void *ctx);
+
+
+/*
+ * avl_dup_fn() - Duplicate callback of a merge iterator (avl_merge_init).
+ * 
+ *     Argument: void *kept
+ *          IN   Element the iterator returns for the key (from the tree
+ *               listed first)
+ * 
+ *     Argument: void *dup
+ *          IN   Another element that compares equal to kept; it is skipped
+ * 
+ *     Argument: void *ctx
+ *          IN   Context given to avl_merge_init()
+ */
+typedef void (*avl_dup_fn) (void *kept, void *dup, void *ctx);
+
+
+/*
+ * avl_mutate_fn() - Key update function for avl_update_key(): change the
+ * key fields of a tree element in place.
+ * 
+ *     Argument: void *n
+ *          IN   Avl node or user data to rekey
+ * 
+ *     Argument: void *ctx
+ *          IN   Context passed to avl_update_key()
+ */
+typedef void (*avl_mutate_fn) (void *n, void *ctx);
+
+
+/*
+ * avl_evict_fn() - Eviction callback of a capacity bounded tree.  Receives
+ * each element pushed out by avl_insert(); the element is no longer in the
+ * tree and now belongs to the callback (the tree free function is not
+ * called for it).
+ * 
+ *     Argument: void *n
+ *          IN   Evicted avl node or user data
+ * 
+ *     Argument: void *ctx
+ *          IN   Context given to avl_set_capacity()
+ */
+typedef void (*avl_evict_fn) (void *n, void *ctx);
+
+
 /*
  * struct avl_node_t - Avl node type.  If an avl tree is intrusive, this must
  * be the first element in the user data type, and for this reason, we have to 
  * make this type transparent.
  * 
  *     Element: int balance
- *              Node balance factor
+ *              Node balance factor (node rank for AVL_TREE_WAVL trees)
+ * 
+ *     Element: unsigned flags
+ *              Node state bits (AVL_NODE_*), owned by the library.  Fits in
+ *              the padding after balance on 64-bit targets.
  * 
  *     Element: avl_node *child[2]
  *              Left (0) and right (1) pointers
@@ -76,11 +221,41 @@ typedef struct avl_node_t avl_node;
 
 struct avl_node_t {
     int       balance;   
+    unsigned  flags;
     avl_node *child[2];
     void     *data[0];  
 };
 
 
+/*
+ * Avl node flags
+ * 
+ *     AVL_NODE_DEAD: Node was removed from an AVL_TREE_LAZY tree and is waiting
+ *                    for avl_compact()
+ */
+#define AVL_NODE_DEAD 0x00000001
+
+
+/*
+ * AVL_NODE_SHIFT: The flag bits from here up hold a per-node value owned by
+ * one optional tree feature (the FIFO slot of an AVL_EVICT_OLDEST tree, or
+ * the access count of an AVL_TREE_COUNTED tree).
+ */
+#define AVL_NODE_SHIFT 8
+
+
+/*
+ * Capacity bound state of an avl tree (avl_set_capacity), private.
+ */
+typedef struct avl_bound_t avl_bound;
+
+
+/*
+ * Hash side-index of an avl tree (avl_set_hash), private.
+ */
+typedef struct avl_hash_t avl_hash;
+
+
 /*
  * struct avl_tree_t - Avl tree type.  
  * 
@@ -94,13 +269,46 @@ struct avl_node_t {
  *              Avl node free function
  * 
  *     Element: int size
- *              Avl tree size
+ *              Avl tree size (live nodes only)
  * 
  *     Element: int opts
  *              Avl tree options 
  *
  *     Element: int indx
  *              Avl tree index (for multi-trees)
+ *
+ *     Element: int dead
+ *              Number of tombstones (AVL_TREE_LAZY trees)
+ *
+ *     Element: unsigned long rotations
+ *              Number of single rotations done so far (a double rotation
+ *              counts as two).  Useful to compare balancing modes.
+ *
+ *     Element: avl_augment_fn augment, void *augment_ctx
+ *              Augmentation function and its context (avl_set_augment)
+ *
+ *     Element: avl_prefix_fn prefix
+ *              Key prefix function of a prefix-caching tree (avl_set_prefix)
+ *
+ *     Element: avl_bound *bound
+ *              Capacity and eviction policy, NULL if unbounded
+ *
+ *     Element: unsigned sample
+ *              Access sampling state (AVL_TREE_COUNTED trees)
+ *
+ *     Element: avl_hash *hash
+ *              Hash side-index, NULL if none
+ *
+ *     Element: size_t item
+ *              Bytes of user data copied into each node (avl_init_inline),
+ *              0 if nodes point to the user data
+ *
+ *     Element: avl_hash_fn merkle
+ *              Element hash of a Merkle-hashed tree (avl_set_merkle)
+ *
+ *     Element: void *block, size_t block_size
+ *              Single allocation holding the nodes of a clone (avl_clone);
+ *              nodes in it are not freed one by one
  */
 struct avl_tree_t {
     avl_node *root;
@@ -110,6 +318,18 @@ struct avl_tree_t {
     int opts;
     int idx;
     int n;
+    int dead;
+    unsigned long rotations;
+    avl_augment_fn augment;
+    void *augment_ctx;
+    avl_prefix_fn prefix;
+    avl_bound *bound;
+    unsigned sample;
+    avl_hash *hash;
+    size_t item;
+    avl_hash_fn merkle;
+    void *block;
+    size_t block_size;
 };
 
 
@@ -127,9 +347,33 @@ typedef struct avl_tree_t avl_tree;
  *     AVL_TREE_INTRUSIVE: User data does not hang off avl_node types. Instead
  *                         user data types are expected to have an avl_node 
  *                         element as the first element in their structures.                             
+ *
+ *     AVL_TREE_WAVL:      Rank-balanced (weak AVL) tree.  Same height as an
+ *                         AVL tree under insertions only, but removals do at
+ *                         most two rotations instead of O(log n).  The
+ *                         height stays within 2 log n when removals occur.
+ *
+ *     AVL_TREE_LAZY:      avl_remove() only marks the node dead (a tombstone);
+ *                         lookups and walks skip dead nodes.  Dead nodes are
+ *                         unlinked and freed in one batch by avl_compact().
+ *                         Intrusive nodes stay linked until then and must not
+ *                         be reused or freed by the caller before that.
+ *
+ *     AVL_TREE_COUNTED:   avl_lookup() counts hits per node, sampling about
+ *                         one lookup in eight.  avl_optimize() reshapes the
+ *                         tree for the observed access distribution.
  */
 #define AVL_TREE_DEFAULT   0x00000000 
 #define AVL_TREE_INTRUSIVE 0x00000001
+#define AVL_TREE_WAVL      0x00000002
+#define AVL_TREE_LAZY      0x00000004
+#define AVL_TREE_COUNTED   0x00000008
+
+
+/*
+ * AVL_MAX_HEIGHT: Max height of an avl tree 
+ */
+#define AVL_MAX_HEIGHT 48 
 
 
 /*
@@ -142,6 +386,22 @@ enum {
 };
 
 
+/*
+ * Eviction policies - Passed to avl_set_capacity().
+ * 
+ *     AVL_EVICT_MIN:    Evict the smallest key (keep the largest n)
+ * 
+ *     AVL_EVICT_MAX:    Evict the largest key (keep the smallest n)
+ * 
+ *     AVL_EVICT_OLDEST: Evict the least recently inserted element
+ */
+enum {
+    AVL_EVICT_MIN,
+    AVL_EVICT_MAX,
+    AVL_EVICT_OLDEST
+};
+
+
 /*
  * Generic return values 
  */
@@ -172,6 +432,26 @@ avl_tree *
 avl_init(avl_compare_fn comp, avl_free_fn free_fn, int options);
 
 
+/*
+ * avl_init_inline() - Create a non-intrusive avl tree that keeps a copy of
+ * each element inside its node.  avl_insert() copies item_size bytes from
+ * data into the node, so an element costs one allocation, and its key sits
+ * on the same cache line as the child pointers.  Lookups, iterators and
+ * callbacks see the copy; it lives as long as the node.  The copy is 8-byte
+ * aligned.  free_fn, if any, is called on the copy before its node is freed,
+ * for resources the element owns; it must not free the copy itself.
+ *
+ *     Argument: size_t item_size
+ *          IN   Size of an element in bytes
+ *
+ *       Return: avl_tree *
+ *               Newly created tree or NULL if error (item_size is 0, options
+ *               include AVL_TREE_INTRUSIVE, or memory error)
+ */
+avl_tree *
+avl_init_inline(avl_compare_fn comp, avl_free_fn free_fn, int options, size_t item_size);
+
+
 avl_tree *
 avl_multi_init(avl_compare_fn comp_fn[], avl_free_fn free_fn[], int n, int opt);
 
@@ -186,6 +466,67 @@ void
 avl_free(avl_tree *tree);
 
 
+/*
+ * avl_free_step() - Free an avl tree a few nodes at a time, for threads
+ * that cannot stall for the whole teardown.  Once started, the tree is being
+ * destroyed: only further avl_free_step() calls may use it.  Each call does
+ * at most budget node frees (and a few rotations per free).
+ *
+ *     Argument: int budget
+ *          IN   Max number of nodes to free in this call
+ *
+ *       Return: int
+ *               Nodes left, or 0 once the tree itself has been freed
+ */
+int
+avl_free_step(avl_tree *tree, int budget);
+
+
+/*
+ * avl_free_async() - Free an avl tree on a background thread.  Returns at
+ * once; the caller must not use the tree afterwards, and the free function
+ * (if any) runs on the other thread, so it must be thread safe.  If the
+ * thread cannot be started, the tree is freed before returning.
+ *
+ *       Return: int
+ *               AVL_SUCCESS, or AVL_ERROR if the tree was freed in the
+ *               calling thread for lack of a background thread
+ */
+int
+avl_free_async(avl_tree *tree);
+
+
+/*
+ * AVL clone options - Passed to avl_clone().
+ *
+ *     AVL_CLONE_PARALLEL: Copy the two subtrees of the root on two threads
+ *                         (large trees only)
+ */
+#define AVL_CLONE_PARALLEL 0x00000001
+
+
+/*
+ * avl_clone() - Copy a tree, shape and all, into a single allocation.  No
+ * compares, rotations or per-node allocations: the nodes are copied as they
+ * are, in preorder, so the copy is also laid out for descents.  The clone
+ * shares the elements of a pointer tree and copies those of an inline tree
+ * (shallowly); its free function is NULL either way.  Cached prefixes and
+ * Merkle hashes come along; a hash side-index or capacity bound does not.
+ * Nodes inserted later are allocated as usual, and the clone is freed with
+ * avl_free() like any tree.
+ *
+ *     Argument: int options
+ *          IN   AVL_CLONE_* option bits
+ *
+ *       Return: avl_tree *
+ *               The clone, or NULL if error (intrusive tree, augmented
+ *               pointer tree whose aggregates live in the shared elements,
+ *               or memory error)
+ */
+avl_tree *
+avl_clone(avl_tree *tree, int options);
+
+
 /*
  * avl_insert() - Insert an avl_node/user data into an avl tree.
  * 
@@ -196,7 +537,12 @@ avl_free(avl_tree *tree);
  *          IN   Avl node or user data to insert into tree.
  * 
  *     Argument: void *ctx
- *          IN   Context used for compare operations during insert
+ *          IN   Context used for compare operations during insert (and
+ *               during eviction from an AVL_EVICT_OLDEST tree)
+ * 
+ *       Return: avl_node *
+ *               The new node; NULL on memory error, or if a capacity bounded
+ *               tree evicted the new element itself right away
  */
 avl_node *
 avl_insert(avl_tree *tree, void *data, void *ctx);
@@ -226,6 +572,336 @@ int
 avl_multi_remove(avl_tree *mtree, void *data, void *ctx);
 
 
+/*
+ * avl_remove_range() - Remove every element in the key range [lo, hi].  The
+ * range is split off as one subtree and the rest joined back in O(log n),
+ * then the k removed nodes are freed in one pass: O(log n + k) in all.
+ * Split and join do not keep the ranks of AVL_TREE_WAVL trees, so those
+ * unlink the elements one by one instead, a descent each: O(k log n).
+ * 
+ *     Argument: avl_tree *tree
+ *          IN   Avl tree to remove from
+ * 
+ *     Argument: void *lo, void *hi
+ *          IN   Inclusive bounds (compared like avl_lookup() data); NULL
+ *               leaves that end of the range open
+ * 
+ *     Argument: avl_free_fn free_fn
+ *          IN   Called for every removed element; NULL for the tree's own
+ *               free function
+ * 
+ *     Argument: void *ctx
+ *          IN   Context used for compare operations
+ *
+ *       Return: int
+ *               Number of elements removed (tombstones of a lazy tree in
+ *               the range are purged as well but not counted)
+ */
+int
+avl_remove_range(avl_tree *tree, void *lo, void *hi, avl_free_fn free_fn, void *ctx);
+
+
+/*
+ * avl_remove_range_async() - avl_remove_range(), with the freeing done on a
+ * background thread (avl_free_async).  The range is out of the tree when
+ * this returns: the size, the tombstone count, the hash side-index and the
+ * capacity FIFO are updated in the calling thread, only free_fn and the
+ * node frees run on the other thread, so free_fn must be thread safe.
+ * Clones (avl_clone) and failures to set up the hand-off free the range
+ * before returning.
+ *
+ *       Return: int
+ *               Number of elements removed, as for avl_remove_range()
+ */
+int
+avl_remove_range_async(avl_tree *tree, void *lo, void *hi, avl_free_fn free_fn, void *ctx);
+
+
+/*
+ * avl_update_key() - Change the key of an element that is in the tree.  The
+ * node is found by identity, mutate is called, and if the new key still sits
+ * between the in-order neighbours nothing else happens.  Otherwise the same
+ * node is unlinked and relinked at its new place: no free, no malloc, and
+ * the node (and anything that points to it) stays valid.  The relink climbs
+ * from the old parent to the lowest subtree whose key range holds the new
+ * key and descends from there, so a move by d positions costs O(log d)
+ * comparisons or so after the search by identity (the path itself is
+ * retraced from the root by pointer, with no comparisons).
+ * 
+ *     Argument: avl_tree *tree
+ *          IN   Avl tree holding node
+ * 
+ *     Argument: avl_node *node
+ *          IN   Node to rekey (as returned by avl_insert())
+ * 
+ *     Argument: avl_mutate_fn mutate
+ *          IN   Called once to change the key
+ * 
+ *     Argument: void *ctx
+ *          IN   Context used for compare operations and passed to mutate
+ *
+ *       Return: int
+ *               AVL_SUCCESS, or AVL_ERROR if node is not (live) in the tree,
+ *               in which case mutate is not called
+ */
+int
+avl_update_key(avl_tree *tree, avl_node *node, avl_mutate_fn mutate, void *ctx);
+
+
+/*
+ * avl_compact() - Purge the tombstones of an AVL_TREE_LAZY tree.  Dead nodes
+ * are freed (the free function is called for them now, not at avl_remove()
+ * time) and the live nodes are relinked into a perfectly balanced tree in a
+ * single O(n) pass that needs no memory and no comparisons.  The library does
+ * no locking; a maintenance thread must hold the same lock as the writers.
+ * 
+ *     Argument: avl_tree *tree
+ *          IN   Avl tree to compact
+ * 
+ *     Argument: int ratio
+ *          IN   Only compact if dead nodes make up at least ratio percent of
+ *               the tree; 0 compacts whenever there is a tombstone.
+ * 
+ *       Return: int
+ *               Number of dead nodes purged
+ */
+int
+avl_compact(avl_tree *tree, int ratio);
+
+
+/*
+ * avl_set_capacity() - Bound the size of a tree.  Once an insert takes the
+ * tree past capacity, avl_insert() unlinks one element chosen by the policy
+ * and hands it to evict.  The minimum and maximum are reached without any
+ * comparisons; the oldest element is tracked in a FIFO of node pointers and
+ * found again with one O(log n) descent.  Equal keys are told apart by their
+ * place in the FIFO, which holds as long as they are inserted by avl_insert()
+ * (a key changed by avl_update_key() or a node linked by avl_path_link()
+ * costs a search of its run of equal keys when it is evicted).  avl_remove()
+ * and the avl_path functions keep the FIFO in step, and avl_path_link()
+ * evicts as well.
+ * 
+ *     Argument: avl_tree *tree
+ *          IN   Avl tree to bound (not an AVL_TREE_LAZY tree).  An
+ *               AVL_EVICT_OLDEST tree must be empty and not counted; with
+ *               the other policies the excess is evicted right away.
+ * 
+ *     Argument: int capacity
+ *          IN   Maximum number of elements, 0 to remove the bound.  At most
+ *               2^22 for AVL_EVICT_OLDEST.
+ * 
+ *     Argument: int policy
+ *          IN   Eviction policy (AVL_EVICT_*)
+ * 
+ *     Argument: avl_evict_fn evict
+ *          IN   Called for every evicted element.  If NULL, evicted
+ *               elements are freed like removed ones.
+ * 
+ *     Argument: void *ctx
+ *          IN   Context passed to evict
+ *
+ *       Return: int
+ *               AVL_SUCCESS, or AVL_ERROR if the bound cannot be applied
+ */
+int
+avl_set_capacity(avl_tree *tree, int capacity, int policy, avl_evict_fn evict, void *ctx);
+
+
+/*
+ * avl_optimize() - Rebuild an AVL_TREE_COUNTED tree so that frequently
+ * looked up keys sit near the root.  Each subtree root is the node closest
+ * to the weighted median of its key range (weight = access count + 1) that
+ * still allows a valid AVL tree, so the height stays within the AVL bound of
+ * 1.44 log n and later inserts and removes rebalance as usual.  The counts
+ * are halved afterwards, so the shape follows a changing distribution.
+ * O(n log n) time, O(n) temporary memory, no comparisons.
+ * 
+ *     Argument: avl_tree *tree
+ *          IN   Counted avl tree to reshape
+ *
+ *       Return: int
+ *               AVL_SUCCESS, or AVL_ERROR if the tree is not counted or
+ *               on memory error (the tree is left unchanged)
+ */
+int
+avl_optimize(avl_tree *tree);
+
+
+/*
+ * avl_set_hash() - Keep a hash table from keys to nodes next to the tree.
+ * avl_lookup() then finds exact matches with one hash probe (and one
+ * compare, to confirm) instead of a descent; ordered operations keep using
+ * the tree.  Insert and remove, and everything else that adds or drops
+ * nodes, keep the table in step, at the cost of one hash each.  If the table
+ * ever cannot grow it is dropped and lookups fall back to the tree.
+ * 
+ *     Argument: avl_tree *tree
+ *          IN   Avl tree to index; nodes already in it are indexed now
+ * 
+ *     Argument: avl_hash_fn hash
+ *          IN   Hash of element keys, NULL to drop the index
+ *
+ *       Return: int
+ *               AVL_SUCCESS, or AVL_ERROR on memory error
+ */
+int
+avl_set_hash(avl_tree *tree, avl_hash_fn hash);
+
+
+/*
+ * avl_set_augment() - Register an augmentation function.  The aggregates of
+ * all nodes already in the tree are computed right away (O(n)); from then on
+ * insert and remove keep them up to date in O(log n).
+ * 
+ *     Argument: avl_tree *tree
+ *          IN   Avl tree to augment (not an AVL_TREE_LAZY tree: tombstones
+ *               would still count in their subtrees' aggregates)
+ * 
+ *     Argument: avl_augment_fn augment
+ *          IN   Augmentation function, NULL to stop maintaining aggregates
+ * 
+ *     Argument: void *ctx
+ *          IN   Context passed to every call of augment
+ *
+ *       Return: int
+ *               AVL_SUCCESS, or AVL_ERROR for a lazy tree
+ */
+int
+avl_set_augment(avl_tree *tree, avl_augment_fn augment, void *ctx);
+
+
+/*
+ * avl_aggregate() - Decompose the key range [lo, hi] of an augmented tree
+ * into O(log n) whole subtrees and single nodes, passed to span in key order.
+ * Combining their aggregates gives the range sum / min / max etc.
+ * 
+ *     Argument: avl_tree *tree
+ *          IN   Augmented avl tree
+ * 
+ *     Argument: void *lo, void *hi
+ *          IN   Inclusive bounds (compared like avl_lookup() data); NULL
+ *               leaves that end of the range open
+ * 
+ *     Argument: avl_span_fn span
+ *          IN   Called for every piece of the range
+ * 
+ *     Argument: void *ctx
+ *          IN   Context used for compare operations and passed to span
+ *
+ *       Return: int
+ *               AVL_SUCCESS, or AVL_ERROR if span stopped the query
+ */
+int
+avl_aggregate(avl_tree *tree, void *lo, void *hi, avl_span_fn span, void *ctx);
+
+
+/*
+ * avl_stab() - Pruned in-order search of an augmented tree, for interval
+ * stabbing and similar queries.  For an interval tree keyed by start and
+ * augmented with the max end, reach(n) tests "max end of n's subtree >= point"
+ * and walk checks the end of n's own interval.
+ * 
+ *     Argument: avl_tree *tree
+ *          IN   Augmented avl tree
+ * 
+ *     Argument: void *point
+ *          IN   Only nodes comparing <= point are visited
+ * 
+ *     Argument: avl_prune_fn reach
+ *          IN   Subtrees for which reach returns 0 are skipped
+ * 
+ *     Argument: avl_walker_fn walk
+ *          IN   Called in key order for every visited node
+ * 
+ *     Argument: void *ctx
+ *          IN   Context used for compare operations, reach and walk
+ *
+ *       Return: int
+ *               AVL_SUCCESS, or AVL_ERROR if walk stopped the search
+ */
+int
+avl_stab(avl_tree *tree, void *point, avl_prune_fn reach, avl_walker_fn walk, void *ctx);
+
+
+/*
+ * avl_set_prefix() - Make a non-intrusive tree cache an 8-byte key prefix in
+ * every node.  Insert, remove and avl_lookup() then order nodes by comparing
+ * the cached prefixes, without touching user data, and only call the compare
+ * function when prefixes are equal.
+ * 
+ *     Argument: avl_tree *tree
+ *          IN   Empty, non-intrusive avl tree
+ * 
+ *     Argument: avl_prefix_fn prefix
+ *          IN   Order preserving key prefix function
+ *
+ *       Return: int
+ *               AVL_SUCCESS, or AVL_ERROR if the tree is intrusive or not
+ *               empty
+ */
+int
+avl_set_prefix(avl_tree *tree, avl_prefix_fn prefix);
+
+
+/*
+ * avl_set_merkle() - Make a non-intrusive tree keep, in every node, a hash of
+ * the elements of its subtree.  The hash is the sum of the element hashes,
+ * so two trees holding the same elements have the same root hash whatever
+ * their shapes.  Insert, remove and every rotation keep it up to date; an
+ * element changed in place must go through avl_update_key().
+ * 
+ *     Argument: avl_tree *tree
+ *          IN   Empty, non-intrusive, non-lazy avl tree with unique keys
+ * 
+ *     Argument: avl_hash_fn hash
+ *          IN   Hash of the whole element (key and contents), NULL to stop
+ *
+ *       Return: int
+ *               AVL_SUCCESS, or AVL_ERROR if the tree is intrusive, lazy or
+ *               not empty
+ */
+int
+avl_set_merkle(avl_tree *tree, avl_hash_fn hash);
+
+
+/*
+ * avl_merkle_root() - Hash of all elements of a Merkle-hashed tree, 0 if
+ * empty.  Replicas can compare it before they compare anything else.
+ */
+uint64_t
+avl_merkle_root(avl_tree *tree);
+
+
+/*
+ * avl_diff() - Report the differences between two Merkle-hashed trees with
+ * the same order and element hash.  Subtrees of a whose elements hash the
+ * same as the same key range of b are skipped, so the work grows with the
+ * number of differences d (O(d log^2 n)), not with the size of the trees.
+ * 
+ *     Argument: avl_tree *a, avl_tree *b
+ *          IN   Trees to compare, ordered by the compare function of a
+ * 
+ *     Argument: avl_diff_fn diff
+ *          IN   Called for each difference, in key order within a's subtrees
+ * 
+ *     Argument: void *ctx
+ *          IN   Context passed to diff and to the compare function
+ *
+ *       Return: int
+ *               Number of differences, or -1 if a tree is not Merkle-hashed
+ */
+int
+avl_diff(avl_tree *a, avl_tree *b, avl_diff_fn diff, void *ctx);
+
+
+/*
+ * avl_prefix_bytes() - Order preserving prefix of a byte string: its first
+ * 8 bytes, big-endian, zero padded.  Matches memcmp()/strcmp() order.
+ */
+uint64_t
+avl_prefix_bytes(const void *key, size_t len);
+
+
 /*
  * avl_size() - Get the size of an avl tree
  * 
@@ -308,5 +984,215 @@ int
 avl_validate(avl_tree *tree, avl_node *node, void *ctx);
 
 
+/*
+ * struct avl_path_t - Descent path for callers that search the tree with
+ * their own (typically inlined) comparison and only need the balancing core.
+ * 
+ *     Element: avl_node *up[]
+ *              Nodes visited from the root down
+ * 
+ *     Element: int upd[]
+ *              Direction taken at each visited node (0 left, 1 right)
+ * 
+ *     Element: int top
+ *              Number of nodes on the path.  The path designates the child
+ *              slot up[top-1]->child[upd[top-1]], or the root if top is 0.
+ */
+typedef struct avl_path_t {
+    avl_node *up[AVL_MAX_HEIGHT];
+    int       upd[AVL_MAX_HEIGHT];
+    int       top;
+} avl_path;
+
+
+/*
+ * avl_path_link() - Link a node into the (empty) slot designated by a path and
+ * rebalance.  The node is used as is, so the tree must be intrusive.
+ * 
+ *     Argument: avl_tree *tree
+ *          IN   Avl tree the path was recorded in
+ * 
+ *     Argument: avl_path *path
+ *          IN   Path to an empty slot
+ *          OUT  Path to the node after rebalancing (recorded without
+ *               comparisons), unless the node was evicted
+ * 
+ *     Argument: avl_node *node
+ *          IN   Node to link, it does not need to be initialized
+ *
+ *       Return: avl_node *
+ *               The node, or NULL if a capacity bound evicted it right away
+ *               (avl_set_capacity)
+ */
+avl_node *
+avl_path_link(avl_tree *tree, avl_path *path, avl_node *node);
+
+
+/*
+ * avl_path_unlink() - Unlink the node in the slot designated by a path and
+ * rebalance.  Neither the node nor its data is freed.
+ * 
+ *     Argument: avl_tree *tree
+ *          IN   Avl tree the path was recorded in
+ * 
+ *     Argument: avl_path *path
+ *          IN   Path to the node
+ *          OUT  Path to the in-order successor of the node after
+ *               rebalancing (recorded without comparisons), or top is -1 if
+ *               the node was the last one
+ * 
+ *       Return: avl_node *
+ *               The unlinked node
+ */
+avl_node *
+avl_path_unlink(avl_tree *tree, avl_path *path);
+
+
+/*
+ * struct avl_iter_t - In-order cursor.  Keeps the path to the current node,
+ * so stepping is amortized O(1) without parent pointers.  Any insert or
+ * remove invalidates the cursor.
+ * 
+ *     Element: avl_tree *tree
+ *              Avl tree being iterated
+ * 
+ *     Element: avl_node *up[]
+ *              Path from the root to the current node (inclusive)
+ * 
+ *     Element: int top
+ *              Path length; 0 once the cursor has run off either end
+ */
+typedef struct avl_iter_t {
+    avl_tree *tree;
+    avl_node *up[AVL_MAX_HEIGHT];
+    int       top;
+} avl_iter;
+
+
+/*
+ * avl_iter_first() / avl_iter_last() - Position a cursor on the smallest or
+ * largest live node of a tree.
+ * 
+ *     Argument: avl_iter *iter
+ *          OUT  Cursor to position
+ * 
+ *     Argument: avl_tree *tree
+ *          IN   Avl tree to iterate
+ * 
+ *       Return: void *
+ *               Avl node or user data at the cursor, NULL if tree is empty
+ */
+void *
+avl_iter_first(avl_iter *iter, avl_tree *tree);
+
+void *
+avl_iter_last(avl_iter *iter, avl_tree *tree);
+
+
+/*
+ * avl_iter_seek() - Position a cursor on the smallest live node that does not
+ * compare below data.
+ * 
+ *     Argument: void *data, void *ctx
+ *          IN   Key to seek and context for the compare function
+ * 
+ *       Return: void *
+ *               Avl node or user data at the cursor, NULL if every node is
+ *               below data
+ */
+void *
+avl_iter_seek(avl_iter *iter, avl_tree *tree, void *data, void *ctx);
+
+
+/*
+ * avl_iter_next() / avl_iter_prev() - Step a cursor to the next or previous
+ * live node.  Stepping back from the end (after the last node) positions the
+ * cursor on the last node.
+ * 
+ *     Argument: avl_iter *iter
+ *          IN   Cursor to step
+ * 
+ *       Return: void *
+ *               Avl node or user data at the cursor, NULL at the end
+ */
+void *
+avl_iter_next(avl_iter *iter);
+
+void *
+avl_iter_prev(avl_iter *iter);
+
+
+/*
+ * Opaque type for a merge iterator: an ordered scan over the union of several
+ * trees, without copying.  One cursor per tree feeds a loser tree, so each
+ * element costs about log2(n) compares.  The trees must not change while the
+ * iterator is in use.
+ */
+typedef struct avl_merge_iter_t avl_merge_iter;
+
+
+/*
+ * avl_merge_init() - Create a merge iterator over n trees.  The trees of an
+ * avl_multi_init() group are passed as &mtree[index].
+ * 
+ *     Argument: avl_tree *trees[], int n
+ *          IN   Trees to merge, all ordered the same way
+ * 
+ *     Argument: avl_compare_fn comp
+ *          IN   Compare function for two elements from any of the trees;
+ *               NULL to use the compare function of trees[0]
+ * 
+ *     Argument: avl_dup_fn dup
+ *          IN   Called for each element equal to one returned, which is
+ *               then skipped; NULL to return all equal elements, in tree
+ *               order
+ * 
+ *     Argument: void *ctx
+ *          IN   Context for comp, dup and the compare functions of the trees
+ * 
+ *       Return: avl_merge_iter *
+ *               Iterator or NULL if error (n < 1 or memory error)
+ */
+avl_merge_iter *
+avl_merge_init(avl_tree *trees[], int n, avl_compare_fn comp, avl_dup_fn dup, void *ctx);
+
+
+/*
+ * avl_merge_first() - Start a scan over the keys between lo and hi
+ * (inclusive).  Duplicates of an element are passed to dup before it is
+ * returned.
+ * 
+ *     Argument: void *lo, void *hi
+ *          IN   Range bounds (keys for the compare functions), NULL for no
+ *               bound
+ * 
+ *       Return: void *
+ *               Smallest element in range, NULL if none
+ */
+void *
+avl_merge_first(avl_merge_iter *merge, void *lo, void *hi);
+
+
+/*
+ * avl_merge_next() - Next element of the scan.
+ * 
+ *       Return: void *
+ *               Avl node or user data, NULL at the end of the range
+ */
+void *
+avl_merge_next(avl_merge_iter *merge);
+
+
+/*
+ * avl_merge_free() - Free a merge iterator (not the trees).
+ */
+void
+avl_merge_free(avl_merge_iter *merge);
+
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* _AVL_TREE_H_ */
 
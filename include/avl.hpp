@@ -0,0 +1,512 @@
+/*-----------------------------------------------------------------------------
+ * avl.hpp - C++ templates over the avl tree balancing core
+ *
+ * avl::tree<K, V, Compare, Alloc> is an ordered map that owns its nodes.
+ * avl::intrusive_tree<T, &T::hook, Compare> orders caller-owned objects that
+ * embed an avl_node.  Both do their own descent with an inlined Compare and
+ * hand the recorded path to avl_path_link() / avl_path_unlink(), so all the
+ * rebalancing (including AVL_TREE_WAVL) is shared with the C library.
+ *-----------------------------------------------------------------------------
+ */
+
+#ifndef _AVL_TREE_HPP_
+#define _AVL_TREE_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include "avl.h"
+
+
+namespace avl {
+
+namespace detail {
+
+template <class Traits, class Compare> class core;
+
+
+/*
+ * iterator - Bidirectional iterator over the nodes of a core.  It carries an
+ * avl_iter (the path to the current node), so ++ and -- are amortized O(1).
+ */
+template <class Traits, bool Const>
+class iterator {
+public:
+    typedef std::bidirectional_iterator_tag iterator_category;
+    typedef typename Traits::value_type value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef typename std::conditional<Const, const value_type *, value_type *>::type pointer;
+    typedef typename std::conditional<Const, const value_type &, value_type &>::type reference;
+
+    iterator() { it_.tree = 0; it_.top = 0; }
+    template <bool C, class = typename std::enable_if<Const && !C>::type>
+    iterator(const iterator<Traits, C> &other) : it_(other.it_) {}
+
+    reference operator*() const { return Traits::value(node()); }
+    pointer operator->() const { return &Traits::value(node()); }
+
+    iterator &operator++() { avl_iter_next(&it_); return *this; }
+    iterator &operator--() { avl_iter_prev(&it_); return *this; }
+    iterator operator++(int) { iterator old(*this); avl_iter_next(&it_); return old; }
+    iterator operator--(int) { iterator old(*this); avl_iter_prev(&it_); return old; }
+
+    friend bool operator==(const iterator &a, const iterator &b) { return a.node() == b.node(); }
+    friend bool operator!=(const iterator &a, const iterator &b) { return a.node() != b.node(); }
+
+private:
+    template <class, bool> friend class iterator;
+    template <class, class> friend class core;
+
+    avl_node *node() const { return it_.top ? it_.up[it_.top - 1] : 0; }
+
+    avl_iter it_;
+};
+
+
+/*
+ * core - Search, insert and erase shared by the owning and intrusive trees.
+ * Traits maps an avl_node to its value and a value to its key.
+ */
+template <class Traits, class Compare>
+class core : private Compare {
+public:
+    typedef typename Traits::key_type key_type;
+    typedef typename Traits::value_type value_type;
+    typedef Compare key_compare;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef value_type &reference;
+    typedef const value_type &const_reference;
+    typedef detail::iterator<Traits, false> iterator;
+    typedef detail::iterator<Traits, true> const_iterator;
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+    explicit core(const Compare &comp = Compare(), int options = AVL_TREE_DEFAULT)
+        : Compare(comp), tree_()
+    {
+        tree_.opts = AVL_TREE_INTRUSIVE | options;
+        tree_.n = 1;
+    }
+
+    size_type size() const { return tree_.size; }
+    bool empty() const { return tree_.size == 0; }
+    key_compare key_comp() const { return *this; }
+
+    iterator begin() { iterator i; avl_iter_first(&i.it_, tree()); return i; }
+    iterator end() { iterator i; i.it_.tree = tree(); return i; }
+    const_iterator begin() const { const_iterator i; avl_iter_first(&i.it_, tree()); return i; }
+    const_iterator end() const { const_iterator i; i.it_.tree = tree(); return i; }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+    reverse_iterator rbegin() { return reverse_iterator(end()); }
+    reverse_iterator rend() { return reverse_iterator(begin()); }
+    const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+    const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+    template <class K> iterator lower_bound(const K &key) { return bound<iterator>(key, 0); }
+    template <class K> iterator upper_bound(const K &key) { return bound<iterator>(key, 1); }
+    template <class K> const_iterator lower_bound(const K &key) const { return bound<const_iterator>(key, 0); }
+    template <class K> const_iterator upper_bound(const K &key) const { return bound<const_iterator>(key, 1); }
+
+    template <class K>
+    iterator find(const K &key)
+    {
+        iterator i = lower_bound(key);
+        return (i.node() && !less(key, Traits::key(*i))) ? i : end();
+    }
+
+    template <class K>
+    const_iterator find(const K &key) const
+    {
+        const_iterator i = lower_bound(key);
+        return (i.node() && !less(key, Traits::key(*i))) ? i : end();
+    }
+
+    template <class K> size_type count(const K &key) const { return find(key) != end(); }
+
+    /*
+     * rotations() - Rotations done so far by the balancing core
+     */
+    unsigned long rotations() const { return tree_.rotations; }
+
+protected:
+    /*
+     * descend() - Record the path to where key belongs (after any equal
+     * keys).  Returns the depth + 1 of the node holding an equal key, or 0.
+     * One comparison per level: the last node we went right at is the only
+     * candidate for equality.
+     */
+    template <class K>
+    int descend(const K &key, avl_path &path) const
+    {
+        avl_node *node = tree_.root;
+        int found = 0, dir;
+
+        path.top = 0;
+        while (node != 0) {
+            dir = !less(key, Traits::key(Traits::value(node)));
+            path.up[path.top] = node;
+            path.upd[path.top++] = dir;
+            if (dir) found = path.top;
+            node = node->child[dir];
+        }
+        if (found && less(Traits::key(Traits::value(path.up[found - 1])), key)) found = 0;
+        return found;
+    }
+
+    /*
+     * at() - Iterator at the depth-th node of a recorded path
+     */
+    iterator at(const avl_path &path, int depth)
+    {
+        iterator i;
+        i.it_.tree = tree();
+        i.it_.top = depth;
+        std::copy(path.up, path.up + depth, i.it_.up);
+        return i;
+    }
+
+    /*
+     * at() - Iterator at the node in the slot a path designates, as left by
+     * avl_path_link() / avl_path_unlink()
+     */
+    iterator at(avl_path &path)
+    {
+        if (path.top < 0) return end();
+        path.up[path.top] = path.top ? path.up[path.top - 1]->child[path.upd[path.top - 1]] : tree_.root;
+        return at(path, path.top + 1);
+    }
+
+    /*
+     * link() - Link a node with a unique key.  Returns the node in the tree
+     * holding the key and whether it is the given one.
+     */
+    std::pair<iterator, bool> link(avl_node *node)
+    {
+        avl_path path;
+        int found = descend(Traits::key(Traits::value(node)), path);
+
+        if (found) return std::make_pair(at(path, found), false);
+        avl_path_link(&tree_, &path, node);
+        return std::make_pair(at(path), true);
+    }
+
+    /*
+     * unlink() - Unlink the node an iterator points at; returns the node and
+     * moves the iterator to its successor
+     */
+    avl_node *unlink(iterator &pos)
+    {
+        avl_path path;
+        avl_node *node = pos.node();
+        int k;
+
+        for (k = 0; k + 1 < pos.it_.top; k++) {
+            path.up[k] = pos.it_.up[k];
+            path.upd[k] = pos.it_.up[k]->child[1] == pos.it_.up[k + 1];
+        }
+        path.top = k;
+
+        avl_path_unlink(&tree_, &path);
+        pos = at(path);
+        return node;
+    }
+
+    /*
+     * unlink() - Unlink the node holding key, or return NULL
+     */
+    template <class K>
+    avl_node *unlink(const K &key)
+    {
+        avl_path path;
+        int found = descend(key, path);
+
+        if (!found) return 0;
+        path.top = found - 1;
+        return avl_path_unlink(&tree_, &path);
+    }
+
+    /*
+     * release() - Detach all nodes, calling dispose on each of them.  Uses
+     * the same right rotations as avl_free() to avoid recursion.
+     */
+    template <class Dispose>
+    void release(Dispose dispose)
+    {
+        avl_node *node = tree_.root, *temp;
+
+        while (node != 0) {
+            if (node->child[0] == 0) {
+                temp = node->child[1];
+                dispose(node);
+            } else {
+                temp = node->child[0];
+                node->child[0] = temp->child[1];
+                temp->child[1] = node;
+            }
+            node = temp;
+        }
+        tree_.root = 0;
+        tree_.size = 0;
+    }
+
+    void swap_core(core &other)
+    {
+        std::swap(static_cast<Compare &>(*this), static_cast<Compare &>(other));
+        std::swap(tree_, other.tree_);
+    }
+
+    avl_tree *tree() const { return const_cast<avl_tree *>(&tree_); }
+
+    avl_tree tree_;
+
+private:
+    template <class A, class B>
+    bool less(const A &a, const B &b) const { return static_cast<const Compare &>(*this)(a, b); }
+
+    template <class I, class K>
+    I bound(const K &key, int upper) const
+    {
+        avl_node *node = tree_.root;
+        int depth = 0;
+        I i;
+
+        i.it_.tree = tree();
+        i.it_.top = 0;
+        while (node != 0) {
+            i.it_.up[i.it_.top++] = node;
+            if (upper ? less(key, Traits::key(Traits::value(node)))
+                      : !less(Traits::key(Traits::value(node)), key)) {
+                depth = i.it_.top;
+                node = node->child[0];
+            } else {
+                node = node->child[1];
+            }
+        }
+        i.it_.top = depth;
+        return i;
+    }
+};
+
+
+/*
+ * value_node - Node of an owning tree: the avl_node comes first, as in an
+ * intrusive C tree, followed by the value constructed in place
+ */
+template <class V>
+struct value_node : avl_node {
+    template <class... Args>
+    explicit value_node(Args &&... args) : value(std::forward<Args>(args)...) {}
+
+    V value;
+};
+
+
+template <class K, class V>
+struct map_traits {
+    typedef K key_type;
+    typedef std::pair<const K, V> value_type;
+
+    static value_type &value(avl_node *node) { return static_cast<value_node<value_type> *>(node)->value; }
+    static const K &key(const value_type &value) { return value.first; }
+};
+
+
+template <class T, avl_node T::*Hook>
+struct intrusive_traits {
+    typedef T key_type;
+    typedef T value_type;
+
+    static std::size_t offset()
+    {
+        return reinterpret_cast<std::size_t>(&(reinterpret_cast<T *>(64)->*Hook)) - 64;
+    }
+    static T &value(avl_node *node) { return *reinterpret_cast<T *>(reinterpret_cast<char *>(node) - offset()); }
+    static const T &key(const T &value) { return value; }
+};
+
+} /* namespace detail */
+
+
+/*
+ * tree - Ordered map with unique keys.  Nodes hold the value inline and are
+ * allocated through Alloc (rebound to the node type); emplace constructs the
+ * value in the node, so move-only values are never copied.
+ */
+template <class K, class V, class Compare = std::less<K>,
+          class Alloc = std::allocator<std::pair<const K, V> > >
+class tree : public detail::core<detail::map_traits<K, V>, Compare> {
+    typedef detail::core<detail::map_traits<K, V>, Compare> base;
+    typedef detail::value_node<typename base::value_type> node_type;
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<node_type> node_alloc;
+    typedef std::allocator_traits<node_alloc> node_traits;
+
+public:
+    typedef V mapped_type;
+    typedef Alloc allocator_type;
+    typedef typename base::value_type value_type;
+    typedef typename base::iterator iterator;
+    typedef typename base::const_iterator const_iterator;
+
+    explicit tree(const Compare &comp = Compare(), const Alloc &alloc = Alloc(),
+                  int options = AVL_TREE_DEFAULT)
+        : base(comp, options), alloc_(alloc) {}
+
+    tree(const tree &other)
+        : base(other.key_comp(), other.tree_.opts),
+          alloc_(node_traits::select_on_container_copy_construction(other.alloc_))
+    {
+        for (const_iterator i = other.begin(); i != other.end(); ++i) emplace(*i);
+    }
+
+    tree(tree &&other) : base(other.key_comp(), other.tree_.opts), alloc_(other.alloc_)
+    {
+        this->swap_core(other);
+    }
+
+    ~tree() { clear(); }
+
+    tree &operator=(tree other)
+    {
+        swap(other);
+        return *this;
+    }
+
+    void swap(tree &other)
+    {
+        using std::swap;
+        this->swap_core(other);
+        swap(alloc_, other.alloc_);
+    }
+
+    allocator_type get_allocator() const { return allocator_type(alloc_); }
+
+    template <class... Args>
+    std::pair<iterator, bool> emplace(Args &&... args)
+    {
+        node_type *node = create(std::forward<Args>(args)...);
+        std::pair<iterator, bool> result = this->link(node);
+
+        if (!result.second) destroy(node);
+        return result;
+    }
+
+    /*
+     * try_emplace() - Like emplace, but no node is built if key is present
+     */
+    template <class... Args>
+    std::pair<iterator, bool> try_emplace(const K &key, Args &&... args)
+    {
+        avl_path path;
+        int found = this->descend(key, path);
+
+        if (found) return std::make_pair(this->at(path, found), false);
+        avl_path_link(&this->tree_, &path, create(std::piecewise_construct, std::forward_as_tuple(key),
+                                                  std::forward_as_tuple(std::forward<Args>(args)...)));
+        return std::make_pair(this->at(path), true);
+    }
+
+    std::pair<iterator, bool> insert(const value_type &value) { return emplace(value); }
+    std::pair<iterator, bool> insert(value_type &&value) { return emplace(std::move(value)); }
+
+    V &operator[](const K &key) { return try_emplace(key).first->second; }
+
+    iterator erase(iterator pos)
+    {
+        destroy(static_cast<node_type *>(this->unlink(pos)));
+        return pos;
+    }
+
+    std::size_t erase(const K &key)
+    {
+        avl_node *node = this->unlink(key);
+
+        if (node == 0) return 0;
+        destroy(static_cast<node_type *>(node));
+        return 1;
+    }
+
+    void clear()
+    {
+        this->release([this](avl_node *node) { destroy(static_cast<node_type *>(node)); });
+    }
+
+private:
+    template <class... Args>
+    node_type *create(Args &&... args)
+    {
+        node_type *node = node_traits::allocate(alloc_, 1);
+
+        try {
+            node_traits::construct(alloc_, node, std::forward<Args>(args)...);
+        } catch (...) {
+            node_traits::deallocate(alloc_, node, 1);
+            throw;
+        }
+        return node;
+    }
+
+    void destroy(node_type *node)
+    {
+        node_traits::destroy(alloc_, node);
+        node_traits::deallocate(alloc_, node, 1);
+    }
+
+    node_alloc alloc_;
+};
+
+
+/*
+ * intrusive_tree - Ordered set of caller-owned objects with unique keys.  T
+ * embeds the avl_node named by Hook; Compare orders T objects (and any other
+ * key type it accepts for lookups).  The tree never allocates or frees.
+ */
+template <class T, avl_node T::*Hook, class Compare = std::less<T> >
+class intrusive_tree : public detail::core<detail::intrusive_traits<T, Hook>, Compare> {
+    typedef detail::core<detail::intrusive_traits<T, Hook>, Compare> base;
+
+public:
+    typedef typename base::iterator iterator;
+    typedef typename base::const_iterator const_iterator;
+
+    explicit intrusive_tree(const Compare &comp = Compare(), int options = AVL_TREE_DEFAULT)
+        : base(comp, options) {}
+
+    intrusive_tree(intrusive_tree &&other) : base(other.key_comp(), other.tree_.opts)
+    {
+        this->swap_core(other);
+    }
+
+    intrusive_tree(const intrusive_tree &) = delete;
+    intrusive_tree &operator=(const intrusive_tree &) = delete;
+
+    std::pair<iterator, bool> insert(T &value) { return this->link(&(value.*Hook)); }
+
+    iterator erase(iterator pos)
+    {
+        this->unlink(pos);
+        return pos;
+    }
+
+    /*
+     * erase() - Unlink the object holding value's key; returns it or NULL
+     */
+    T *erase(const T &value)
+    {
+        avl_node *node = this->unlink(value);
+        return node ? &detail::intrusive_traits<T, Hook>::value(node) : 0;
+    }
+
+    void clear() { this->release([](avl_node *) {}); }
+};
+
+} /* namespace avl */
+
+
+#endif /* _AVL_TREE_HPP_ */
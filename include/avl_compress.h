@@ -0,0 +1,161 @@
+/*-----------------------------------------------------------------------------
+ * avl_compress.h - Compressed read-only snapshots of avl trees
+ *
+ * avl_compress() copies the elements of a tree, in order, into blocks of
+ * AVL_COMPRESS_BLOCK records.  Integer keys are stored as varint deltas from
+ * the previous key, byte string keys as the length shared with the previous
+ * key plus the new suffix, and values as a varint length plus the bytes.  A
+ * sparse index holds the first key of each block, so a lookup is a binary
+ * search over blocks and a decode of at most one block.  There are no node
+ * pointers and no per-element allocations, so a cold tree of small records
+ * takes several times less memory than the live tree.
+ *
+ * The snapshot does not change and does not refer to the tree, which can be
+ * freed.  Lookups and scans only read it, so any number of threads may use
+ * it at once.
+ *-----------------------------------------------------------------------------
+ */
+
+#ifndef _AVL_COMPRESS_H_
+#define _AVL_COMPRESS_H_
+
+#include "avl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/*
+ * Opaque compressed snapshot type
+ */
+typedef struct avl_compressed_t avl_compressed;
+
+
+/*
+ * AVL_COMPRESS_BLOCK: Records per block
+ */
+#define AVL_COMPRESS_BLOCK 32
+
+
+/*
+ * Key types - Passed to avl_compress().
+ *
+ *     AVL_COMPRESS_BYTES: Byte string keys, ordered as by memcmp() with the
+ *                         shorter key first on a tie
+ *
+ *     AVL_COMPRESS_INT:   Unsigned 64-bit integer keys
+ */
+#define AVL_COMPRESS_BYTES 0x00000000
+#define AVL_COMPRESS_INT   0x00000001
+
+
+/*
+ * struct avl_record_t - One element as stored in a snapshot
+ *
+ *     Element: uint64_t ikey
+ *              Key of an AVL_COMPRESS_INT snapshot
+ *
+ *     Element: const void *key, size_t key_len
+ *              Key of an AVL_COMPRESS_BYTES snapshot
+ *
+ *     Element: const void *value, size_t value_len
+ *              Value bytes
+ */
+typedef struct avl_record_t {
+    uint64_t    ikey;
+    const void *key;
+    size_t      key_len;
+    const void *value;
+    size_t      value_len;
+} avl_record;
+
+
+/*
+ * avl_record_fn() - Describe a tree element as a record: fill in the key
+ * (ikey, or key and key_len) and the value.  The bytes must stay valid until
+ * the next call.
+ *
+ *     Argument: void *n
+ *          IN   Avl node or user data
+ *
+ *     Argument: avl_record *rec
+ *          OUT  Record of n
+ */
+typedef void (*avl_record_fn) (void *n, avl_record *rec);
+
+
+/*
+ * avl_compress() - Build a compressed snapshot of a tree.
+ *
+ *     Argument: avl_record_fn record
+ *          IN   Maps each element to its key and value
+ *
+ *     Argument: int options
+ *          IN   Key type (AVL_COMPRESS_*)
+ *
+ *       Return: avl_compressed *
+ *               Snapshot or NULL if error (the tree order does not match the
+ *               key order of the key type, or memory error)
+ */
+avl_compressed *
+avl_compress(avl_tree *tree, avl_record_fn record, int options);
+
+
+/*
+ * avl_compressed_free() - Free a snapshot.
+ */
+void
+avl_compressed_free(avl_compressed *packed);
+
+
+/*
+ * avl_compressed_lookup() - Find the value of a key.
+ *
+ *     Argument: const avl_record *key
+ *          IN   Key to look up (ikey, or key and key_len)
+ *
+ *     Argument: avl_record *rec
+ *          OUT  If found and not NULL, gets the value, which points into the
+ *               snapshot; the key fields are left alone
+ *
+ *       Return: int
+ *               AVL_SUCCESS if found, else AVL_ERROR
+ */
+int
+avl_compressed_lookup(avl_compressed *packed, const avl_record *key, avl_record *rec);
+
+
+/*
+ * avl_compressed_scan() - Call walk in key order with each record between
+ * lo and hi (inclusive).  The record, a const avl_record *, is only valid
+ * during the call.
+ *
+ *     Argument: const avl_record *lo, const avl_record *hi
+ *          IN   Range bounds, NULL for no bound
+ *
+ *       Return: int
+ *               AVL_SUCCESS, or AVL_ERROR if walk stopped the scan or on
+ *               memory error
+ */
+int
+avl_compressed_scan(avl_compressed *packed, const avl_record *lo, const avl_record *hi,
+                    avl_walker_fn walk, void *ctx);
+
+
+/*
+ * avl_compressed_size() / avl_compressed_bytes() - Number of records; bytes
+ * of memory the snapshot takes.
+ */
+int
+avl_compressed_size(avl_compressed *packed);
+
+size_t
+avl_compressed_bytes(avl_compressed *packed);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _AVL_COMPRESS_H_ */
@@ -0,0 +1,124 @@
+/*-----------------------------------------------------------------------------
+ * avl_fat.h - Bucketed ("fat node") avl trees
+ *
+ * Each avl node holds a small sorted array of element pointers (a bucket)
+ * instead of one element, and the tree is balanced over buckets.  Buckets
+ * split when they overflow and merge into a neighbour when they run low, so
+ * the tree has about bucket_size times fewer nodes and log2(bucket_size)
+ * fewer levels than a plain avl tree of the same elements, and a lookup
+ * touches far fewer cache lines.  Elements are unique, as in avl_tree.
+ *-----------------------------------------------------------------------------
+ */
+
+#ifndef _AVL_FAT_H_
+#define _AVL_FAT_H_
+
+#include "avl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/*
+ * Opaque bucketed tree type
+ */
+typedef struct avl_fat_t avl_fat;
+
+
+/*
+ * Bucket size limits.  AVL_FAT_DEFAULT is used when 0 is passed.
+ */
+#define AVL_FAT_MIN     4
+#define AVL_FAT_MAX     64
+#define AVL_FAT_DEFAULT 16
+
+
+/*
+ * avl_fat_init() - Create a new bucketed tree.
+ *
+ *     Argument: avl_compare_fn comp
+ *          IN   Comparison function, called with element pointers
+ *
+ *     Argument: avl_free_fn free_fn
+ *          IN   Free function called for each element when the tree is
+ *               destroyed or an element removed, NULL for none
+ *
+ *     Argument: int bucket_size
+ *          IN   Elements per bucket (AVL_FAT_MIN .. AVL_FAT_MAX), 0 for
+ *               the default
+ *
+ *       Return: avl_fat *
+ *               Newly created tree or NULL if error
+ */
+avl_fat *
+avl_fat_init(avl_compare_fn comp, avl_free_fn free_fn, int bucket_size);
+
+
+/*
+ * avl_fat_free() - Free a bucketed tree and (with free_fn) its elements.
+ */
+void
+avl_fat_free(avl_fat *tree);
+
+
+/*
+ * avl_fat_insert() - Insert an element.
+ *
+ *       Return: int
+ *               AVL_SUCCESS, or AVL_ERROR if an equal element is already in
+ *               the tree or on memory error
+ */
+int
+avl_fat_insert(avl_fat *tree, void *data, void *ctx);
+
+
+/*
+ * avl_fat_remove() - Remove the element equal to data.
+ *
+ *       Return: int
+ *               AVL_SUCCESS, or AVL_ERROR if there is none
+ */
+int
+avl_fat_remove(avl_fat *tree, void *data, void *ctx);
+
+
+/*
+ * avl_fat_lookup() - Find the element equal to data.
+ *
+ *       Return: void *
+ *               The element in the tree, NULL if none
+ */
+void *
+avl_fat_lookup(avl_fat *tree, void *data, void *ctx);
+
+
+/*
+ * avl_fat_walk() - In-order walk over the elements.
+ *
+ *       Return: int
+ *               AVL_SUCCESS, or AVL_ERROR if walk stopped the walk
+ */
+int
+avl_fat_walk(avl_fat *tree, avl_walker_fn walk, void *ctx);
+
+
+/*
+ * avl_fat_size() / avl_fat_buckets() / avl_fat_height() - Number of
+ * elements, number of buckets (tree nodes) and height of the bucket tree
+ */
+int
+avl_fat_size(avl_fat *tree);
+
+int
+avl_fat_buckets(avl_fat *tree);
+
+int
+avl_fat_height(avl_fat *tree);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _AVL_FAT_H_ */
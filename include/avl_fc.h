@@ -0,0 +1,96 @@
+/*-----------------------------------------------------------------------------
+ * avl_fc.h - Flat-combining front end for avl trees shared by many threads
+ *
+ * Each thread owns a slot (one cache line) where it publishes its request.
+ * Whichever thread gets the combiner lock applies every pending request of
+ * every slot in one batch, sorted by key, and hands back the results; the
+ * other threads only spin on their own slot.  The tree and its cache lines
+ * stay with one thread at a time instead of bouncing on every operation,
+ * and the lock changes hands once per batch instead of once per operation.
+ *
+ * The tree itself is unchanged and single-threaded; it must only be used
+ * through the front end while threads are attached.
+ *-----------------------------------------------------------------------------
+ */
+
+#ifndef _AVL_FC_H_
+#define _AVL_FC_H_
+
+#include "avl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/*
+ * Opaque flat-combining front end
+ */
+typedef struct avl_fc_t avl_fc;
+
+
+/*
+ * avl_fc_init() - Put a flat-combining front end on a tree.
+ *
+ *     Argument: avl_tree *tree
+ *          IN   Tree to share; it is not copied
+ *
+ *     Argument: int slots
+ *          IN   Maximum number of threads attached at the same time
+ *
+ *       Return: avl_fc *
+ *               Front end or NULL if error
+ */
+avl_fc *
+avl_fc_init(avl_tree *tree, int slots);
+
+
+/*
+ * avl_fc_free() - Free a front end.  The tree is not freed.
+ */
+void
+avl_fc_free(avl_fc *fc);
+
+
+/*
+ * avl_fc_attach() / avl_fc_detach() - Claim a slot for the calling thread,
+ * or give it back.  A slot must only be used by the thread that claimed it.
+ *
+ *       Return: int
+ *               Slot number, or -1 if all slots are taken
+ */
+int
+avl_fc_attach(avl_fc *fc);
+
+void
+avl_fc_detach(avl_fc *fc, int slot);
+
+
+/*
+ * avl_fc_insert() / avl_fc_remove() / avl_fc_lookup() - avl_insert(),
+ * avl_remove() and avl_lookup() through the combiner.  ctx is passed to the
+ * compare function as usual, including when the combiner sorts a batch.
+ */
+avl_node *
+avl_fc_insert(avl_fc *fc, int slot, void *data, void *ctx);
+
+int
+avl_fc_remove(avl_fc *fc, int slot, void *data, void *ctx);
+
+void *
+avl_fc_lookup(avl_fc *fc, int slot, void *data, void *ctx);
+
+
+/*
+ * avl_fc_batches() - Number of batches combined so far and, in *ops, the
+ * number of operations they held.  For tuning.
+ */
+unsigned long
+avl_fc_batches(avl_fc *fc, unsigned long *ops);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _AVL_FC_H_ */
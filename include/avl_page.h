@@ -0,0 +1,204 @@
+/*-----------------------------------------------------------------------------
+ * avl_page.h - Out-of-core avl trees in a paged file
+ *
+ * Nodes are fixed-size records (key, value, child ids, balance) in fixed-size
+ * pages of a local file, read and written through a bounded buffer cache
+ * with LRU eviction, so the tree can be much larger than memory.  A new node
+ * goes to the page of its parent when that page has room, so subtrees of
+ * several levels share a page and a descent faults in about one page per
+ * few levels instead of one per level.  Rotations break those subtrees up
+ * over time; avl_page_repack() rewrites the file to cluster them again.
+ *
+ * Keys and values are copied in and out; keys are unique.  The tree is not
+ * thread safe.  Nothing reaches the file before avl_page_sync() or
+ * avl_page_close() except pages evicted from the cache.
+ *-----------------------------------------------------------------------------
+ */
+
+#ifndef _AVL_PAGE_H_
+#define _AVL_PAGE_H_
+
+#include "avl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/*
+ * Opaque paged tree type
+ */
+typedef struct avl_page_t avl_page;
+
+
+/*
+ * AVL_PAGE_SIZE: Bytes per page of the file
+ */
+#define AVL_PAGE_SIZE 4096
+
+
+/*
+ * Paged tree options - Passed to avl_page_open().
+ *
+ *     AVL_PAGE_TRUNCATE: Start an empty tree even if the file holds one
+ *
+ *     AVL_PAGE_PREFETCH: On lookups, as soon as the descent picks a child
+ *                        on a page that is not cached, pread() that page
+ *                        into a spare frame outside the LRU list, which the
+ *                        next access takes over; the other child is never
+ *                        read.  Off by default.
+ */
+#define AVL_PAGE_TRUNCATE 0x00000001
+#define AVL_PAGE_PREFETCH 0x00000002
+
+
+/*
+ * struct avl_page_stats_t - Buffer cache counters, since open
+ *
+ *     Element: unsigned long hits, faults
+ *              Page accesses served by the cache, and those that had to
+ *              read the page from the file
+ *
+ *     Element: unsigned long writes
+ *              Dirty pages written back (on eviction or sync)
+ *
+ *     Element: unsigned long prefetches
+ *              Pages read ahead into the spare frame (AVL_PAGE_PREFETCH);
+ *              a page taken from there is not counted as a fault
+ *
+ *     Element: unsigned long pages
+ *              Pages in the file, header included
+ */
+typedef struct avl_page_stats_t {
+    unsigned long hits;
+    unsigned long faults;
+    unsigned long writes;
+    unsigned long prefetches;
+    unsigned long pages;
+} avl_page_stats;
+
+
+/*
+ * avl_page_open() - Open (or create) a paged tree.
+ *
+ *     Argument: const char *path
+ *          IN   File holding the tree
+ *
+ *     Argument: size_t key_size, size_t value_size
+ *          IN   Bytes per key and per value; must match the file if it
+ *               already holds a tree
+ *
+ *     Argument: avl_compare_fn comp
+ *          IN   Compare function, called with two keys (the first one in
+ *               the tree) and NULL; NULL to compare keys with memcmp()
+ *
+ *     Argument: int cache_pages
+ *          IN   Buffer cache size in pages (at least 4)
+ *
+ *     Argument: int options
+ *          IN   AVL_PAGE_* option bits
+ *
+ *       Return: avl_page *
+ *               Paged tree or NULL if error (I/O error, sizes do not match
+ *               the file, or a record does not fit in a page)
+ */
+avl_page *
+avl_page_open(const char *path, size_t key_size, size_t value_size, avl_compare_fn comp,
+              int cache_pages, int options);
+
+
+/*
+ * avl_page_close() - Write back every dirty page and close the tree.
+ *
+ *       Return: int
+ *               AVL_SUCCESS, or AVL_ERROR if a write failed
+ */
+int
+avl_page_close(avl_page *tree);
+
+
+/*
+ * avl_page_sync() - Write back every dirty page and the file header.
+ */
+int
+avl_page_sync(avl_page *tree);
+
+
+/*
+ * avl_page_insert() - Insert a copy of key and value.
+ *
+ *       Return: int
+ *               AVL_SUCCESS, or AVL_ERROR if key is in the tree already or
+ *               on I/O error
+ */
+int
+avl_page_insert(avl_page *tree, const void *key, const void *value);
+
+
+/*
+ * avl_page_lookup() - Find key and copy its value to value (if not NULL).
+ *
+ *       Return: int
+ *               AVL_SUCCESS if found, else AVL_ERROR
+ */
+int
+avl_page_lookup(avl_page *tree, const void *key, void *value);
+
+
+/*
+ * avl_page_remove() - Remove key.
+ *
+ *       Return: int
+ *               AVL_SUCCESS if it was in the tree, else AVL_ERROR
+ */
+int
+avl_page_remove(avl_page *tree, const void *key);
+
+
+/*
+ * avl_page_walk() - Call walk in key order with each record (the key, then
+ * the value).  The record is only valid during the call, and walk must not
+ * use the tree.
+ *
+ *       Return: int
+ *               AVL_SUCCESS, or AVL_ERROR if walk stopped the walk
+ */
+int
+avl_page_walk(avl_page *tree, avl_walker_fn walk, void *ctx);
+
+
+/*
+ * avl_page_repack() - Rewrite the file so that every page holds the top
+ * levels of one subtree in breadth-first order, and subtrees small enough
+ * share pages whole; a lookup then reads one page per log2(slots) levels
+ * or so.  The new file is written beside the old one (path + ".repack")
+ * and renamed over it, so a failure leaves the tree as it was.  Dirty
+ * pages are carried over without being written back to the old file.
+ *
+ *       Return: int
+ *               AVL_SUCCESS, or AVL_ERROR on I/O error or out of memory
+ */
+int
+avl_page_repack(avl_page *tree);
+
+
+/*
+ * avl_page_size() / avl_page_validate() / avl_page_counters() - Number of
+ * keys; check order and balance of every node (AVL_SUCCESS if valid); get
+ * the buffer cache counters.
+ */
+int
+avl_page_size(avl_page *tree);
+
+int
+avl_page_validate(avl_page *tree);
+
+void
+avl_page_counters(avl_page *tree, avl_page_stats *stats);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _AVL_PAGE_H_ */
@@ -0,0 +1,128 @@
+/*-----------------------------------------------------------------------------
+ * avl_perf.h - Hardware counter instrumentation for tree benchmarks
+ *
+ * A region brackets a batch of operations of one kind (e.g. NNN lookups)
+ * with avl_perf_begin() / avl_perf_end(); the counters read at both ends are
+ * accumulated per region and reported as averages per operation.  Counters
+ * come from Linux perf_event_open(), user space only.  Events the kernel or
+ * the machine does not offer (no PMU in a VM, perf_event_paranoid too high,
+ * not Linux at all) are reported as "-"; elapsed time is always measured.
+ *
+ * Reading counters costs system calls, so regions should hold many
+ * operations rather than wrap single calls.
+ *-----------------------------------------------------------------------------
+ */
+
+#ifndef _AVL_PERF_H_
+#define _AVL_PERF_H_
+
+#include <stdio.h>
+#include "avl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/*
+ * Opaque counter set
+ */
+typedef struct avl_perf_t avl_perf;
+
+
+/*
+ * Regions - One per kind of tree operation
+ */
+enum {
+    AVL_PERF_INSERT,
+    AVL_PERF_LOOKUP,
+    AVL_PERF_REMOVE,
+    AVL_PERF_WALK,
+    AVL_PERF_REGIONS
+};
+
+
+/*
+ * Events - What is counted in every region
+ *
+ *     AVL_PERF_NSEC:          Elapsed nanoseconds (always available)
+ *     AVL_PERF_INSTRUCTIONS:  Instructions retired
+ *     AVL_PERF_CACHE_MISSES:  Last level cache misses
+ *     AVL_PERF_TLB_MISSES:    Data TLB read misses
+ *     AVL_PERF_BRANCH_MISSES: Mispredicted branches
+ *     AVL_PERF_PAGE_FAULTS:   Page faults (software event)
+ */
+enum {
+    AVL_PERF_NSEC,
+    AVL_PERF_INSTRUCTIONS,
+    AVL_PERF_CACHE_MISSES,
+    AVL_PERF_TLB_MISSES,
+    AVL_PERF_BRANCH_MISSES,
+    AVL_PERF_PAGE_FAULTS,
+    AVL_PERF_EVENTS
+};
+
+
+/*
+ * avl_perf_init() - Open the counters of the calling thread.
+ *
+ *       Return: avl_perf *
+ *               Counter set (possibly with no hardware events), or NULL on
+ *               memory error
+ */
+avl_perf *
+avl_perf_init(void);
+
+
+/*
+ * avl_perf_free() - Close the counters.
+ */
+void
+avl_perf_free(avl_perf *perf);
+
+
+/*
+ * avl_perf_available() - Tell whether an event is counted.
+ */
+int
+avl_perf_available(avl_perf *perf, int event);
+
+
+/*
+ * avl_perf_begin() / avl_perf_end() - Open and close a region.  Regions do
+ * not nest; ops is the number of operations done in between.
+ */
+void
+avl_perf_begin(avl_perf *perf, int region);
+
+void
+avl_perf_end(avl_perf *perf, int region, unsigned long ops);
+
+
+/*
+ * avl_perf_average() - Average count of event per operation of region.
+ *
+ *       Return: double
+ *               Average, or -1 if the event is not available or the region
+ *               has seen no operations
+ */
+double
+avl_perf_average(avl_perf *perf, int region, int event);
+
+
+/*
+ * avl_perf_report() - Print one line of per-operation averages for each
+ * region that has seen operations, then clear all regions.
+ *
+ *     Argument: const char *name
+ *          IN   Label of the lines (e.g. the tree variant measured)
+ */
+void
+avl_perf_report(avl_perf *perf, FILE *out, const char *name);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _AVL_PERF_H_ */
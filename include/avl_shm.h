@@ -0,0 +1,154 @@
+/*-----------------------------------------------------------------------------
+ * avl_shm.h - Position independent avl trees in shared memory
+ *
+ * The tree lives entirely inside a caller supplied memory region (typically
+ * from shm_open() + mmap(), or a MAP_SHARED mapping inherited across fork()).
+ * Nodes link to each other by offset from the region start instead of by
+ * pointer, so every process can map the region at a different address.
+ * Items are fixed size and stored inline in the nodes.
+ *
+ * Writers serialize on a process-shared mutex kept in the region.  Lookups do
+ * not take it: they read under a sequence lock and retry if a writer ran
+ * concurrently, so one writer and many reader processes share one copy.
+ * The mutex is robust: if a process dies holding it, whichever process takes
+ * it next rebuilds the tree (O(n log n), calling the compare function with a
+ * NULL context) and carries on.  The item of an insert or remove cut short
+ * that way is dropped.
+ *-----------------------------------------------------------------------------
+ */
+
+#ifndef _AVL_SHM_H_
+#define _AVL_SHM_H_
+
+#include <stddef.h>
+#include "avl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/*
+ * Opaque per-process handle on a shared tree.  The compare function is a
+ * per-process pointer, so it is kept here and not in the shared region.
+ */
+typedef struct avl_shm_t avl_shm;
+
+
+/*
+ * avl_shm_create() - Format a memory region as an empty shared tree.
+ *
+ *     Argument: void *region
+ *          IN   Start of the region, 8 byte aligned
+ *
+ *     Argument: size_t size
+ *          IN   Size of the region.  Header and nodes are carved out of it;
+ *               inserts fail once it is full.
+ *
+ *     Argument: size_t item_size
+ *          IN   Size of the items stored in the tree
+ *
+ *     Argument: avl_compare_fn comp
+ *          IN   Comparison function, called with pointers to items.  It may
+ *               see a torn item during an optimistic lookup (the result is
+ *               discarded), so it must not follow pointers inside items.
+ *
+ *       Return: avl_shm *
+ *               Handle for this process or NULL if error
+ */
+avl_shm *
+avl_shm_create(void *region, size_t size, size_t item_size, avl_compare_fn comp);
+
+
+/*
+ * avl_shm_attach() - Attach to a region formatted by avl_shm_create(), in
+ * this or any other process and at any address.
+ *
+ *     Argument: void *region
+ *          IN   Start of the region as mapped in this process
+ *
+ *     Argument: avl_compare_fn comp
+ *          IN   Comparison function (same ordering as the creator's)
+ *
+ *       Return: avl_shm *
+ *               Handle for this process or NULL if the region is not a tree
+ */
+avl_shm *
+avl_shm_attach(void *region, avl_compare_fn comp);
+
+
+/*
+ * avl_shm_detach() - Release a handle.  The region and tree are untouched.
+ */
+void
+avl_shm_detach(avl_shm *shm);
+
+
+/*
+ * avl_shm_insert() - Copy an item into the tree.
+ *
+ *     Argument: void *item
+ *          IN   Item to copy (item_size bytes)
+ *
+ *     Argument: void *ctx
+ *          IN   Context used for compare operations during insert
+ *
+ *       Return: int
+ *               AVL_SUCCESS, or AVL_ERROR if the region is full
+ */
+int
+avl_shm_insert(avl_shm *shm, void *item, void *ctx);
+
+
+/*
+ * avl_shm_remove() - Remove the item matching key; its node is recycled.
+ *
+ *       Return: int
+ *               AVL_SUCCESS, or AVL_ERROR if no item matches
+ */
+int
+avl_shm_remove(avl_shm *shm, void *key, void *ctx);
+
+
+/*
+ * avl_shm_lookup() - Find the item matching key and copy it out.  Lock free
+ * for readers; retries while a writer is active.
+ *
+ *     Argument: void *key
+ *          IN   Item to look for (passed as second argument to comp)
+ *
+ *     Argument: void *out
+ *          OUT  Receives a copy of the matching item, may be NULL
+ *
+ *       Return: int
+ *               AVL_SUCCESS if found, AVL_ERROR if not
+ */
+int
+avl_shm_lookup(avl_shm *shm, void *key, void *out, void *ctx);
+
+
+/*
+ * avl_shm_walk() - In-order walk under the writer lock.  The walker gets a
+ * pointer to each item inside the region.
+ */
+int
+avl_shm_walk(avl_shm *shm, avl_walker_fn walk, void *ctx);
+
+
+/*
+ * avl_shm_size() / avl_shm_validate() - Number of items in the tree; check,
+ * under the writer lock, the order and AVL balance of every node and the
+ * item count (AVL_SUCCESS if valid).
+ */
+int
+avl_shm_size(avl_shm *shm);
+
+int
+avl_shm_validate(avl_shm *shm, void *ctx);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _AVL_SHM_H_ */
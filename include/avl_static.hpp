@@ -0,0 +1,204 @@
+/*-----------------------------------------------------------------------------
+ * avl_static.hpp - Lookup tables built at compile time
+ *
+ * avl::static_map<K, V, N, Compare> is a read-only map built by a constexpr
+ * constructor from a sorted array of entries.  The entries are stored in
+ * Eytzinger order (the balanced search tree laid out breadth first: the
+ * children of slot k are slots 2k and 2k+1), so a constexpr table sits in
+ * read-only data, costs nothing at startup and needs no pointers.  find() is
+ * constexpr and can be used in static_assert; lookup() is the branch-free
+ * runtime descent, whose fixed trip count lets the compiler unroll it.
+ *
+ * K and V must be literal types and Compare needs a constexpr operator().
+ *-----------------------------------------------------------------------------
+ */
+
+#ifndef _AVL_STATIC_HPP_
+#define _AVL_STATIC_HPP_
+
+#include <cstddef>
+#include <stdexcept>
+
+
+namespace avl {
+
+/*
+ * entry - Key / value pair of a static_map initializer
+ */
+template <class K, class V>
+struct entry {
+    K key;
+    V value;
+};
+
+
+/*
+ * static_less - Default order of a static_map (std::less is not constexpr
+ * before C++14)
+ */
+template <class K>
+struct static_less {
+    constexpr bool operator()(const K &a, const K &b) const { return a < b; }
+};
+
+
+namespace detail {
+
+template <std::size_t... I> struct index_seq {};
+
+template <class A, class B> struct index_cat;
+
+template <std::size_t... I, std::size_t... J>
+struct index_cat<index_seq<I...>, index_seq<J...> > {
+    typedef index_seq<I..., (sizeof...(I) + J)...> type;
+};
+
+/*
+ * make_index_seq - 0 .. N-1, built by halves so the instantiation depth is
+ * log N rather than N
+ */
+template <std::size_t N>
+struct make_index_seq {
+    typedef typename index_cat<typename make_index_seq<N / 2>::type,
+                               typename make_index_seq<N - N / 2>::type>::type type;
+};
+
+template <> struct make_index_seq<0> { typedef index_seq<> type; };
+template <> struct make_index_seq<1> { typedef index_seq<0> type; };
+
+
+/*
+ * eytzinger_size() - Number of slots in the subtree of slot k of an n-slot
+ * table, one level (of width slots, starting at slot k) at a time
+ */
+constexpr std::size_t
+eytzinger_size(std::size_t k, std::size_t n, std::size_t width = 1)
+{
+    return k > n ? 0 : (n - k + 1 < width ? n - k + 1 : width) + eytzinger_size(2 * k, n, 2 * width);
+}
+
+
+/*
+ * eytzinger_rank() - Sorted position of the entry that goes to slot k: a
+ * right child follows its parent and the left subtree of the child, a left
+ * child precedes its parent by the right subtree of the child
+ */
+constexpr std::size_t
+eytzinger_rank(std::size_t k, std::size_t n)
+{
+    return k == 1 ? eytzinger_size(2, n)
+         : k % 2  ? eytzinger_rank(k / 2, n) + 1 + eytzinger_size(2 * k, n)
+                  : eytzinger_rank(k / 2, n) - 1 - eytzinger_size(2 * k + 1, n);
+}
+
+
+/*
+ * eytzinger_levels() - Levels of an n-slot table
+ */
+constexpr std::size_t
+eytzinger_levels(std::size_t n)
+{
+    return n ? 1 + eytzinger_levels(n / 2) : 0;
+}
+
+
+/*
+ * ascending() - Keys of e[lo, hi) strictly ascending, checked by halves so
+ * the recursion depth is log N
+ */
+template <class Compare, class E>
+constexpr bool
+ascending(const E *e, std::size_t lo, std::size_t hi)
+{
+    return hi - lo < 2 ||
+           (ascending<Compare>(e, lo, lo + (hi - lo) / 2) &&
+            Compare()(e[lo + (hi - lo) / 2 - 1].key, e[lo + (hi - lo) / 2].key) &&
+            ascending<Compare>(e, lo + (hi - lo) / 2, hi));
+}
+
+} /* namespace detail */
+
+
+template <class K, class V, std::size_t N, class Compare = static_less<K> >
+class static_map {
+public:
+    typedef K key_type;
+    typedef V mapped_type;
+    typedef entry<K, V> value_type;
+
+    /*
+     * static_map() - Build from entries sorted by key, without duplicates.
+     * Unsorted input fails to compile in a constant expression and throws
+     * std::logic_error at run time.
+     */
+    constexpr static_map(const value_type (&sorted)[N])
+        : static_map(sorted, typename detail::make_index_seq<N>::type()) {}
+
+    constexpr std::size_t size() const { return N; }
+
+    /*
+     * find() - Value of key or NULL, usable in constant expressions
+     */
+    constexpr const V *find(const K &key) const { return find_r(key, 1); }
+
+    /*
+     * lookup() - Same as find(), for run time: descend all levels without
+     * branching on the result of a compare, then take the last slot where
+     * the descent went left (the lower bound) and check it for equality
+     */
+    const V *lookup(const K &key) const
+    {
+        std::size_t k = 1;
+
+        for (std::size_t level = 0; level < levels; level++) {
+            k = k <= N ? 2 * k + Compare()(slot_[k - 1].key, key) : k;
+        }
+        k >>= __builtin_ctzll(~(unsigned long long)k) + 1;
+
+        return k && !Compare()(key, slot_[k - 1].key) ? &slot_[k - 1].value : 0;
+    }
+
+    /*
+     * slot() - Entry in slot k (1 .. N) of the Eytzinger layout
+     */
+    constexpr const value_type &slot(std::size_t k) const { return slot_[k - 1]; }
+
+private:
+    static const std::size_t levels = detail::eytzinger_levels(N);
+
+    template <std::size_t... I>
+    constexpr static_map(const value_type (&sorted)[N], detail::index_seq<I...>)
+        : slot_{ checked(sorted, I == 0)[detail::eytzinger_rank(I + 1, N)]... } {}
+
+    static constexpr const value_type *checked(const value_type (&sorted)[N], bool check)
+    {
+        return !check || detail::ascending<Compare>(sorted, 0, N)
+               ? sorted : throw std::logic_error("avl::static_map: keys not sorted");
+    }
+
+    constexpr const V *find_r(const K &key, std::size_t k) const
+    {
+        return k > N ? 0
+             : Compare()(key, slot_[k - 1].key) ? find_r(key, 2 * k)
+             : Compare()(slot_[k - 1].key, key) ? find_r(key, 2 * k + 1)
+             : &slot_[k - 1].value;
+    }
+
+    value_type slot_[N];
+};
+
+
+/*
+ * make_static_map() - static_map of the default order, sized from the array
+ */
+template <class K, class V, std::size_t N>
+constexpr static_map<K, V, N>
+make_static_map(const entry<K, V> (&sorted)[N])
+{
+    return static_map<K, V, N>(sorted);
+}
+
+} /* namespace avl */
+
+
+#endif /* _AVL_STATIC_HPP_ */
@@ -6,37 +6,14 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 #include <assert.h>
+#include <pthread.h>
 #include "avl.h"
 #include "avl_private.h"
 
 
-/*
- * Two way single rotation 
- */
-#define avl_single(root, dir) do {                     \
-    avl_node *save = root->child[!dir];                \
-    root->child[!dir] = save->child[dir];              \
-    save->child[dir] = root;                           \
-    root = save;                                       \
-} while (0)
-
-
-/*
- * Two way double rotation 
- */
-#define avl_double(root, dir) do {                     \
-    avl_node *save = root->child[!dir]->child[dir];    \
-    root->child[!dir]->child[dir] = save->child[!dir]; \
-    save->child[!dir] = root->child[!dir];             \
-    root->child[!dir] = save;                          \
-    save = root->child[!dir];                          \
-    root->child[!dir] = save->child[dir];              \
-    save->child[dir] = root;                           \
-    root = save;                                       \
-} while (0)
-
-
 /*
  * Adjust balance before double rotation 
  */
@@ -59,15 +36,15 @@
 /*
  * Rebalance after insertion 
  */
-#define avl_insert_balance(root, dir) do {             \
+#define avl_insert_balance(tree, root, dir) do {       \
     avl_node *n = root->child[dir];                    \
     int bal = dir == 0 ? -1 : +1;                      \
     if ( n->balance == bal ) {                         \
         root->balance = n->balance = 0;                \
-        avl_single ( root, !dir );                     \
+        avl_single ( tree, root, !dir );               \
     } else {                                           \
         avl_adjust_balance ( root, dir, bal );         \
-        avl_double ( root, !dir );                     \
+        avl_double ( tree, root, !dir );               \
     }                                                  \
 } while (0)
 
@@ -75,20 +52,20 @@
 /* 
  * Rebalance after deletion 
  */
-#define avl_remove_balance(root, dir, done) do {       \
+#define avl_remove_balance(tree, root, dir, done) do { \
     avl_node *n = root->child[!dir];                   \
     int bal = dir == 0 ? -1 : +1;                      \
     if ( n->balance == -bal ) {                        \
         root->balance = n->balance = 0;                \
-        avl_single ( root, dir );                      \
+        avl_single ( tree, root, dir );                \
     }                                                  \
     else if ( n->balance == bal ) {                    \
         avl_adjust_balance ( root, !dir, -bal );       \
-        avl_double ( root, dir );                      \
+        avl_double ( tree, root, dir );                \
     } else {                                           \
         root->balance = -bal;                          \
         n->balance = bal;                              \
-        avl_single ( root, dir );                      \
+        avl_single ( tree, root, dir );                \
         done = 1;                                      \
     }                                                  \
 } while (0)
@@ -101,25 +78,31 @@
     if (tree->free) {                                  \
         tree->free(AVL_DATA(node, tree));              \
     }                                                  \
-    if ((tree->opts & AVL_INTR) == 0) {                \
-        free(node);                                    \
-    }                                                  \
+    AVL_FREE_NODE(tree, node);                         \
 } while (0)
 
 
 /*
- * Create new avl node for insertion if tree is non-intrusive
+ * Create new avl node for insertion if tree is non-intrusive.  Inline trees
+ * copy the element after the data pointer (and the cached prefix and Merkle
+ * hash), at the next 8-byte boundary, and point data[0] at the copy, so
+ * AVL_DATA() works the same for both layouts.
  */
 static avl_node *
 avl_new_node(avl_tree *tree, void *data)
 {
     avl_node *node;
-    size_t    size = sizeof(avl_node) + sizeof(void*);
+    size_t    size = AVL_ITEM_OFFSET(tree);
 
-    node = (avl_node *) malloc(size);
+    node = (avl_node *) malloc(size + tree->item);
     if (node == NULL) return NULL;
     node->balance = 0;
-    node->data[0] = data;
+    node->flags = 0;
+    if (tree->item) {
+        node->data[0] = memcpy((char *)node + size, data, tree->item);
+    } else {
+        node->data[0] = data;
+    }
     node->child[0] = node->child[1] = NULL;
 
     return node;
@@ -139,13 +122,13 @@ avl_walk_internal(avl_tree *r, avl_node *n, avl_walker_fn w, void *c, int t)
     switch (t) {
     case AVL_WALK_INORDER:
         if (!avl_walk_internal(r, n->child[0], w, c, t)) return AVL_ERROR;
-        if (!w(AVL_DATA(n, r), c)) return AVL_ERROR;
+        if (!(n->flags & AVL_DEAD) && !w(AVL_DATA(n, r), c)) return AVL_ERROR;
         if (!avl_walk_internal(r, n->child[1], w, c, t)) return AVL_ERROR;
         return AVL_SUCCESS;
         break;
 
     case AVL_WALK_PREORDER:
-        if (!w(AVL_DATA(n, r), c)) return AVL_ERROR;
+        if (!(n->flags & AVL_DEAD) && !w(AVL_DATA(n, r), c)) return AVL_ERROR;
         if (!avl_walk_internal(r, n->child[0], w, c, t)) return AVL_ERROR;
         if (!avl_walk_internal(r, n->child[1], w, c, t)) return AVL_ERROR;
         return AVL_SUCCESS;
@@ -164,6 +147,33 @@ avl_walk_internal(avl_tree *r, avl_node *n, avl_walker_fn w, void *c, int t)
 }
 
 
+/*
+ * avl_lookup_live() - Find a live node matching data below node.  Equal keys
+ * can end up on either side of a tombstone after rotations, so both subtrees
+ * of a dead match are searched.
+ */
+static avl_node *
+avl_lookup_live(avl_tree *tree, avl_node *node, avl_compare_fn cmp, void *data, void *ctx)
+{
+    avl_node *live;
+    int comp;
+
+    while ( node != NULL ) {
+        comp = cmp( AVL_DATA(node, tree), data, ctx );
+        if (comp == 0) {
+            if ((node->flags & AVL_DEAD) == 0) return node;
+            live = avl_lookup_live(tree, node->child[0], cmp, data, ctx);
+            if (live) return live;
+            node = node->child[1];
+        } else {
+            node = node->child[comp < 0];
+        }
+    }
+
+    return NULL;
+}
+
+
 avl_tree *
 avl_init(avl_compare_fn comp_fn, avl_free_fn free_fn, int options)
 {
@@ -178,11 +188,37 @@ avl_init(avl_compare_fn comp_fn, avl_free_fn free_fn, int options)
     tree->size = 0;
     tree->idx = 0;
     tree->n = 1;
+    tree->dead = 0;
+    tree->rotations = 0;
+    tree->augment = NULL;
+    tree->augment_ctx = NULL;
+    tree->prefix = NULL;
+    tree->bound = NULL;
+    tree->sample = 0;
+    tree->hash = NULL;
+    tree->item = 0;
+    tree->merkle = NULL;
+    tree->block = NULL;
+    tree->block_size = 0;
     
     return tree;
 }
 
 
+avl_tree *
+avl_init_inline(avl_compare_fn comp_fn, avl_free_fn free_fn, int options, size_t item_size)
+{
+    avl_tree *tree;
+
+    if (item_size == 0 || (options & AVL_INTR)) return NULL;
+
+    tree = avl_init(comp_fn, free_fn, options);
+    if (tree) tree->item = item_size;
+
+    return tree;
+}
+
+
 avl_tree *
 avl_multi_init(avl_compare_fn comp_fn[], avl_free_fn free_fn[], int n, int opt)
 {
@@ -209,13 +245,28 @@ avl_multi_init(avl_compare_fn comp_fn[], avl_free_fn free_fn[], int n, int opt)
 
 void 
 avl_free(avl_tree *tree)
+{
+    avl_free_step(tree, INT_MAX);
+}
+
+
+/*
+ * Nodes are freed in order: the root is rotated right until it has no left
+ * child, freed, and its right child becomes the root.  The only state is the
+ * root, so the teardown can stop after any node and resume later.
+ */
+int
+avl_free_step(avl_tree *tree, int budget)
 {
     avl_node *node = tree->root, *temp;
 
-    while ( node != NULL ) {
+    while ( node != NULL && budget > 0 ) {
         if (node->child[0] == NULL) {
             temp = node->child[1];
+            if (node->flags & AVL_DEAD) tree->dead--;
+            else                        tree->size--;
             avl_free_node(node, tree);
+            budget--;
         } else {
             temp = node->child[0];
             node->child[0] = temp->child[1];
@@ -223,7 +274,51 @@ avl_free(avl_tree *tree)
         }
         node = temp;
     }
+    tree->root = node;
+
+    if (node != NULL) return tree->size + tree->dead;
+
+    avl_bound_free(tree);
+    avl_hash_free(tree);
+    free(tree->block);
     free(tree);
+    return 0;
+}
+
+
+static void *
+avl_free_thread(void *tree)
+{
+    avl_free((avl_tree *)tree);
+    return NULL;
+}
+
+
+int
+avl_free_async(avl_tree *tree)
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+    int rc;
+
+    /* nothing to hand off for an empty tree */
+    if (tree->root == NULL) {
+        avl_free(tree);
+        return AVL_SUCCESS;
+    }
+    if (pthread_attr_init(&attr) != 0) {
+        avl_free(tree);
+        return AVL_ERROR;
+    }
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    rc = pthread_create(&thread, &attr, avl_free_thread, tree);
+    pthread_attr_destroy(&attr);
+    if (rc != 0) {
+        avl_free(tree);
+        return AVL_ERROR;
+    }
+
+    return AVL_SUCCESS;
 }
 
 
@@ -231,15 +326,29 @@ void *
 avl_lookup(avl_tree *tree, void *data, void *ctx)
 {
     avl_node *node = tree->root;
+    uint64_t pfx;
     int comp;
 
+    if (tree->hash) {
+        node = avl_hash_find(tree, data, ctx);
+        if (node == NULL) return NULL;
+        AVL_COUNT_ACCESS(tree, node);
+        return (void*) AVL_DATA(node, tree);
+    }
+
+    pfx = tree->prefix ? tree->prefix(data) : 0;
     while ( node != NULL ) {
-        comp = tree->comp( AVL_DATA(node, tree), data, ctx );
+        comp = AVL_COMPARE( tree, node, data, pfx, ctx );
         if (comp == 0) break;
         node = node->child[comp < 0];
     }
 
+    if (node && (node->flags & AVL_DEAD)) {
+        node = avl_lookup_live(tree, node, tree->comp, data, ctx);
+    }
+
     if (node) {
+        AVL_COUNT_ACCESS(tree, node);
         return (void*) AVL_DATA(node, tree);
     }
 
@@ -259,7 +368,12 @@ avl_lookup_compare(avl_tree *tree, avl_compare_fn cmp, void *data, void *ctx)
         node = node->child[comp < 0];
     }
 
+    if (node && (node->flags & AVL_DEAD)) {
+        node = avl_lookup_live(tree, node, cmp, data, ctx);
+    }
+
     if (node) {
+        AVL_COUNT_ACCESS(tree, node);
         return (void*)AVL_DATA(node, tree);
     }
 
@@ -267,61 +381,63 @@ avl_lookup_compare(avl_tree *tree, avl_compare_fn cmp, void *data, void *ctx)
 }
 
 
+void
+avl_link(avl_tree *tree, avl_node **up, int *upd, int top, avl_node *node)
+{
+    int k;
+
+    *AVL_SLOT(tree, up, upd, top) = node;
+
+    if (AVL_AUGMENTED(tree)) {
+        avl_augment_node(tree, node);
+        avl_augment_path(tree, up, top);
+    }
+
+    if (tree->opts & AVL_WAVL) {
+        avl_wavl_insert_balance(tree, up, upd, top);
+        return;
+    }
+
+    for (k = top - 1; k >= 0; k--) {
+        up[k]->balance += upd[k] == 0 ? -1 : +1;
+        if (up[k]->balance == 0) break;
+        if (abs ( up[k]->balance ) > 1) {
+            avl_insert_balance ( tree, up[k], upd[k] );
+            *AVL_SLOT(tree, up, upd, k) = up[k];
+            break;
+        }
+    }
+}
+
+
 avl_node * 
 avl_insert(avl_tree *tree, void *data , void *ctx)
 {
-    avl_node  head = {0}; 
-    avl_node *s, *t, *p, *q, *r = NULL;
-    int dir;
+    avl_node *up[AVL_MAX_HEIGHT], *node;
+    uint64_t pfx = tree->prefix ? tree->prefix(data) : 0;
+    int upd[AVL_MAX_HEIGHT], top = 0;
 
-    if (tree->root == NULL) { 
-        if (tree->opts & AVL_INTR) {
-            tree->root = data; 
-            r = tree->root;
-        } else { 
-            tree->root = avl_new_node ( tree, data );
-            if (tree->root == NULL) return NULL;    
-        }
-        goto done;
-    } 
-    
-    t = &head;
-    t->child[1] = tree->root;
-    for (s = p = t->child[1]; ; p = q) {
-        dir = tree->comp(AVL_DATA(p, tree), AVL_NODE(data, tree), ctx) < 0;
-        q = p->child[dir];
-        if (q == NULL) break;
-        if (q->balance != 0) {
-            t = p; s = q;
-        }
+    for (node = tree->root; node != NULL; node = node->child[upd[top++]]) {
+        up[top] = node;
+        upd[top] = AVL_COMPARE(tree, node, AVL_NODE(data, tree), pfx, ctx) < 0;
     }
+
     if (tree->opts & AVL_INTR) {
-        q = (avl_node *) data; 
-    } else {
-        q = avl_new_node(tree, data);
-    }
-    r = q;
-    p->child[dir] = q;
-    if (q == NULL) return NULL;
-    for (p = s; p != q; p = p->child[dir]) {
-        dir = tree->comp(AVL_DATA(p, tree), AVL_NODE(data, tree) , ctx) < 0;
-        p->balance += dir == 0 ? -1 : +1;
-    }
-    q = s; 
-    if (abs ( s->balance ) > 1) {
-        dir = tree->comp (AVL_DATA(s, tree), AVL_NODE(data, tree), ctx ) < 0;
-        avl_insert_balance ( s, dir );
-    }
-    if (q == head.child[1]) {
-        tree->root = s;
+        node = (avl_node *) data;
+        node->balance = 0;
+        node->flags = 0;
+        node->child[0] = node->child[1] = NULL;
     } else {
-        t->child[q == t->child[1]] = s;
+        node = avl_new_node(tree, data);
+        if (node == NULL) return NULL;
+        if (tree->prefix) avl_prefix_set(node, pfx);
     }
- 
-done:
 
+    avl_link(tree, up, upd, top, node);
     tree->size++;
-    return r;
+    if (tree->hash) avl_hash_add(tree, node);
+    if (tree->bound) node = avl_bound_link(tree, node, ctx);
+    return node;
 }
 
 
@@ -348,97 +464,275 @@ avl_multi_insert(avl_tree *mtree, void *data, void *ctx)
 }
 
 
-int 
-avl_remove(avl_tree *tree, void *data , void *ctx)
+avl_node *
+avl_unlink(avl_tree *tree, avl_node **up, int *upd, int top)
 {
-    avl_node *up[AVL_MAX_HEIGHT], *node = NULL, *parent = NULL, *delete, *child;
-    int upd[AVL_MAX_HEIGHT], top = 0, n = 0, done = 0;
-
-    if (tree->root == NULL) return AVL_ERROR;
-
-    node = tree->root;
-    while (1) {
-        if ( node == NULL ) {
-            return 0;
-        } else if ( tree->comp (AVL_DATA(node, tree), AVL_NODE(data, tree), ctx) == 0 ) {
-            break;
-        }
-
-        upd[top] = tree->comp (AVL_DATA(node, tree), AVL_NODE(data, tree), ctx ) < 0;
-        up[top++] = node;
-        node = node->child[upd[top - 1]];
-        parent = up[top-1];
-    }
+    avl_node **slot = AVL_SLOT(tree, up, upd, top), *node = *slot, *temp;
+    int n, done = 0;
 
     if (node->child[0] == NULL || node->child[1] == NULL) {
-        int dir = node->child[0] == NULL;
-        if ( top != 0 ) {
-            up[top - 1]->child[upd[top - 1]] = node->child[dir];
-        } else {
-            tree->root = node->child[dir];
-        }
-        avl_free_node(node, tree);
+        *slot = node->child[node->child[0] == NULL];
         goto rebalance;
-    } 
-       
-    avl_node *temp = node->child[1];
+    }
+
+    /*
+     * Two children: the in-order successor takes the node's place in the
+     * tree (and its balance), so node addresses stay stable for the user
+     */
+    temp = node->child[1];
     upd[top] = 1;
-    up[top] = node;      
+    up[top] = node;
     n = top++;
     while ( temp->child[0] != NULL ) {
         upd[top] = 0;
         up[top++] = temp;
         temp = temp->child[0];
     }
-    child = temp->child[1]; 
-    if (tree->opts & AVL_INTR) {
-        if (parent) {
-            if (parent->child[0] == node) {
-                parent->child[0] = temp;
-            } else if (parent->child[1] == node) {
-                parent->child[1] = temp;
-            } else { 
-                assert(0);
-            }
-        } else {
-            tree->root = temp;
-        }
-               
-        temp->child[0] = node->child[0];
-        if (node->child[1] != temp) {
-            temp->child[1] = node->child[1]; 
-        } 
-        temp->balance = node->balance;
-        up[n] = temp;
-        if (n != top-1) up[top - 1]->child[0] = child;
-        delete = node;
-    } else {
-        node->data[0] = temp->data[0];
-        up[top - 1]->child[up[top - 1] == node] = child;
-        delete = temp;
-    }
-    avl_free_node(delete, tree);
+    up[top - 1]->child[upd[top - 1]] = temp->child[1];
+    temp->child[0] = node->child[0];
+    temp->child[1] = node->child[1];
+    temp->balance = node->balance;
+    up[n] = temp;
+    *slot = temp;
 
 rebalance:
 
+    if (AVL_AUGMENTED(tree)) {
+        avl_augment_path(tree, up, top);
+    }
+
+    if (tree->opts & AVL_WAVL) {
+        avl_wavl_remove_balance(tree, up, upd, top);
+        return node;
+    }
+
     while ( --top >= 0 && !done ) {
         up[top]->balance += upd[top] != 0 ? -1 : +1;
         if (abs ( up[top]->balance ) == 1) {
             break;
         } else if (abs ( up[top]->balance ) > 1) {
-            avl_remove_balance ( up[top], upd[top], done );
-            if ( top != 0 ) {
-                up[top - 1]->child[upd[top - 1]] = up[top];
-            } else {
-                tree->root = up[0];
-            }
+            avl_remove_balance ( tree, up[top], upd[top], done );
+            *AVL_SLOT(tree, up, upd, top) = up[top];
+        }
+    }
+    return node;
+}
+
+
+int
+avl_find_path(avl_tree *tree, avl_node *node, avl_node *target, avl_node **up, int *upd, int top, void *ctx)
+{
+    uint64_t pfx = tree->prefix ? avl_prefix_get(target) : 0;
+    void *data = AVL_DATA(target, tree);
+    int comp, found;
+
+    for ( ; node != NULL; node = node->child[upd[top++]]) {
+        if (node == target) return top;
+        comp = AVL_COMPARE(tree, node, data, pfx, ctx);
+        up[top] = node;
+        if (comp == 0) {
+            upd[top] = 0;
+            found = avl_find_path(tree, node->child[0], target, up, upd, top + 1, ctx);
+            if (found >= 0) return found;
+            upd[top] = 1;
+        } else {
+            upd[top] = comp < 0;
         }
     }
+
+    return -1;
+}
+
+
+int 
+avl_remove(avl_tree *tree, void *data , void *ctx)
+{
+    avl_node *up[AVL_MAX_HEIGHT], *node;
+    uint64_t pfx = 0;
+    int upd[AVL_MAX_HEIGHT], top = 0, comp;
+
+    if (tree->opts & AVL_LAZY) {
+        node = avl_lookup_live(tree, tree->root, tree->comp, AVL_NODE(data, tree), ctx);
+        if (node == NULL) return AVL_ERROR;
+        if (tree->hash) avl_hash_del(tree, node);
+        node->flags |= AVL_DEAD;
+        tree->dead++;
+        tree->size--;
+        return AVL_SUCCESS;
+    }
+
+    if (tree->prefix) pfx = tree->prefix(data);
+
+    for (node = tree->root; node != NULL; node = node->child[upd[top++]]) {
+        comp = AVL_COMPARE(tree, node, AVL_NODE(data, tree), pfx, ctx);
+        if (comp == 0) break;
+        up[top] = node;
+        upd[top] = comp < 0;
+    }
+
+    if (node == NULL) return AVL_ERROR;
+
+    node = avl_unlink(tree, up, upd, top);
+    if (tree->hash) avl_hash_del(tree, node);
+    if (tree->bound) avl_bound_unlink(tree, node);
+    avl_free_node(node, tree);
     tree->size--;
     return AVL_SUCCESS;
 }
 
 
+/*
+ * avl_neighbour() - In-order predecessor (dir 0) or successor (dir 1) of the
+ * node at the end of a path, without comparisons
+ */
+static avl_node *
+avl_neighbour(avl_node *node, avl_node **up, int *upd, int top, int dir)
+{
+    if (node->child[dir] != NULL) {
+        for (node = node->child[dir]; node->child[!dir] != NULL; node = node->child[!dir]) ;
+        return node;
+    }
+    while ( --top >= 0 ) {
+        if (upd[top] == !dir) return up[top];
+    }
+
+    return NULL;
+}
+
+
+/*
+ * AVL_NODE_PATH / AVL_NODE_RIGHT: Transient flags (below AVL_NODE_SHIFT) of
+ * the nodes of a path being retraced, and the side the path left them on
+ */
+#define AVL_NODE_PATH  0x00000002
+#define AVL_NODE_RIGHT 0x00000004
+
+
+/*
+ * avl_path_mark() - Flag the first n nodes of a path with the side the path
+ * takes at each, keeping a copy of the nodes for avl_path_retrace()
+ */
+static void
+avl_path_mark(avl_path *path, avl_node **old, int n)
+{
+    int k;
+
+    for (k = 0; k < n; k++) {
+        old[k] = path->up[k];
+        old[k]->flags |= AVL_NODE_PATH | (path->upd[k] ? AVL_NODE_RIGHT : 0);
+    }
+}
+
+
+/*
+ * avl_path_retrace() - Record the path to target once rebalancing is done,
+ * without comparisons, and clear the flags avl_path_mark() set.  Rotations
+ * keep the in-order position of every node, so target is still on the
+ * flagged side of a flagged node; a node rotated onto the path from off it
+ * has a flagged node, or target, as a child.
+ */
+static void
+avl_path_retrace(avl_tree *tree, avl_path *path, avl_node *target, avl_node **old, int n)
+{
+    avl_node *node, *left;
+    int dir;
+
+    path->top = 0;
+    for (node = tree->root; node != target; node = node->child[dir]) {
+        if (node->flags & AVL_NODE_PATH) {
+            dir = (node->flags & AVL_NODE_RIGHT) != 0;
+        } else {
+            left = node->child[0];
+            dir = !(left != NULL && (left == target || (left->flags & AVL_NODE_PATH)));
+        }
+        path->up[path->top] = node;
+        path->upd[path->top++] = dir;
+    }
+
+    while ( --n >= 0 ) {
+        old[n]->flags &= ~(AVL_NODE_PATH | AVL_NODE_RIGHT);
+    }
+}
+
+
+int
+avl_update_key(avl_tree *tree, avl_node *node, avl_mutate_fn mutate, void *ctx)
+{
+    avl_node *old[AVL_MAX_HEIGHT], *pred, *succ, *temp;
+    avl_path path;
+    uint64_t pfx = 0;
+    int top, lo, hi;
+    void *data = AVL_DATA(node, tree);
+
+    if (node->flags & AVL_DEAD) return AVL_ERROR;
+
+    top = avl_find_path(tree, tree->root, node, path.up, path.upd, 0, ctx);
+    if (top < 0) return AVL_ERROR;
+
+    pred = avl_neighbour(node, path.up, path.upd, top, 0);
+    succ = avl_neighbour(node, path.up, path.upd, top, 1);
+
+    if (tree->hash) avl_hash_del(tree, node);
+    mutate(data, ctx);
+    if (tree->prefix) {
+        pfx = tree->prefix(data);
+        avl_prefix_set(node, pfx);
+    }
+    if (tree->hash) avl_hash_add(tree, node);
+
+    /*
+     * Still in order: only the aggregates on the path can have changed
+     */
+    if ((pred == NULL || AVL_COMPARE(tree, pred, data, pfx, ctx) <= 0) &&
+        (succ == NULL || AVL_COMPARE(tree, succ, data, pfx, ctx) >= 0)) {
+        if (AVL_AUGMENTED(tree)) {
+            avl_augment_node(tree, node);
+            avl_augment_path(tree, path.up, top);
+        }
+        return AVL_SUCCESS;
+    }
+
+    /*
+     * Unlink, then take the path back to the old parent: the new place is
+     * usually close to it.  Climb to the lowest node whose key range (set by
+     * the nearest ancestors the path left to the right and to the left)
+     * holds the new key, then descend from there as avl_insert() would.  A
+     * range that fails at an ancestor fails below it too, so the climb jumps
+     * straight to that ancestor.
+     */
+    if (top > 0) {
+        temp = path.up[top - 1];
+        avl_path_mark(&path, old, top - 1);
+        avl_unlink(tree, path.up, path.upd, top);
+        avl_path_retrace(tree, &path, temp, old, top - 1);
+        top = path.top;
+        path.up[top] = temp;
+        while ( top > 0 ) {
+            for (lo = top - 1; lo >= 0 && path.upd[lo] != 1; lo--) ;
+            for (hi = top - 1; hi >= 0 && path.upd[hi] != 0; hi--) ;
+            if (lo >= 0 && AVL_COMPARE(tree, path.up[lo], data, pfx, ctx) >= 0) top = lo;
+            else if (hi >= 0 && AVL_COMPARE(tree, path.up[hi], data, pfx, ctx) < 0) top = hi;
+            else break;
+        }
+        temp = path.up[top];
+    } else {
+        avl_unlink(tree, path.up, path.upd, top);
+        temp = tree->root;
+    }
+
+    for ( ; temp != NULL; temp = temp->child[path.upd[top++]]) {
+        path.up[top] = temp;
+        path.upd[top] = AVL_COMPARE(tree, temp, data, pfx, ctx) < 0;
+    }
+
+    node->balance = 0;
+    node->child[0] = node->child[1] = NULL;
+    avl_link(tree, path.up, path.upd, top, node);
+
+    return AVL_SUCCESS;
+}
+
+
 int
 avl_multi_remove(avl_tree *mtree, void *data, void *ctx)
 {
@@ -460,6 +754,274 @@ avl_multi_remove(avl_tree *mtree, void *data, void *ctx)
 }
 
 
+int
+avl_vine(avl_tree *tree, avl_node **head, int purge)
+{
+    avl_node *node = tree->root, *temp, **tail = head;
+    int n = 0;
+
+    while ( node != NULL ) {
+        if (node->child[0] == NULL) {
+            temp = node->child[1];
+            if (purge && (node->flags & AVL_DEAD)) {
+                avl_free_node(node, tree);
+            } else {
+                *tail = node;
+                tail = &node->child[1];
+                n++;
+            }
+        } else {
+            temp = node->child[0];
+            node->child[0] = temp->child[1];
+            temp->child[1] = node;
+        }
+        node = temp;
+    }
+    *tail = NULL;
+    tree->root = NULL;
+    return n;
+}
+
+
+avl_node *
+avl_build(avl_tree *tree, avl_node **list, int n, int *height)
+{
+    avl_node *left, *node;
+    int lh, rh;
+
+    if (n == 0) {
+        *height = 0;
+        return NULL;
+    }
+
+    left = avl_build(tree, list, (n - 1) / 2, &lh);
+    node = *list;
+    *list = node->child[1];
+    node->child[0] = left;
+    node->child[1] = avl_build(tree, list, n - 1 - (n - 1) / 2, &rh);
+    *height = (lh >= rh ? lh : rh) + 1;
+    node->balance = (tree->opts & AVL_WAVL) ? *height - 1 : rh - lh;
+    if (AVL_AUGMENTED(tree)) avl_augment_node(tree, node);
+
+    return node;
+}
+
+
+int
+avl_compact(avl_tree *tree, int ratio)
+{
+    avl_node *list;
+    int purged = tree->dead, n, height;
+
+    if (purged == 0) return 0;
+    if ((long)purged * 100 < (long)ratio * (tree->size + purged)) return 0;
+
+    n = avl_vine(tree, &list, 1);
+    tree->root = avl_build(tree, &list, n, &height);
+    tree->dead = 0;
+
+    return purged;
+}
+
+
+avl_node *
+avl_path_link(avl_tree *tree, avl_path *path, avl_node *node)
+{
+    avl_node *old[AVL_MAX_HEIGHT];
+    int size;
+
+    node->balance = 0;
+    node->flags = 0;
+    node->child[0] = node->child[1] = NULL;
+    avl_path_mark(path, old, path->top);
+    avl_link(tree, path->up, path->upd, path->top, node);
+    avl_path_retrace(tree, path, node, old, path->top);
+    tree->size++;
+    if (tree->hash) avl_hash_add(tree, node);
+
+    if (tree->bound) {
+        /* evictions move other nodes: find the node again if it stayed */
+        size = tree->size;
+        node = avl_bound_link(tree, node, NULL);
+        if (node != NULL && tree->size < size) {
+            path->top = avl_find_path(tree, tree->root, node, path->up, path->upd, 0, NULL);
+        }
+    }
+    return node;
+}
+
+
+avl_node *
+avl_path_unlink(avl_tree *tree, avl_path *path)
+{
+    avl_node *old[AVL_MAX_HEIGHT], *node = *AVL_SLOT(tree, path->up, path->upd, path->top), *next;
+    int n = path->top;
+
+    /*
+     * The successor is the leftmost node on the right, which takes the
+     * node's place (with no left child, the right child is a leaf), else the
+     * last node on the path that was left to the left
+     */
+    if (node->child[1] != NULL) {
+        for (next = node->child[1]; next->child[0] != NULL; next = next->child[0]) ;
+    } else {
+        while ( n > 0 && path->upd[n - 1] ) n--;
+        next = n > 0 ? path->up[--n] : NULL;
+    }
+    avl_path_mark(path, old, n);
+
+    avl_unlink(tree, path->up, path->upd, path->top);
+    if (next != NULL) {
+        avl_path_retrace(tree, path, next, old, n);
+    } else {
+        path->top = -1;
+    }
+    if (tree->hash) avl_hash_del(tree, node);
+    if (tree->bound) avl_bound_unlink(tree, node);
+    tree->size--;
+    return node;
+}
+
+
+/*
+ * avl_iter_edge() - Descend from the current cursor node along dir and
+ * return the data of the node where the descent ends
+ */
+static void *
+avl_iter_edge(avl_iter *iter, avl_node *node, int dir)
+{
+    while ( node != NULL ) {
+        iter->up[iter->top++] = node;
+        node = node->child[dir];
+    }
+    return iter->top ? AVL_DATA(iter->up[iter->top - 1], iter->tree) : NULL;
+}
+
+
+/*
+ * avl_iter_step() - Move a cursor one node along dir (1 next, 0 previous)
+ */
+static void *
+avl_iter_step(avl_iter *iter, int dir)
+{
+    avl_node *node;
+
+    if (iter->top == 0) return NULL;
+
+    node = iter->up[iter->top - 1];
+    if (node->child[dir] != NULL) {
+        return avl_iter_edge(iter, node->child[dir], !dir);
+    }
+    do {
+        node = iter->up[--iter->top];
+    } while ( iter->top > 0 && iter->up[iter->top - 1]->child[dir] == node );
+
+    return iter->top ? AVL_DATA(iter->up[iter->top - 1], iter->tree) : NULL;
+}
+
+
+void *
+avl_iter_first(avl_iter *iter, avl_tree *tree)
+{
+    void *data;
+
+    iter->tree = tree;
+    iter->top = 0;
+    data = avl_iter_edge(iter, tree->root, 0);
+    if (data && (iter->up[iter->top - 1]->flags & AVL_DEAD)) return avl_iter_next(iter);
+    return data;
+}
+
+
+void *
+avl_iter_last(avl_iter *iter, avl_tree *tree)
+{
+    void *data;
+
+    iter->tree = tree;
+    iter->top = 0;
+    data = avl_iter_edge(iter, tree->root, 1);
+    if (data && (iter->up[iter->top - 1]->flags & AVL_DEAD)) return avl_iter_prev(iter);
+    return data;
+}
+
+
+void *
+avl_iter_seek(avl_iter *iter, avl_tree *tree, void *data, void *ctx)
+{
+    avl_node *node = tree->root;
+    uint64_t pfx = tree->prefix ? tree->prefix(data) : 0;
+    int comp, top = 0;
+
+    iter->tree = tree;
+    iter->top = 0;
+    while ( node != NULL ) {
+        iter->up[iter->top++] = node;
+        comp = AVL_COMPARE( tree, node, data, pfx, ctx );
+        if (comp >= 0) top = iter->top;
+        node = node->child[comp < 0];
+    }
+
+    /* the last node not below data is the first one at or above it */
+    iter->top = top;
+    if (top == 0) return NULL;
+    if (iter->up[top - 1]->flags & AVL_DEAD) return avl_iter_next(iter);
+    return AVL_DATA(iter->up[top - 1], tree);
+}
+
+
+void *
+avl_iter_next(avl_iter *iter)
+{
+    void *data;
+
+    do {
+        data = avl_iter_step(iter, 1);
+    } while ( data && (iter->up[iter->top - 1]->flags & AVL_DEAD) );
+
+    return data;
+}
+
+
+void *
+avl_iter_prev(avl_iter *iter)
+{
+    void *data;
+
+    if (iter->top == 0) return avl_iter_last(iter, iter->tree);
+
+    do {
+        data = avl_iter_step(iter, 0);
+    } while ( data && (iter->up[iter->top - 1]->flags & AVL_DEAD) );
+
+    return data;
+}
+
+
+int
+avl_set_prefix(avl_tree *tree, avl_prefix_fn prefix)
+{
+    if ((tree->opts & AVL_INTR) || tree->root != NULL) return AVL_ERROR;
+
+    tree->prefix = prefix;
+    return AVL_SUCCESS;
+}
+
+
+uint64_t
+avl_prefix_bytes(const void *key, size_t len)
+{
+    const unsigned char *k = (const unsigned char *)key;
+    uint64_t pfx = 0;
+    size_t i;
+
+    for (i = 0; i < sizeof(pfx); i++) {
+        pfx = (pfx << 8) | (i < len ? k[i] : 0);
+    }
+    return pfx;
+}
+
+
 int
 avl_size(avl_tree *tree)
 {
@@ -515,6 +1077,17 @@ avl_validate(avl_tree *tree, avl_node *node, void *ctx)
 
     if (l && valid) valid = (tree->comp(AVL_DATA(l, tree), AVL_DATA(node, tree), ctx) <= 0);
     if (r && valid) valid = (tree->comp(AVL_DATA(r, tree), AVL_DATA(node, tree), ctx) >= 0);
+    if (valid && (tree->opts & AVL_WAVL)) {
+        /*
+         * Rank rule: every rank difference is 1 or 2, leaves have rank 0
+         */
+        valid = (l || r || node->balance == 0) &&
+                (node->balance - AVL_RANK(l) == 1 || node->balance - AVL_RANK(l) == 2) &&
+                (node->balance - AVL_RANK(r) == 1 || node->balance - AVL_RANK(r) == 2);
+    } else if (valid) {
+        valid = (node->balance >= -1 && node->balance <= 1 &&
+                 node->balance == avl_height_r(r) - avl_height_r(l));
+    }
     if (valid) valid = avl_validate(tree, l, ctx);
     if (valid) valid = avl_validate(tree, r, ctx);
 
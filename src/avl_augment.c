@@ -0,0 +1,95 @@
+/*-----------------------------------------------------------------------------
+ * avl_augment.c - subtree augmentation and aggregate queries
+ *
+ * The aggregates themselves are kept up to date by the balancing core (see
+ * avl_link(), avl_unlink() and the rotation macros); this file registers the
+ * augmentation function and answers queries from the stored aggregates.
+ *-----------------------------------------------------------------------------
+ */
+
+#include <stdlib.h>
+#include "avl.h"
+#include "avl_private.h"
+
+
+/*
+ * avl_augment_all() - Post-order recompute of every aggregate
+ */
+static void
+avl_augment_all(avl_tree *tree, avl_node *node)
+{
+    if (node == NULL) return;
+
+    avl_augment_all(tree, node->child[0]);
+    avl_augment_all(tree, node->child[1]);
+    avl_augment_node(tree, node);
+}
+
+
+int
+avl_set_augment(avl_tree *tree, avl_augment_fn augment, void *ctx)
+{
+    if (tree->opts & AVL_LAZY) return AVL_ERROR;
+
+    tree->augment = augment;
+    tree->augment_ctx = ctx;
+    if (augment) avl_augment_all(tree, tree->root);
+
+    return AVL_SUCCESS;
+}
+
+
+/*
+ * avl_aggregate_r() - Range decomposition below node.  A NULL bound means
+ * the subtree is already known to be inside the range on that side, so a
+ * subtree bounded on neither side is handed over whole.
+ */
+static int
+avl_aggregate_r(avl_tree *tree, avl_node *node, void *lo, void *hi, avl_span_fn span, void *ctx)
+{
+    while ( node != NULL ) {
+        if (lo == NULL && hi == NULL) {
+            return span(AVL_DATA(node, tree), 1, ctx);
+        }
+        if (lo && tree->comp(AVL_DATA(node, tree), lo, ctx) < 0) {
+            node = node->child[1];
+        } else if (hi && tree->comp(AVL_DATA(node, tree), hi, ctx) > 0) {
+            node = node->child[0];
+        } else {
+            if (!avl_aggregate_r(tree, node->child[0], lo, NULL, span, ctx)) return AVL_ERROR;
+            if (!span(AVL_DATA(node, tree), 0, ctx)) return AVL_ERROR;
+            node = node->child[1];
+            lo = NULL;
+        }
+    }
+
+    return AVL_SUCCESS;
+}
+
+
+int
+avl_aggregate(avl_tree *tree, void *lo, void *hi, avl_span_fn span, void *ctx)
+{
+    return avl_aggregate_r(tree, tree->root, lo, hi, span, ctx);
+}
+
+
+static int
+avl_stab_r(avl_tree *tree, avl_node *node, void *point, avl_prune_fn reach, avl_walker_fn walk, void *ctx)
+{
+    while ( node != NULL && reach(AVL_DATA(node, tree), ctx) ) {
+        if (!avl_stab_r(tree, node->child[0], point, reach, walk, ctx)) return AVL_ERROR;
+        if (tree->comp(AVL_DATA(node, tree), point, ctx) > 0) break;
+        if (!walk(AVL_DATA(node, tree), ctx)) return AVL_ERROR;
+        node = node->child[1];
+    }
+
+    return AVL_SUCCESS;
+}
+
+
+int
+avl_stab(avl_tree *tree, void *point, avl_prune_fn reach, avl_walker_fn walk, void *ctx)
+{
+    return avl_stab_r(tree, tree->root, point, reach, walk, ctx);
+}
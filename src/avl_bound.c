@@ -0,0 +1,238 @@
+/*-----------------------------------------------------------------------------
+ * avl_bound.c - capacity bounded trees
+ *
+ * avl_insert() links the new node as usual and then calls avl_bound_link(),
+ * which unlinks the element chosen by the eviction policy through the same
+ * balancing core (avl_unlink()).  The oldest element is found through a FIFO
+ * of node pointers; each node keeps its FIFO slot in the high flag bits so a
+ * remove can clear the slot in O(1).
+ *-----------------------------------------------------------------------------
+ */
+
+#include <stdlib.h>
+#include "avl.h"
+#include "avl_private.h"
+
+
+/*
+ * AVL_BOUND_MAX: Largest AVL_EVICT_OLDEST capacity; the FIFO has twice as
+ *                many slots, and slot numbers must fit above AVL_NODE_SHIFT
+ */
+#define AVL_BOUND_MAX (1 << 22)
+
+
+/*
+ * struct avl_bound_t - Capacity bound of a tree
+ *
+ *     Element: avl_node **fifo
+ *              AVL_EVICT_OLDEST only: nodes in insertion order from head to
+ *              tail, NULL where a node has been removed since
+ */
+struct avl_bound_t {
+    int capacity;
+    int policy;
+    avl_evict_fn evict;
+    void *ctx;
+    avl_node **fifo;
+    int slots;
+    int head;
+    int tail;
+};
+
+
+/*
+ * avl_bound_pack() - Squeeze the removed entries out of a full FIFO.  At most
+ * capacity entries are live, so at least half of the slots come free and
+ * packing is amortized O(1) per insert.
+ */
+static void
+avl_bound_pack(avl_bound *bound)
+{
+    avl_node *node;
+    int i, n = 0;
+
+    for (i = bound->head; i < bound->tail; i++) {
+        if ((node = bound->fifo[i]) == NULL) continue;
+        node->flags = (node->flags & ((1 << AVL_NODE_SHIFT) - 1)) | (n << AVL_NODE_SHIFT);
+        bound->fifo[n++] = node;
+    }
+    bound->head = 0;
+    bound->tail = n;
+}
+
+
+/*
+ * avl_bound_edge() - Unlink the leftmost (dir 0) or rightmost (dir 1) node
+ */
+static avl_node *
+avl_bound_edge(avl_tree *tree, int dir)
+{
+    avl_node *up[AVL_MAX_HEIGHT], *node;
+    int upd[AVL_MAX_HEIGHT], top = 0;
+
+    for (node = tree->root; node->child[dir] != NULL; node = node->child[dir]) {
+        up[top] = node;
+        upd[top++] = dir;
+    }
+
+    return avl_unlink(tree, up, upd, top);
+}
+
+
+/*
+ * avl_bound_path() - Record the path to a node that is in the FIFO.
+ * avl_insert() links a new node before the nodes with an equal key, and
+ * packing keeps the order of FIFO slots, so along a run of equal keys the
+ * slots fall from left to right and the descent needs no backtracking.
+ * Nodes placed otherwise (avl_path_link(), avl_update_key()) can break that
+ * order; they are found by searching the whole run.
+ */
+static int
+avl_bound_path(avl_tree *tree, avl_node *target, avl_node **up, int *upd, void *ctx)
+{
+    uint64_t pfx = tree->prefix ? avl_prefix_get(target) : 0;
+    unsigned slot = target->flags >> AVL_NODE_SHIFT;
+    void *data = AVL_DATA(target, tree);
+    avl_node *node;
+    int top = 0, comp;
+
+    for (node = tree->root; node != NULL; node = node->child[upd[top++]]) {
+        if (node == target) return top;
+        comp = AVL_COMPARE(tree, node, data, pfx, ctx);
+        if (comp == 0) comp = (node->flags >> AVL_NODE_SHIFT) > slot ? -1 : 1;
+        up[top] = node;
+        upd[top] = comp < 0;
+    }
+
+    return avl_find_path(tree, tree->root, target, up, upd, 0, ctx);
+}
+
+
+/*
+ * avl_bound_oldest() - Unlink the least recently inserted node
+ */
+static avl_node *
+avl_bound_oldest(avl_tree *tree, void *ctx)
+{
+    avl_bound *bound = tree->bound;
+    avl_node *up[AVL_MAX_HEIGHT], *node;
+    int upd[AVL_MAX_HEIGHT], top;
+
+    while ( (node = bound->fifo[bound->head]) == NULL ) bound->head++;
+    bound->fifo[bound->head++] = NULL;
+
+    top = avl_bound_path(tree, node, up, upd, ctx);
+    return avl_unlink(tree, up, upd, top);
+}
+
+
+/*
+ * avl_bound_evict() - Evict one element; returns 1 if it was node
+ */
+static int
+avl_bound_evict(avl_tree *tree, avl_node *node, void *ctx)
+{
+    avl_bound *bound = tree->bound;
+    avl_node *out;
+    int self;
+
+    if (bound->policy == AVL_EVICT_OLDEST) {
+        out = avl_bound_oldest(tree, ctx);
+    } else {
+        out = avl_bound_edge(tree, bound->policy == AVL_EVICT_MAX);
+    }
+    tree->size--;
+    self = (out == node);
+    if (tree->hash) avl_hash_del(tree, out);
+
+    if (bound->evict) {
+        bound->evict(AVL_DATA(out, tree), bound->ctx);
+    } else if (tree->free) {
+        tree->free(AVL_DATA(out, tree));
+    }
+    AVL_FREE_NODE(tree, out);
+
+    return self;
+}
+
+
+avl_node *
+avl_bound_link(avl_tree *tree, avl_node *node, void *ctx)
+{
+    avl_bound *bound = tree->bound;
+
+    if (bound->policy == AVL_EVICT_OLDEST) {
+        if (bound->tail == bound->slots) avl_bound_pack(bound);
+        node->flags |= bound->tail << AVL_NODE_SHIFT;
+        bound->fifo[bound->tail++] = node;
+    }
+
+    while ( tree->size > bound->capacity ) {
+        if (avl_bound_evict(tree, node, ctx)) node = NULL;
+    }
+
+    return node;
+}
+
+
+void
+avl_bound_unlink(avl_tree *tree, avl_node *node)
+{
+    avl_bound *bound = tree->bound;
+
+    if (bound->policy == AVL_EVICT_OLDEST) {
+        bound->fifo[node->flags >> AVL_NODE_SHIFT] = NULL;
+    }
+}
+
+
+void
+avl_bound_free(avl_tree *tree)
+{
+    if (tree->bound == NULL) return;
+
+    free(tree->bound->fifo);
+    free(tree->bound);
+    tree->bound = NULL;
+}
+
+
+int
+avl_set_capacity(avl_tree *tree, int capacity, int policy, avl_evict_fn evict, void *ctx)
+{
+    avl_bound *bound;
+
+    if (tree->opts & AVL_LAZY) return AVL_ERROR;
+    if (capacity == 0) {
+        avl_bound_free(tree);
+        return AVL_SUCCESS;
+    }
+    if (capacity < 0 || policy < AVL_EVICT_MIN || policy > AVL_EVICT_OLDEST) return AVL_ERROR;
+    if (policy == AVL_EVICT_OLDEST && (capacity > AVL_BOUND_MAX || tree->size || (tree->opts & AVL_CNTD))) {
+        return AVL_ERROR;
+    }
+
+    bound = (avl_bound *)calloc(1, sizeof(avl_bound));
+    if (bound == NULL) return AVL_ERROR;
+
+    if (policy == AVL_EVICT_OLDEST) {
+        bound->slots = 2 * (capacity + 1);
+        bound->fifo = (avl_node **)calloc(bound->slots, sizeof(avl_node *));
+        if (bound->fifo == NULL) {
+            free(bound);
+            return AVL_ERROR;
+        }
+    }
+    bound->capacity = capacity;
+    bound->policy = policy;
+    bound->evict = evict;
+    bound->ctx = ctx;
+    avl_bound_free(tree);
+    tree->bound = bound;
+
+    while ( tree->size > capacity ) {
+        avl_bound_evict(tree, NULL, NULL);
+    }
+
+    return AVL_SUCCESS;
+}
@@ -0,0 +1,144 @@
+/*-----------------------------------------------------------------------------
+ * avl_clone.c - Structural copies of avl trees in one allocation
+ *
+ * Nodes are copied in preorder into consecutive slots of a single block, so
+ * every subtree occupies one run of the block and a descent moves forward
+ * through memory.  A parallel clone copies the root into the first slot,
+ * the left subtree forward from the second slot on the calling thread and
+ * the right subtree backward from the last slot (mirrored preorder) on a
+ * helper thread; the two runs meet without either side knowing the size of
+ * the other subtree.
+ *-----------------------------------------------------------------------------
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "avl.h"
+#include "avl_private.h"
+
+
+/*
+ * AVL_CLONE_MIN: Smallest tree worth a helper thread
+ */
+#define AVL_CLONE_MIN 8192
+
+
+/*
+ * struct avl_clone_job_t - One run of copies
+ *
+ *     Element: avl_node *src, avl_node **link
+ *              Subtree to copy and the slot of the copy of its root
+ *
+ *     Element: char *next; long step
+ *              Slot of the next copy, and the distance to the one after it
+ *              (negative to fill the block backward)
+ */
+typedef struct avl_clone_job_t {
+    avl_tree *tree;
+    avl_node *src;
+    avl_node **link;
+    char *next;
+    long step;
+} avl_clone_job;
+
+
+/*
+ * avl_clone_run() - Copy a subtree in preorder, left child first (right
+ * child first when filling backward)
+ */
+static void *
+avl_clone_run(void *arg)
+{
+    avl_clone_job *job = (avl_clone_job *)arg;
+    avl_node *src[2 * AVL_MAX_HEIGHT], **link[2 * AVL_MAX_HEIGHT], *s, *d;
+    int top = 0, back = job->step < 0, k;
+
+    if (job->src == NULL) return NULL;
+
+    src[top] = job->src;
+    link[top++] = job->link;
+    while ( top > 0 ) {
+        s = src[--top];
+        d = (avl_node *)job->next;
+        job->next += job->step;
+
+        memcpy(d, s, AVL_NODE_BYTES(job->tree));
+        if (job->tree->item) d->data[0] = (char *)d + ((char *)s->data[0] - (char *)s);
+        *link[top] = d;
+
+        for (k = 0; k < 2; k++) {
+            if (s->child[back ^ !k] == NULL) continue;
+            src[top] = s->child[back ^ !k];
+            link[top++] = &d->child[back ^ !k];
+        }
+    }
+
+    return NULL;
+}
+
+
+avl_tree *
+avl_clone(avl_tree *tree, int options)
+{
+    avl_clone_job job[2];
+    avl_tree *clone;
+    avl_node *root;
+    pthread_t thread;
+    size_t size = (AVL_NODE_BYTES(tree) + 7) & ~(size_t)7;
+    long n = (long)tree->size + tree->dead;
+    int threaded = 0;
+
+    if ((tree->opts & AVL_INTR) || (tree->augment && tree->item == 0)) return NULL;
+
+    clone = avl_init(tree->comp, NULL, tree->opts);
+    if (clone == NULL) return NULL;
+
+    clone->size = tree->size;
+    clone->dead = tree->dead;
+    clone->augment = tree->augment;
+    clone->augment_ctx = tree->augment_ctx;
+    clone->prefix = tree->prefix;
+    clone->sample = tree->sample;
+    clone->item = tree->item;
+    clone->merkle = tree->merkle;
+    if (n == 0) return clone;
+
+    clone->block = malloc(n * size);
+    if (clone->block == NULL) {
+        free(clone);
+        return NULL;
+    }
+    clone->block_size = n * size;
+
+    memset(job, 0, sizeof(job));
+    job[0].tree = job[1].tree = tree;
+    if ((options & AVL_CLONE_PARALLEL) && n >= AVL_CLONE_MIN) {
+        /* the root here, its subtrees from both ends of the block */
+        root = (avl_node *)clone->block;
+        memcpy(root, tree->root, AVL_NODE_BYTES(tree));
+        if (tree->item) root->data[0] = (char *)root + ((char *)tree->root->data[0] - (char *)tree->root);
+        clone->root = root;
+
+        job[0].src = tree->root->child[0];
+        job[0].link = &root->child[0];
+        job[0].next = (char *)clone->block + size;
+        job[0].step = size;
+        job[1].src = tree->root->child[1];
+        job[1].link = &root->child[1];
+        job[1].next = (char *)clone->block + (n - 1) * size;
+        job[1].step = -(long)size;
+        threaded = pthread_create(&thread, NULL, avl_clone_run, &job[1]) == 0;
+        avl_clone_run(&job[0]);
+        if (threaded) pthread_join(thread, NULL);
+        else          avl_clone_run(&job[1]);
+    } else {
+        job[0].src = tree->root;
+        job[0].link = &clone->root;
+        job[0].next = (char *)clone->block;
+        job[0].step = size;
+        avl_clone_run(&job[0]);
+    }
+
+    return clone;
+}
@@ -0,0 +1,391 @@
+/*-----------------------------------------------------------------------------
+ * avl_compress.c - Compressed read-only snapshots of avl trees
+ *
+ * Block layout, records back to back:
+ *
+ *     AVL_COMPRESS_INT:   [delta]            [value_len] [value]
+ *     AVL_COMPRESS_BYTES: [shared] [len] [suffix] [value_len] [value]
+ *
+ * All numbers are LEB128 varints.  The first record of a block has no delta
+ * (its key is in the index) or no shared length (its key is stored whole), so
+ * every block decodes on its own.
+ *-----------------------------------------------------------------------------
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "avl.h"
+#include "avl_compress.h"
+
+
+/*
+ * AVL_COMPRESS_STACK: Keys up to this long are rebuilt on the stack
+ */
+#define AVL_COMPRESS_STACK 256
+
+
+/*
+ * struct avl_compressed_block_t - Sparse index entry
+ *
+ *     Element: uint64_t ikey
+ *              First key of the block (AVL_COMPRESS_INT)
+ *
+ *     Element: size_t off
+ *              Offset of the block in the blob
+ */
+typedef struct avl_compressed_block_t {
+    uint64_t ikey;
+    size_t   off;
+} avl_compressed_block;
+
+
+struct avl_compressed_t {
+    int options;
+    int size;
+    int blocks;
+    size_t max_key;
+    size_t used;
+    avl_compressed_block *index;
+    unsigned char *blob;
+};
+
+
+/*
+ * struct avl_compressed_cursor_t - Decoding state: the record last read,
+ * where the next one starts and how many are left in the block
+ */
+typedef struct avl_compressed_cursor_t {
+    avl_record rec;
+    const unsigned char *p;
+    int block;
+    int left;
+    int first;
+    unsigned char *buf;
+} avl_compressed_cursor;
+
+
+static unsigned char *
+avl_varint_put(unsigned char *p, uint64_t v)
+{
+    while ( v >= 0x80 ) {
+        *p++ = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (unsigned char)v;
+    return p;
+}
+
+
+static const unsigned char *
+avl_varint_get(const unsigned char *p, uint64_t *v)
+{
+    int shift = 0;
+
+    *v = 0;
+    do {
+        *v |= (uint64_t)(*p & 0x7f) << shift;
+        shift += 7;
+    } while ( *p++ & 0x80 );
+
+    return p;
+}
+
+
+/*
+ * avl_compressed_cmp() - Compare two keys of the snapshot's key type
+ */
+static int
+avl_compressed_cmp(avl_compressed *c, const avl_record *a, const avl_record *b)
+{
+    size_t n;
+    int comp;
+
+    if (c->options & AVL_COMPRESS_INT) return (a->ikey > b->ikey) - (a->ikey < b->ikey);
+
+    n = a->key_len < b->key_len ? a->key_len : b->key_len;
+    comp = n ? memcmp(a->key, b->key, n) : 0;
+    if (comp) return comp;
+    return (a->key_len > b->key_len) - (a->key_len < b->key_len);
+}
+
+
+/*
+ * avl_compressed_first() - First key of block b
+ */
+static void
+avl_compressed_first(avl_compressed *c, int b, avl_record *rec)
+{
+    const unsigned char *p = c->blob + c->index[b].off;
+    uint64_t len;
+
+    rec->ikey = c->index[b].ikey;
+    if ((c->options & AVL_COMPRESS_INT) == 0) {
+        p = avl_varint_get(p, &len);
+        rec->key = p;
+        rec->key_len = (size_t)len;
+    }
+}
+
+
+/*
+ * avl_compressed_find() - Last block whose first key is not above key (below
+ * it, if below is set), -1 if there is none
+ *
+ * A run of equal keys may start at the end of one block and go on into the
+ * next, so a scan must start from the last block that begins below its
+ * bound; a lookup only needs one of the equal records.
+ */
+static int
+avl_compressed_find(avl_compressed *c, const avl_record *key, int below)
+{
+    avl_record first;
+    int lo = 0, hi = c->blocks - 1, mid, found = -1;
+
+    while ( lo <= hi ) {
+        mid = lo + (hi - lo) / 2;
+        avl_compressed_first(c, mid, &first);
+        if (avl_compressed_cmp(c, &first, key) < (below ? 0 : 1)) {
+            found = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    return found;
+}
+
+
+static void
+avl_compressed_seek(avl_compressed *c, avl_compressed_cursor *cur, int b)
+{
+    cur->block = b;
+    cur->p = c->blob + c->index[b].off;
+    cur->left = b < c->blocks - 1 ? AVL_COMPRESS_BLOCK : c->size - b * AVL_COMPRESS_BLOCK;
+    cur->first = 1;
+    cur->rec.ikey = c->index[b].ikey;
+}
+
+
+/*
+ * avl_compressed_read() - Decode the next record into cur->rec, moving on
+ * to the next block at the end of one
+ *
+ *       Return: int
+ *               AVL_SUCCESS, or AVL_ERROR past the last record
+ */
+static int
+avl_compressed_read(avl_compressed *c, avl_compressed_cursor *cur)
+{
+    const unsigned char *p;
+    uint64_t shared = 0, len;
+
+    if (cur->left == 0) {
+        if (cur->block + 1 >= c->blocks) return AVL_ERROR;
+        avl_compressed_seek(c, cur, cur->block + 1);
+    }
+
+    p = cur->p;
+    if (c->options & AVL_COMPRESS_INT) {
+        if (!cur->first) {
+            p = avl_varint_get(p, &len);
+            cur->rec.ikey += len;
+        }
+    } else {
+        if (!cur->first) p = avl_varint_get(p, &shared);
+        p = avl_varint_get(p, &len);
+        memcpy(cur->buf + shared, p, (size_t)len);
+        p += len;
+        cur->rec.key = cur->buf;
+        cur->rec.key_len = (size_t)(shared + len);
+    }
+    p = avl_varint_get(p, &len);
+    cur->rec.value = p;
+    cur->rec.value_len = (size_t)len;
+
+    cur->p = p + len;
+    cur->left--;
+    cur->first = 0;
+    return AVL_SUCCESS;
+}
+
+
+/*
+ * avl_compressed_open() - Set up a cursor with a key buffer (stack, if the
+ * longest key fits), positioned before the first record of block b
+ */
+static int
+avl_compressed_open(avl_compressed *c, avl_compressed_cursor *cur, int b, unsigned char *stack)
+{
+    cur->buf = stack;
+    if (c->max_key > AVL_COMPRESS_STACK) {
+        cur->buf = (unsigned char *)malloc(c->max_key);
+        if (cur->buf == NULL) return AVL_ERROR;
+    }
+    avl_compressed_seek(c, cur, b);
+    return AVL_SUCCESS;
+}
+
+
+static void
+avl_compressed_close(avl_compressed_cursor *cur, unsigned char *stack)
+{
+    if (cur->buf != stack) free(cur->buf);
+}
+
+
+avl_compressed *
+avl_compress(avl_tree *tree, avl_record_fn record, int options)
+{
+    avl_compressed *c = (avl_compressed *)calloc(1, sizeof(avl_compressed));
+    avl_record rec, prev;
+    avl_iter iter;
+    unsigned char *p, *grown, *last = NULL;
+    size_t cap = 0, last_cap = 0, need, shared;
+    void *data;
+
+    if (c == NULL) return NULL;
+
+    c->options = options;
+    c->index = (avl_compressed_block *)malloc(((avl_size(tree) + AVL_COMPRESS_BLOCK - 1) / AVL_COMPRESS_BLOCK + 1) *
+                                              sizeof(avl_compressed_block));
+    if (c->index == NULL) goto fail;
+    memset(&prev, 0, sizeof(prev));
+
+    for (data = avl_iter_first(&iter, tree); data != NULL; data = avl_iter_next(&iter)) {
+        memset(&rec, 0, sizeof(rec));
+        record(data, &rec);
+        if (c->size && avl_compressed_cmp(c, &prev, &rec) > 0) goto fail;
+
+        /* three varints and the bytes, at most */
+        need = c->used + 30 + rec.key_len + rec.value_len;
+        if (need > cap) {
+            cap = need > 2 * cap ? need : 2 * cap;
+            grown = (unsigned char *)realloc(c->blob, cap);
+            if (grown == NULL) goto fail;
+            c->blob = grown;
+        }
+
+        p = c->blob + c->used;
+        if (c->size % AVL_COMPRESS_BLOCK == 0) {
+            c->index[c->blocks].ikey = rec.ikey;
+            c->index[c->blocks++].off = c->used;
+            if ((options & AVL_COMPRESS_INT) == 0) {
+                p = avl_varint_put(p, rec.key_len);
+                if (rec.key_len) memcpy(p, rec.key, rec.key_len);
+                p += rec.key_len;
+            }
+        } else if (options & AVL_COMPRESS_INT) {
+            p = avl_varint_put(p, rec.ikey - prev.ikey);
+        } else {
+            for (shared = 0; shared < rec.key_len && shared < prev.key_len &&
+                             last[shared] == ((const unsigned char *)rec.key)[shared]; shared++) ;
+            p = avl_varint_put(p, shared);
+            p = avl_varint_put(p, rec.key_len - shared);
+            memcpy(p, (const unsigned char *)rec.key + shared, rec.key_len - shared);
+            p += rec.key_len - shared;
+        }
+        p = avl_varint_put(p, rec.value_len);
+        if (rec.value_len) memcpy(p, rec.value, rec.value_len);
+        c->used = p + rec.value_len - c->blob;
+
+        /* keep the key, the record bytes may not outlive the next call */
+        prev.ikey = rec.ikey;
+        if ((options & AVL_COMPRESS_INT) == 0) {
+            if (rec.key_len > last_cap) {
+                last_cap = 2 * rec.key_len;
+                grown = (unsigned char *)realloc(last, last_cap);
+                if (grown == NULL) goto fail;
+                last = grown;
+            }
+            if (rec.key_len) memcpy(last, rec.key, rec.key_len);
+            prev.key = last;
+            prev.key_len = rec.key_len;
+            if (rec.key_len > c->max_key) c->max_key = rec.key_len;
+        }
+        c->size++;
+    }
+
+    free(last);
+    if (c->used && c->used < cap) {
+        grown = (unsigned char *)realloc(c->blob, c->used);
+        if (grown) c->blob = grown;
+    }
+    return c;
+
+fail:
+    free(last);
+    avl_compressed_free(c);
+    return NULL;
+}
+
+
+void
+avl_compressed_free(avl_compressed *c)
+{
+    free(c->index);
+    free(c->blob);
+    free(c);
+}
+
+
+int
+avl_compressed_lookup(avl_compressed *c, const avl_record *key, avl_record *rec)
+{
+    unsigned char stack[AVL_COMPRESS_STACK];
+    avl_compressed_cursor cur;
+    int b = avl_compressed_find(c, key, 0), comp = 1;
+
+    if (b < 0 || !avl_compressed_open(c, &cur, b, stack)) return AVL_ERROR;
+
+    while ( cur.left > 0 && avl_compressed_read(c, &cur) ) {
+        comp = avl_compressed_cmp(c, &cur.rec, key);
+        if (comp >= 0) break;
+    }
+    if (comp == 0 && rec) {
+        rec->value = cur.rec.value;
+        rec->value_len = cur.rec.value_len;
+    }
+    avl_compressed_close(&cur, stack);
+
+    return comp == 0 ? AVL_SUCCESS : AVL_ERROR;
+}
+
+
+int
+avl_compressed_scan(avl_compressed *c, const avl_record *lo, const avl_record *hi,
+                    avl_walker_fn walk, void *ctx)
+{
+    unsigned char stack[AVL_COMPRESS_STACK];
+    avl_compressed_cursor cur;
+    int b = lo ? avl_compressed_find(c, lo, 1) : 0, rc = AVL_SUCCESS;
+
+    if (c->size == 0) return AVL_SUCCESS;
+    if (!avl_compressed_open(c, &cur, b < 0 ? 0 : b, stack)) return AVL_ERROR;
+
+    while ( avl_compressed_read(c, &cur) ) {
+        if (lo && avl_compressed_cmp(c, &cur.rec, lo) < 0) continue;
+        if (hi && avl_compressed_cmp(c, &cur.rec, hi) > 0) break;
+        if (!walk(&cur.rec, ctx)) {
+            rc = AVL_ERROR;
+            break;
+        }
+    }
+    avl_compressed_close(&cur, stack);
+
+    return rc;
+}
+
+
+int
+avl_compressed_size(avl_compressed *c)
+{
+    return c->size;
+}
+
+
+size_t
+avl_compressed_bytes(avl_compressed *c)
+{
+    return sizeof(avl_compressed) + c->blocks * sizeof(avl_compressed_block) + c->used;
+}
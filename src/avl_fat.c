@@ -0,0 +1,356 @@
+/*-----------------------------------------------------------------------------
+ * avl_fat.c - Bucketed ("fat node") avl trees
+ *
+ * Buckets are intrusive nodes of an ordinary avl_tree and are linked and
+ * unlinked with the avl_path functions, so balancing is the core's.  A bucket
+ * is found by comparing with its first element only: the descent remembers
+ * the last bucket whose first element is <= the key, and the key can only be
+ * in that bucket.  Inside a bucket a binary search finds the position.
+ *-----------------------------------------------------------------------------
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "avl.h"
+#include "avl_fat.h"
+
+
+/*
+ * struct avl_fat_bucket_t - Bucket node
+ *
+ *     Element: int n
+ *              Number of elements in the bucket, never 0 while linked
+ *
+ *     Element: void *item[0]
+ *              Sorted elements (bucket_size slots)
+ */
+typedef struct avl_fat_bucket_t {
+    avl_node avl;
+    int      n;
+    void    *item[0];
+} avl_fat_bucket;
+
+#define BUCKET(node) ((avl_fat_bucket *)(node))
+
+
+struct avl_fat_t {
+    avl_tree *tree;
+    avl_compare_fn comp;
+    avl_free_fn free;
+    int cap;
+    int size;
+};
+
+
+static avl_fat_bucket *
+avl_fat_bucket_new(avl_fat *fat)
+{
+    return (avl_fat_bucket *)calloc(1, sizeof(avl_fat_bucket) + fat->cap * sizeof(void *));
+}
+
+
+/*
+ * avl_fat_find() - Find the bucket the key belongs to (the last bucket whose
+ * first element is <= data, else the first bucket) and record the path to
+ * it.  Returns NULL if the tree is empty.
+ */
+static avl_fat_bucket *
+avl_fat_find(avl_fat *fat, void *data, avl_path *path, void *ctx)
+{
+    avl_node *node, *cand = NULL;
+    int depth = 0, comp;
+
+    path->top = 0;
+    for (node = fat->tree->root; node != NULL; node = node->child[path->upd[path->top++]]) {
+        comp = fat->comp(BUCKET(node)->item[0], data, ctx);
+        path->up[path->top] = node;
+        if (comp == 0) {
+            cand = node;
+            depth = path->top;
+            break;
+        }
+        path->upd[path->top] = comp < 0;
+        if (comp < 0) {
+            cand = node;
+            depth = path->top;
+        }
+    }
+
+    if (cand == NULL) {
+        if (path->top == 0) return NULL;
+        depth = path->top - 1;
+        cand = path->up[depth];
+    }
+    path->top = depth;
+
+    return BUCKET(cand);
+}
+
+
+/*
+ * avl_fat_search() - Binary search in a bucket.  Returns the position of
+ * data, or where it would go; *found tells which.
+ */
+static int
+avl_fat_search(avl_fat *fat, avl_fat_bucket *b, void *data, int *found, void *ctx)
+{
+    int lo = 0, hi = b->n, mid, comp;
+
+    *found = 0;
+    while ( lo < hi ) {
+        mid = (lo + hi) / 2;
+        comp = fat->comp(b->item[mid], data, ctx);
+        if (comp == 0) {
+            *found = 1;
+            return mid;
+        }
+        if (comp < 0) lo = mid + 1; else hi = mid;
+    }
+
+    return lo;
+}
+
+
+/*
+ * avl_fat_neighbour() - In-order predecessor (dir 0) or successor (dir 1)
+ * of the bucket at the end of path, found without comparisons
+ */
+static avl_fat_bucket *
+avl_fat_neighbour(avl_path *path, avl_node *node, int dir)
+{
+    int k;
+
+    if (node->child[dir] != NULL) {
+        for (node = node->child[dir]; node->child[!dir] != NULL; node = node->child[!dir]) ;
+        return BUCKET(node);
+    }
+    for (k = path->top - 1; k >= 0; k--) {
+        if (path->upd[k] == !dir) return BUCKET(path->up[k]);
+    }
+
+    return NULL;
+}
+
+
+avl_fat *
+avl_fat_init(avl_compare_fn comp, avl_free_fn free_fn, int bucket_size)
+{
+    avl_fat *fat;
+
+    if (bucket_size == 0) bucket_size = AVL_FAT_DEFAULT;
+    if (comp == NULL || bucket_size < AVL_FAT_MIN || bucket_size > AVL_FAT_MAX) return NULL;
+
+    fat = (avl_fat *)calloc(1, sizeof(avl_fat));
+    if (fat == NULL) return NULL;
+
+    fat->tree = avl_init(comp, NULL, AVL_TREE_INTRUSIVE);
+    if (fat->tree == NULL) {
+        free(fat);
+        return NULL;
+    }
+    fat->comp = comp;
+    fat->free = free_fn;
+    fat->cap = bucket_size;
+    fat->size = 0;
+
+    return fat;
+}
+
+
+static void
+avl_fat_free_r(avl_fat *fat, avl_node *node)
+{
+    int i;
+
+    if (node == NULL) return;
+
+    avl_fat_free_r(fat, node->child[0]);
+    avl_fat_free_r(fat, node->child[1]);
+    if (fat->free) {
+        for (i = 0; i < BUCKET(node)->n; i++) fat->free(BUCKET(node)->item[i]);
+    }
+    free(node);
+}
+
+
+void
+avl_fat_free(avl_fat *fat)
+{
+    avl_fat_free_r(fat, fat->tree->root);
+    fat->tree->root = NULL;
+    avl_free(fat->tree);
+    free(fat);
+}
+
+
+int
+avl_fat_insert(avl_fat *fat, void *data, void *ctx)
+{
+    avl_path path;
+    avl_fat_bucket *b, *s;
+    avl_node *node;
+    int i, half, found;
+
+    b = avl_fat_find(fat, data, &path, ctx);
+    if (b == NULL) {
+        if ((b = avl_fat_bucket_new(fat)) == NULL) return AVL_ERROR;
+        b->item[0] = data;
+        b->n = 1;
+        avl_path_link(fat->tree, &path, &b->avl);
+        fat->size++;
+        return AVL_SUCCESS;
+    }
+
+    i = avl_fat_search(fat, b, data, &found, ctx);
+    if (found) return AVL_ERROR;
+
+    /*
+     * Split a full bucket: the upper half moves to a new bucket linked as its
+     * in-order successor.  Appending past the end starts an empty bucket
+     * instead, so ascending inserts leave full buckets behind.
+     */
+    if (b->n == fat->cap) {
+        if ((s = avl_fat_bucket_new(fat)) == NULL) return AVL_ERROR;
+        half = (i == b->n) ? b->n : b->n / 2;
+        s->n = b->n - half;
+        memcpy(s->item, &b->item[half], s->n * sizeof(void *));
+        b->n = half;
+
+        path.up[path.top] = &b->avl;
+        path.upd[path.top++] = 1;
+        for (node = b->avl.child[1]; node != NULL; node = node->child[0]) {
+            path.up[path.top] = node;
+            path.upd[path.top++] = 0;
+        }
+        avl_path_link(fat->tree, &path, &s->avl);
+
+        if (i > half || i == fat->cap) {
+            b = s;
+            i -= half;
+        }
+    }
+
+    memmove(&b->item[i + 1], &b->item[i], (b->n - i) * sizeof(void *));
+    b->item[i] = data;
+    b->n++;
+    fat->size++;
+
+    return AVL_SUCCESS;
+}
+
+
+int
+avl_fat_remove(avl_fat *fat, void *data, void *ctx)
+{
+    avl_path path;
+    avl_fat_bucket *b, *n;
+    int i, found;
+
+    b = avl_fat_find(fat, data, &path, ctx);
+    if (b == NULL) return AVL_ERROR;
+
+    i = avl_fat_search(fat, b, data, &found, ctx);
+    if (!found) return AVL_ERROR;
+
+    if (fat->free) fat->free(b->item[i]);
+    memmove(&b->item[i], &b->item[i + 1], (b->n - i - 1) * sizeof(void *));
+    b->n--;
+    fat->size--;
+
+    /*
+     * Merge a bucket that drops below half full into a neighbour that stays
+     * at most three quarters full, so merges and splits do not ping-pong
+     */
+    if (b->n > 0 && b->n < fat->cap / 2) {
+        if ((n = avl_fat_neighbour(&path, &b->avl, 0)) && n->n + b->n <= fat->cap * 3 / 4) {
+            memcpy(&n->item[n->n], b->item, b->n * sizeof(void *));
+            n->n += b->n;
+            b->n = 0;
+        } else if ((n = avl_fat_neighbour(&path, &b->avl, 1)) && n->n + b->n <= fat->cap * 3 / 4) {
+            memmove(&n->item[b->n], n->item, n->n * sizeof(void *));
+            memcpy(n->item, b->item, b->n * sizeof(void *));
+            n->n += b->n;
+            b->n = 0;
+        }
+    }
+
+    if (b->n == 0) {
+        avl_path_unlink(fat->tree, &path);
+        free(b);
+    }
+
+    return AVL_SUCCESS;
+}
+
+
+void *
+avl_fat_lookup(avl_fat *fat, void *data, void *ctx)
+{
+    avl_path path;
+    avl_fat_bucket *b;
+    int i, found;
+
+    b = avl_fat_find(fat, data, &path, ctx);
+    if (b == NULL) return NULL;
+
+    i = avl_fat_search(fat, b, data, &found, ctx);
+    return found ? b->item[i] : NULL;
+}
+
+
+static int
+avl_fat_walk_r(avl_node *node, avl_walker_fn walk, void *ctx)
+{
+    int i;
+
+    while ( node != NULL ) {
+        if (!avl_fat_walk_r(node->child[0], walk, ctx)) return AVL_ERROR;
+        for (i = 0; i < BUCKET(node)->n; i++) {
+            if (!walk(BUCKET(node)->item[i], ctx)) return AVL_ERROR;
+        }
+        node = node->child[1];
+    }
+
+    return AVL_SUCCESS;
+}
+
+
+int
+avl_fat_walk(avl_fat *fat, avl_walker_fn walk, void *ctx)
+{
+    return avl_fat_walk_r(fat->tree->root, walk, ctx);
+}
+
+
+int
+avl_fat_size(avl_fat *fat)
+{
+    return fat->size;
+}
+
+
+int
+avl_fat_buckets(avl_fat *fat)
+{
+    return avl_size(fat->tree);
+}
+
+
+static int
+avl_fat_height_r(avl_node *node)
+{
+    int l, r;
+
+    if (node == NULL) return 0;
+
+    l = avl_fat_height_r(node->child[0]);
+    r = avl_fat_height_r(node->child[1]);
+    return 1 + (l > r ? l : r);
+}
+
+
+int
+avl_fat_height(avl_fat *fat)
+{
+    return avl_fat_height_r(fat->tree->root);
+}
@@ -0,0 +1,227 @@
+/*-----------------------------------------------------------------------------
+ * avl_fc.c - Flat-combining front end for avl trees
+ *
+ * A request is published by filling a slot and then setting its op with
+ * release ordering; the combiner clears op (release) after writing the
+ * result, so the owner reads the result once it sees op cleared (acquire).
+ * The combiner lock is a test-and-test-and-set word: waiters read it, which
+ * keeps its cache line shared, and only try to take it when it looks free.
+ *-----------------------------------------------------------------------------
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include "avl.h"
+#include "avl_fc.h"
+
+
+/*
+ * AVL_FC_PASSES: Batches a combiner applies before it lets the lock go, so
+ *                requests that arrive while it works are served at once
+ */
+#define AVL_FC_PASSES 3
+
+
+enum {
+    AVL_FC_NONE,
+    AVL_FC_INSERT,
+    AVL_FC_REMOVE,
+    AVL_FC_LOOKUP
+};
+
+
+/*
+ * struct avl_fc_slot_t - Per-thread request slot, one cache line each
+ *
+ *     Element: int op
+ *              Pending request (AVL_FC_*), AVL_FC_NONE once served
+ *
+ *     Element: int used
+ *              Slot is claimed by a thread
+ */
+typedef struct avl_fc_slot_t {
+    int   op;
+    int   used;
+    int   rc;
+    void *data;
+    void *ctx;
+    void *result;
+} __attribute__((aligned(64))) avl_fc_slot;
+
+
+struct avl_fc_t {
+    avl_tree *tree;
+    avl_fc_slot *slot;
+    avl_fc_slot **batch;
+    int slots;
+    int lock;
+    unsigned long batches;
+    unsigned long ops;
+};
+
+
+avl_fc *
+avl_fc_init(avl_tree *tree, int slots)
+{
+    avl_fc *fc;
+    void *mem;
+
+    if (tree == NULL || slots <= 0) return NULL;
+
+    fc = (avl_fc *)calloc(1, sizeof(avl_fc));
+    if (fc == NULL) return NULL;
+
+    if (posix_memalign(&mem, 64, slots * sizeof(avl_fc_slot)) != 0) {
+        free(fc);
+        return NULL;
+    }
+    fc->slot = (avl_fc_slot *)mem;
+    memset(fc->slot, 0, slots * sizeof(avl_fc_slot));
+
+    fc->batch = (avl_fc_slot **)calloc(slots, sizeof(avl_fc_slot *));
+    if (fc->batch == NULL) {
+        free(fc->slot);
+        free(fc);
+        return NULL;
+    }
+    fc->tree = tree;
+    fc->slots = slots;
+
+    return fc;
+}
+
+
+void
+avl_fc_free(avl_fc *fc)
+{
+    free(fc->batch);
+    free(fc->slot);
+    free(fc);
+}
+
+
+int
+avl_fc_attach(avl_fc *fc)
+{
+    int i;
+
+    for (i = 0; i < fc->slots; i++) {
+        if (__atomic_exchange_n(&fc->slot[i].used, 1, __ATOMIC_ACQ_REL) == 0) return i;
+    }
+
+    return -1;
+}
+
+
+void
+avl_fc_detach(avl_fc *fc, int slot)
+{
+    __atomic_store_n(&fc->slot[slot].used, 0, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * avl_fc_combine() - Serve every pending request, called with the lock held.
+ * Each batch is sorted by key (batches are at most one request per thread,
+ * so insertion sort) so that successive descents share their upper path.
+ */
+static void
+avl_fc_combine(avl_fc *fc)
+{
+    avl_tree *tree = fc->tree;
+    avl_fc_slot *s;
+    int i, j, n, pass;
+
+    for (pass = 0; pass < AVL_FC_PASSES; pass++) {
+        for (i = 0, n = 0; i < fc->slots; i++) {
+            if (__atomic_load_n(&fc->slot[i].op, __ATOMIC_ACQUIRE) != AVL_FC_NONE) {
+                fc->batch[n++] = &fc->slot[i];
+            }
+        }
+        if (n == 0) break;
+
+        for (i = 1; i < n; i++) {
+            s = fc->batch[i];
+            for (j = i; j > 0 && tree->comp(fc->batch[j - 1]->data, s->data, s->ctx) > 0; j--) {
+                fc->batch[j] = fc->batch[j - 1];
+            }
+            fc->batch[j] = s;
+        }
+
+        for (i = 0; i < n; i++) {
+            s = fc->batch[i];
+            switch (s->op) {
+            case AVL_FC_INSERT:
+                s->result = avl_insert(tree, s->data, s->ctx);
+                break;
+            case AVL_FC_REMOVE:
+                s->rc = avl_remove(tree, s->data, s->ctx);
+                break;
+            case AVL_FC_LOOKUP:
+                s->result = avl_lookup(tree, s->data, s->ctx);
+                break;
+            }
+            __atomic_store_n(&s->op, AVL_FC_NONE, __ATOMIC_RELEASE);
+        }
+        fc->batches++;
+        fc->ops += n;
+    }
+}
+
+
+/*
+ * avl_fc_request() - Publish a request and wait until some combiner, maybe
+ * this thread, has served it
+ */
+static avl_fc_slot *
+avl_fc_request(avl_fc *fc, int slot, int op, void *data, void *ctx)
+{
+    avl_fc_slot *s = &fc->slot[slot];
+    int spins = 0;
+
+    s->data = data;
+    s->ctx = ctx;
+    __atomic_store_n(&s->op, op, __ATOMIC_RELEASE);
+
+    while ( __atomic_load_n(&s->op, __ATOMIC_ACQUIRE) != AVL_FC_NONE ) {
+        if (__atomic_load_n(&fc->lock, __ATOMIC_RELAXED) == 0 &&
+            __atomic_exchange_n(&fc->lock, 1, __ATOMIC_ACQUIRE) == 0) {
+            avl_fc_combine(fc);
+            __atomic_store_n(&fc->lock, 0, __ATOMIC_RELEASE);
+        } else if (++spins % 64 == 0) {
+            sched_yield();
+        }
+    }
+
+    return s;
+}
+
+
+avl_node *
+avl_fc_insert(avl_fc *fc, int slot, void *data, void *ctx)
+{
+    return (avl_node *)avl_fc_request(fc, slot, AVL_FC_INSERT, data, ctx)->result;
+}
+
+
+int
+avl_fc_remove(avl_fc *fc, int slot, void *data, void *ctx)
+{
+    return avl_fc_request(fc, slot, AVL_FC_REMOVE, data, ctx)->rc;
+}
+
+
+void *
+avl_fc_lookup(avl_fc *fc, int slot, void *data, void *ctx)
+{
+    return avl_fc_request(fc, slot, AVL_FC_LOOKUP, data, ctx)->result;
+}
+
+
+unsigned long
+avl_fc_batches(avl_fc *fc, unsigned long *ops)
+{
+    if (ops) *ops = fc->ops;
+    return fc->batches;
+}
@@ -0,0 +1,199 @@
+/*-----------------------------------------------------------------------------
+ * avl_hash.c - hash side-index for exact-match lookups
+ *
+ * Open addressing with linear probing over (hash, node) pairs.  The home
+ * slot comes from the high bits of the user hash times a golden-ratio
+ * constant, so weak hashes (the identity on integers) still spread.  Removal
+ * shifts the following entries back instead of leaving tombstones, so probe
+ * sequences never grow with churn.  The table is kept at most half full.
+ *-----------------------------------------------------------------------------
+ */
+
+#include <stdlib.h>
+#include "avl.h"
+#include "avl_private.h"
+
+
+#define AVL_HASH_BITS 4
+#define AVL_HASH_HOME(h, shift) ((unsigned long)(((h) * 0x9E3779B97F4A7C15ULL) >> (shift)))
+
+
+typedef struct avl_hash_entry_t {
+    uint64_t  code;
+    avl_node *node;
+} avl_hash_entry;
+
+
+/*
+ * struct avl_hash_t - Side-index of a tree
+ *
+ *     Element: avl_hash_entry *slot
+ *              Table of 2^(64 - shift) entries, node NULL if empty
+ */
+struct avl_hash_t {
+    avl_hash_fn fn;
+    avl_hash_entry *slot;
+    unsigned long mask;
+    unsigned long used;
+    int shift;
+};
+
+
+/*
+ * avl_hash_put() - Enter a node with a known hash code; there is room
+ */
+static void
+avl_hash_put(avl_hash *hash, uint64_t code, avl_node *node)
+{
+    unsigned long i = AVL_HASH_HOME(code, hash->shift);
+
+    while ( hash->slot[i].node != NULL ) i = (i + 1) & hash->mask;
+    hash->slot[i].code = code;
+    hash->slot[i].node = node;
+    hash->used++;
+}
+
+
+/*
+ * avl_hash_resize() - Rehash into a table of 2^bits slots
+ */
+static int
+avl_hash_resize(avl_hash *hash, int bits)
+{
+    avl_hash_entry *old = hash->slot;
+    unsigned long i, n = hash->mask + 1;
+
+    hash->slot = (avl_hash_entry *)calloc(1UL << bits, sizeof(avl_hash_entry));
+    if (hash->slot == NULL) {
+        hash->slot = old;
+        return AVL_ERROR;
+    }
+    hash->mask = (1UL << bits) - 1;
+    hash->shift = 64 - bits;
+    hash->used = 0;
+
+    if (old) {
+        for (i = 0; i < n; i++) {
+            if (old[i].node) avl_hash_put(hash, old[i].code, old[i].node);
+        }
+        free(old);
+    }
+
+    return AVL_SUCCESS;
+}
+
+
+void
+avl_hash_free(avl_tree *tree)
+{
+    if (tree->hash == NULL) return;
+
+    free(tree->hash->slot);
+    free(tree->hash);
+    tree->hash = NULL;
+}
+
+
+void
+avl_hash_add(avl_tree *tree, avl_node *node)
+{
+    avl_hash *hash = tree->hash;
+
+    /*
+     * Keep the table at most half full.  If it cannot grow and is about
+     * to fill up, drop the index: lookups fall back to the tree.
+     */
+    if (2 * (hash->used + 1) > hash->mask + 1 &&
+        avl_hash_resize(hash, 65 - hash->shift) != AVL_SUCCESS &&
+        hash->used + 2 > hash->mask + 1) {
+        avl_hash_free(tree);
+        return;
+    }
+
+    avl_hash_put(hash, hash->fn(AVL_DATA(node, tree)), node);
+}
+
+
+void
+avl_hash_del(avl_tree *tree, avl_node *node)
+{
+    avl_hash *hash = tree->hash;
+    avl_hash_entry *slot = hash->slot;
+    unsigned long i, j, home;
+
+    i = AVL_HASH_HOME(hash->fn(AVL_DATA(node, tree)), hash->shift);
+    while ( slot[i].node != node ) {
+        if (slot[i].node == NULL) return;
+        i = (i + 1) & hash->mask;
+    }
+
+    /* backward shift: pull up every entry that may move closer to home */
+    for (j = (i + 1) & hash->mask; slot[j].node != NULL; j = (j + 1) & hash->mask) {
+        home = AVL_HASH_HOME(slot[j].code, hash->shift);
+        if (((j - home) & hash->mask) >= ((j - i) & hash->mask)) {
+            slot[i] = slot[j];
+            i = j;
+        }
+    }
+    slot[i].node = NULL;
+    hash->used--;
+}
+
+
+avl_node *
+avl_hash_find(avl_tree *tree, void *data, void *ctx)
+{
+    avl_hash *hash = tree->hash;
+    avl_hash_entry *slot = hash->slot;
+    uint64_t code = hash->fn(data);
+    unsigned long i = AVL_HASH_HOME(code, hash->shift);
+
+    for ( ; slot[i].node != NULL; i = (i + 1) & hash->mask) {
+        if (slot[i].code == code && tree->comp(AVL_DATA(slot[i].node, tree), data, ctx) == 0) {
+            return slot[i].node;
+        }
+    }
+
+    return NULL;
+}
+
+
+/*
+ * avl_hash_all() - Index every live node below node
+ */
+static void
+avl_hash_all(avl_tree *tree, avl_node *node)
+{
+    while ( node != NULL && tree->hash != NULL ) {
+        avl_hash_all(tree, node->child[0]);
+        if ((node->flags & AVL_DEAD) == 0 && tree->hash) avl_hash_add(tree, node);
+        node = node->child[1];
+    }
+}
+
+
+int
+avl_set_hash(avl_tree *tree, avl_hash_fn fn)
+{
+    avl_hash *hash;
+    int bits = AVL_HASH_BITS;
+
+    avl_hash_free(tree);
+    if (fn == NULL) return AVL_SUCCESS;
+
+    hash = (avl_hash *)calloc(1, sizeof(avl_hash));
+    if (hash == NULL) return AVL_ERROR;
+
+    while ( (1L << bits) < 2L * (tree->size + 1) ) bits++;
+    hash->fn = fn;
+    hash->mask = 0;
+    if (avl_hash_resize(hash, bits) != AVL_SUCCESS) {
+        free(hash);
+        return AVL_ERROR;
+    }
+
+    tree->hash = hash;
+    avl_hash_all(tree, tree->root);
+
+    return tree->hash ? AVL_SUCCESS : AVL_ERROR;
+}
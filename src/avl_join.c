@@ -0,0 +1,336 @@
+/*-----------------------------------------------------------------------------
+ * avl_join.c - split / join of avl trees and range removal
+ *
+ * Subtree heights are not stored; they are derived on the way down from the
+ * balance factors (a child of a node of height h has height h-1 or h-2), so
+ * split and join run in O(log n) without touching the node layout.
+ *-----------------------------------------------------------------------------
+ */
+
+#include <stdlib.h>
+#include "avl.h"
+#include "avl_private.h"
+
+
+/*
+ * AVL_CHILD_HEIGHT: Height of child d of a node n of height h
+ */
+#define AVL_CHILD_HEIGHT(n, h, d) ((h) - 1 - ((d) ? (n)->balance < 0 : (n)->balance > 0))
+
+
+/*
+ * avl_settle() - Store the balance of node n with children of heights hc[]
+ * and return its height
+ */
+static int
+avl_settle(avl_tree *tree, avl_node *n, int *hc)
+{
+    n->balance = hc[1] - hc[0];
+    if (AVL_AUGMENTED(tree)) avl_augment_node(tree, n);
+
+    return (hc[0] > hc[1] ? hc[0] : hc[1]) + 1;
+}
+
+
+/*
+ * avl_fix() - Make node n, whose subtrees are valid with heights lh and rh
+ * differing by at most 2, the root of a valid subtree.  Returns the new root
+ * and its height in *h.
+ */
+static avl_node *
+avl_fix(avl_tree *tree, avl_node *n, int lh, int rh, int *h)
+{
+    avl_node *c, *x;
+    int hc[2], g[2], xg[2], hn[2], hs[2], d;
+
+    hc[0] = lh;
+    hc[1] = rh;
+    if (abs(rh - lh) <= 1) {
+        *h = avl_settle(tree, n, hc);
+        return n;
+    }
+
+    d = rh > lh;
+    c = n->child[d];
+    g[0] = AVL_CHILD_HEIGHT(c, hc[d], 0);
+    g[1] = AVL_CHILD_HEIGHT(c, hc[d], 1);
+
+    if (g[d] >= g[!d]) {
+        n->child[d] = c->child[!d];
+        c->child[!d] = n;
+        tree->rotations += 1;
+
+        hn[!d] = hc[!d];
+        hn[d] = g[!d];
+        hs[!d] = avl_settle(tree, n, hn);
+        hs[d] = g[d];
+        *h = avl_settle(tree, c, hs);
+        return c;
+    }
+
+    x = c->child[!d];
+    xg[0] = AVL_CHILD_HEIGHT(x, g[!d], 0);
+    xg[1] = AVL_CHILD_HEIGHT(x, g[!d], 1);
+    n->child[d] = x->child[!d];
+    c->child[!d] = x->child[d];
+    x->child[!d] = n;
+    x->child[d] = c;
+    tree->rotations += 2;
+
+    hn[!d] = hc[!d];
+    hn[d] = xg[!d];
+    hs[!d] = avl_settle(tree, n, hn);
+    hn[!d] = xg[d];
+    hn[d] = g[d];
+    hs[d] = avl_settle(tree, c, hn);
+    *h = avl_settle(tree, x, hs);
+    return x;
+}
+
+
+/*
+ * avl_join() - Join l (height lh), the single node k and r (height rh),
+ * where every key of l <= k <= every key of r.  O(|lh - rh|).
+ */
+static avl_node *
+avl_join(avl_tree *tree, avl_node *l, int lh, avl_node *k, avl_node *r, int rh, int *h)
+{
+    int th;
+
+    if (lh > rh + 1) {
+        l->child[1] = avl_join(tree, l->child[1], AVL_CHILD_HEIGHT(l, lh, 1), k, r, rh, &th);
+        return avl_fix(tree, l, AVL_CHILD_HEIGHT(l, lh, 0), th, h);
+    }
+    if (rh > lh + 1) {
+        r->child[0] = avl_join(tree, l, lh, k, r->child[0], AVL_CHILD_HEIGHT(r, rh, 0), &th);
+        return avl_fix(tree, r, th, AVL_CHILD_HEIGHT(r, rh, 1), h);
+    }
+
+    k->child[0] = l;
+    k->child[1] = r;
+    return avl_fix(tree, k, lh, rh, h);
+}
+
+
+/*
+ * avl_split() - Split t (height th) into the nodes that compare below key
+ * (l) and the rest (r).  With edge 0 the split is "< key | >= key", with
+ * edge 1 it is "<= key | > key".
+ */
+static void
+avl_split(avl_tree *tree, avl_node *t, int th, void *key, uint64_t pfx, int edge, void *ctx,
+          avl_node **l, int *lh, avl_node **r, int *rh)
+{
+    avl_node *s;
+    int sh;
+
+    if (t == NULL) {
+        *l = *r = NULL;
+        *lh = *rh = 0;
+        return;
+    }
+
+    if (AVL_COMPARE(tree, t, key, pfx, ctx) >= edge) {
+        avl_split(tree, t->child[0], AVL_CHILD_HEIGHT(t, th, 0), key, pfx, edge, ctx, l, lh, &s, &sh);
+        *r = avl_join(tree, s, sh, t, t->child[1], AVL_CHILD_HEIGHT(t, th, 1), rh);
+    } else {
+        avl_split(tree, t->child[1], AVL_CHILD_HEIGHT(t, th, 1), key, pfx, edge, ctx, &s, &sh, r, rh);
+        *l = avl_join(tree, t->child[0], AVL_CHILD_HEIGHT(t, th, 0), t, s, sh, lh);
+    }
+}
+
+
+/*
+ * avl_split_min() - Detach the smallest node of t (height th) into *min
+ */
+static avl_node *
+avl_split_min(avl_tree *tree, avl_node *t, int th, avl_node **min, int *h)
+{
+    int lh;
+
+    if (t->child[0] == NULL) {
+        *min = t;
+        *h = th - 1;
+        return t->child[1];
+    }
+
+    t->child[0] = avl_split_min(tree, t->child[0], AVL_CHILD_HEIGHT(t, th, 0), min, &lh);
+    return avl_fix(tree, t, lh, AVL_CHILD_HEIGHT(t, th, 1), h);
+}
+
+
+/*
+ * avl_tree_height() - Height of an AVL subtree, following the taller side
+ */
+static int
+avl_tree_height(avl_node *node)
+{
+    int h = 0;
+
+    for ( ; node != NULL; node = node->child[node->balance > 0]) h++;
+
+    return h;
+}
+
+
+/*
+ * avl_release() - Free a detached subtree in one pass that needs no stack,
+ * like avl_free().  Returns the number of live nodes freed.  With a list,
+ * the nodes are only taken out of the tree's counts, hash and FIFO, and
+ * pushed on *list (chained through child[1]) to be freed later.
+ */
+static int
+avl_release(avl_tree *tree, avl_node *node, avl_free_fn free_fn, avl_node **list)
+{
+    avl_node *temp;
+    int k = 0;
+
+    while ( node != NULL ) {
+        if (node->child[0] == NULL) {
+            temp = node->child[1];
+            if (node->flags & AVL_DEAD) {
+                tree->dead--;
+            } else {
+                tree->size--;
+                k++;
+            }
+            if (tree->hash) avl_hash_del(tree, node);
+            if (tree->bound) avl_bound_unlink(tree, node);
+            if (list) {
+                node->child[1] = *list;
+                *list = node;
+            } else {
+                if (free_fn) free_fn(AVL_DATA(node, tree));
+                AVL_FREE_NODE(tree, node);
+            }
+        } else {
+            temp = node->child[0];
+            node->child[0] = temp->child[1];
+            temp->child[1] = node;
+        }
+        node = temp;
+    }
+
+    return k;
+}
+
+
+/*
+ * avl_remove_each() - Range removal for rank-balanced trees, whose ranks
+ * split and join do not maintain: unlink the first node in range until none
+ * is left.  O(k log n), see avl_remove_range() in avl.h.
+ */
+static int
+avl_remove_each(avl_tree *tree, void *lo, void *hi, avl_free_fn free_fn, void *ctx, avl_node **list)
+{
+    avl_node *up[AVL_MAX_HEIGHT], *node;
+    uint64_t lpfx = 0, hpfx = 0;
+    int upd[AVL_MAX_HEIGHT], top, first, k = 0;
+
+    if (tree->prefix) {
+        if (lo) lpfx = tree->prefix(lo);
+        if (hi) hpfx = tree->prefix(hi);
+    }
+
+    for (;;) {
+        for (top = 0, first = -1, node = tree->root; node != NULL; node = node->child[upd[top++]]) {
+            up[top] = node;
+            upd[top] = lo && AVL_COMPARE(tree, node, lo, lpfx, ctx) < 0;
+            if (upd[top] == 0) first = top;
+        }
+        if (first < 0) break;
+
+        node = up[first];
+        if (hi && AVL_COMPARE(tree, node, hi, hpfx, ctx) > 0) break;
+
+        node = avl_unlink(tree, up, upd, first);
+        node->child[0] = node->child[1] = NULL;
+        k += avl_release(tree, node, free_fn, list);
+    }
+
+    return k;
+}
+
+
+/*
+ * avl_remove_span() - avl_remove_range(), with the removed nodes pushed on
+ * *list instead of freed if list is not NULL
+ */
+static int
+avl_remove_span(avl_tree *tree, void *lo, void *hi, avl_free_fn free_fn, void *ctx, avl_node **list)
+{
+    avl_node *l, *m, *r, *min;
+    uint64_t pfx;
+    int h, lh, mh, rh;
+
+    if (tree->opts & AVL_WAVL) return avl_remove_each(tree, lo, hi, free_fn, ctx, list);
+
+    h = avl_tree_height(tree->root);
+
+    if (lo) {
+        pfx = tree->prefix ? tree->prefix(lo) : 0;
+        avl_split(tree, tree->root, h, lo, pfx, 0, ctx, &l, &lh, &m, &mh);
+    } else {
+        l = NULL;
+        lh = 0;
+        m = tree->root;
+        mh = h;
+    }
+
+    if (hi) {
+        pfx = tree->prefix ? tree->prefix(hi) : 0;
+        avl_split(tree, m, mh, hi, pfx, 1, ctx, &m, &mh, &r, &rh);
+    } else {
+        r = NULL;
+        rh = 0;
+    }
+
+    if (r == NULL) {
+        tree->root = l;
+    } else {
+        r = avl_split_min(tree, r, rh, &min, &rh);
+        tree->root = avl_join(tree, l, lh, min, r, rh, &h);
+    }
+
+    return avl_release(tree, m, free_fn, list);
+}
+
+
+int
+avl_remove_range(avl_tree *tree, void *lo, void *hi, avl_free_fn free_fn, void *ctx)
+{
+    if (free_fn == NULL) free_fn = tree->free;
+
+    return avl_remove_span(tree, lo, hi, free_fn, ctx, NULL);
+}
+
+
+/*
+ * The removed nodes form a list with no left children, which the teardown
+ * of avl_free_step() frees in order without a single rotation.  A holder
+ * tree carries them, with just what freeing a node needs: the layout
+ * options, the element offsets and the free function.
+ */
+int
+avl_remove_range_async(avl_tree *tree, void *lo, void *hi, avl_free_fn free_fn, void *ctx)
+{
+    avl_tree *holder;
+    avl_node *list = NULL;
+    int k, dead = tree->dead;
+
+    if (free_fn == NULL) free_fn = tree->free;
+
+    /* a clone's nodes live in its block, which the holder would free */
+    holder = tree->block ? NULL : avl_init(tree->comp, free_fn, tree->opts);
+    if (holder == NULL) return avl_remove_span(tree, lo, hi, free_fn, ctx, NULL);
+
+    k = avl_remove_span(tree, lo, hi, free_fn, ctx, &list);
+    holder->idx = tree->idx;
+    holder->item = tree->item;
+    holder->root = list;
+    holder->size = k;
+    holder->dead = dead - tree->dead;
+    avl_free_async(holder);
+
+    return k;
+}
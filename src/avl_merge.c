@@ -0,0 +1,171 @@
+/*-----------------------------------------------------------------------------
+ * avl_merge.c - k-way ordered merge over several avl trees
+ *
+ * A loser tree over the per-tree cursors: internal node i (1 <= i < n) keeps
+ * the cursor that lost the match played there, with children 2i and 2i+1,
+ * and cursor c sits at leaf n + c.  The overall winner is kept in loser[0].
+ * After the winner advances, only the matches on its leaf-to-root path are
+ * replayed, one compare each.  Ties go to the lower cursor, so the merge is
+ * stable in tree order.
+ *-----------------------------------------------------------------------------
+ */
+
+#include <stdlib.h>
+#include "avl.h"
+#include "avl_private.h"
+
+
+/*
+ * struct avl_merge_iter_t - Merge iterator
+ *
+ *     Element: void **head
+ *              Element at each cursor, NULL once the cursor is past hi
+ *
+ *     Element: int *loser
+ *              Loser tree, winner in loser[0]
+ */
+struct avl_merge_iter_t {
+    avl_compare_fn comp;
+    avl_dup_fn dup;
+    void *ctx;
+    void *hi;
+    int n;
+    void **head;
+    int *loser;
+    avl_iter iter[];
+};
+
+
+/*
+ * avl_merge_less() - Cursor a goes before cursor b
+ */
+static int
+avl_merge_less(avl_merge_iter *m, int a, int b)
+{
+    int comp;
+
+    if (m->head[a] == NULL) return 0;
+    if (m->head[b] == NULL) return 1;
+
+    comp = m->comp(m->head[a], m->head[b], m->ctx);
+    return comp < 0 || (comp == 0 && a < b);
+}
+
+
+/*
+ * avl_merge_play() - Play the matches below loser tree node i and return the
+ * winner
+ */
+static int
+avl_merge_play(avl_merge_iter *m, int i)
+{
+    int a, b;
+
+    if (i >= m->n) return i - m->n;
+
+    a = avl_merge_play(m, 2 * i);
+    b = avl_merge_play(m, 2 * i + 1);
+    if (avl_merge_less(m, b, a)) {
+        m->loser[i] = a;
+        return b;
+    }
+    m->loser[i] = b;
+    return a;
+}
+
+
+/*
+ * avl_merge_advance() - Step cursor c and replay its path to the root
+ */
+static void
+avl_merge_advance(avl_merge_iter *m, int c)
+{
+    int i, t;
+
+    m->head[c] = avl_iter_next(&m->iter[c]);
+    if (m->head[c] && m->hi && m->comp(m->head[c], m->hi, m->ctx) > 0) m->head[c] = NULL;
+
+    for (i = (m->n + c) / 2; i > 0; i /= 2) {
+        if (avl_merge_less(m, m->loser[i], c)) {
+            t = m->loser[i];
+            m->loser[i] = c;
+            c = t;
+        }
+    }
+    m->loser[0] = c;
+}
+
+
+avl_merge_iter *
+avl_merge_init(avl_tree *trees[], int n, avl_compare_fn comp, avl_dup_fn dup, void *ctx)
+{
+    avl_merge_iter *m;
+    int i;
+
+    if (n < 1) return NULL;
+
+    m = (avl_merge_iter *)calloc(1, sizeof(avl_merge_iter) + n * sizeof(avl_iter));
+    if (m == NULL) return NULL;
+
+    m->head = (void **)calloc(n, sizeof(void *));
+    m->loser = (int *)calloc(n, sizeof(int));
+    if (m->head == NULL || m->loser == NULL) {
+        avl_merge_free(m);
+        return NULL;
+    }
+
+    m->comp = comp ? comp : trees[0]->comp;
+    m->dup = dup;
+    m->ctx = ctx;
+    m->n = n;
+    for (i = 0; i < n; i++) m->iter[i].tree = trees[i];
+
+    return m;
+}
+
+
+void *
+avl_merge_first(avl_merge_iter *m, void *lo, void *hi)
+{
+    avl_tree *tree;
+    int i;
+
+    m->hi = hi;
+    for (i = 0; i < m->n; i++) {
+        tree = m->iter[i].tree;
+        m->head[i] = lo ? avl_iter_seek(&m->iter[i], tree, lo, m->ctx)
+                        : avl_iter_first(&m->iter[i], tree);
+        if (m->head[i] && hi && m->comp(m->head[i], hi, m->ctx) > 0) m->head[i] = NULL;
+    }
+    m->loser[0] = avl_merge_play(m, 1);
+
+    return avl_merge_next(m);
+}
+
+
+void *
+avl_merge_next(avl_merge_iter *m)
+{
+    void *data = m->head[m->loser[0]], *dup;
+
+    if (data == NULL) return NULL;
+
+    avl_merge_advance(m, m->loser[0]);
+    if (m->dup) {
+        while ( (dup = m->head[m->loser[0]]) != NULL && m->comp(dup, data, m->ctx) == 0 ) {
+            m->dup(data, dup, m->ctx);
+            avl_merge_advance(m, m->loser[0]);
+        }
+    }
+
+    return data;
+}
+
+
+void
+avl_merge_free(avl_merge_iter *m)
+{
+    free(m->head);
+    free(m->loser);
+    free(m);
+}
@@ -0,0 +1,153 @@
+/*-----------------------------------------------------------------------------
+ * avl_merkle.c - Merkle-hashed subtrees and tree diff
+ *
+ * The subtree hash itself is kept by the balancing core (avl_augment_node());
+ * this file answers diffs.  Subtree hashes are sums, so the hash of any key
+ * range of a tree is the difference of two prefix sums, and the prefix sum
+ * up to a key falls out of the descent that looks the key up.  avl_diff()
+ * walks the first tree and compares each of its subtrees with the same key
+ * range of the second: equal hashes mean equal contents, and the whole
+ * subtree is skipped.
+ *-----------------------------------------------------------------------------
+ */
+
+#include <stdlib.h>
+#include "avl.h"
+#include "avl_private.h"
+
+
+/*
+ * AVL_MERKLE_OF: Subtree hash of a possibly empty subtree
+ */
+#define AVL_MERKLE_OF(t, n) ((n) ? avl_merkle_get(t, n) : 0)
+
+
+/*
+ * avl_merkle_self() - Hash of the element of node n alone
+ */
+static uint64_t
+avl_merkle_self(avl_tree *tree, avl_node *n)
+{
+    return avl_merkle_get(tree, n) - AVL_MERKLE_OF(tree, n->child[0]) - AVL_MERKLE_OF(tree, n->child[1]);
+}
+
+
+/*
+ * avl_merkle_find() - Find key in a tree of unique keys; returns the hash of
+ * the elements below key and the matching node (or NULL) in *match
+ */
+static uint64_t
+avl_merkle_find(avl_tree *tree, avl_compare_fn comp, void *key, avl_node **match, void *ctx)
+{
+    avl_node *node = tree->root;
+    uint64_t sum = 0;
+    int c;
+
+    while ( node != NULL ) {
+        c = comp(AVL_DATA(node, tree), key, ctx);
+        if (c == 0) {
+            sum += AVL_MERKLE_OF(tree, node->child[0]);
+            break;
+        }
+        if (c < 0) sum += avl_merkle_get(tree, node) - AVL_MERKLE_OF(tree, node->child[1]);
+        node = node->child[c < 0];
+    }
+    *match = node;
+
+    return sum;
+}
+
+
+/*
+ * avl_diff_rest() - Report every element of node's subtree (in b) strictly
+ * between lo and hi as missing from a
+ */
+static int
+avl_diff_rest(avl_tree *tree, avl_node *node, avl_compare_fn comp, void *lo, void *hi,
+              avl_diff_fn diff, void *ctx)
+{
+    int k = 0;
+
+    while ( node != NULL ) {
+        if (lo && comp(AVL_DATA(node, tree), lo, ctx) <= 0) {
+            node = node->child[1];
+        } else if (hi && comp(AVL_DATA(node, tree), hi, ctx) >= 0) {
+            node = node->child[0];
+        } else {
+            k += avl_diff_rest(tree, node->child[0], comp, lo, NULL, diff, ctx);
+            diff(NULL, AVL_DATA(node, tree), ctx);
+            k++;
+            lo = NULL;
+            node = node->child[1];
+        }
+    }
+
+    return k;
+}
+
+
+/*
+ * avl_diff_r() - Diff the subtree node of a against the elements of b
+ * strictly between lo and hi.  blo is the hash of the elements of b up to
+ * and including lo, shi that of the elements below hi, so the range hashes
+ * to shi - blo; each node of a visited costs one descent of b.
+ */
+static int
+avl_diff_r(avl_tree *a, avl_node *node, avl_tree *b, void *lo, uint64_t blo, void *hi, uint64_t shi,
+           avl_diff_fn diff, void *ctx)
+{
+    avl_node *match;
+    uint64_t skey;
+    void *key;
+    int k = 0;
+
+    while ( AVL_MERKLE_OF(a, node) != shi - blo ) {
+        if (node == NULL) {
+            return k + avl_diff_rest(b, b->root, a->comp, lo, hi, diff, ctx);
+        }
+
+        key = AVL_DATA(node, a);
+        skey = avl_merkle_find(b, a->comp, key, &match, ctx);
+        k += avl_diff_r(a, node->child[0], b, lo, blo, key, skey, diff, ctx);
+
+        if (match == NULL) {
+            diff(key, NULL, ctx);
+            k++;
+        } else if (avl_merkle_self(a, node) != avl_merkle_self(b, match)) {
+            diff(key, AVL_DATA(match, b), ctx);
+            k++;
+        }
+
+        lo = key;
+        blo = skey + (match ? avl_merkle_self(b, match) : 0);
+        node = node->child[1];
+    }
+
+    return k;
+}
+
+
+int
+avl_set_merkle(avl_tree *tree, avl_hash_fn hash)
+{
+    if ((tree->opts & (AVL_INTR | AVL_LAZY)) || tree->root != NULL) return AVL_ERROR;
+
+    tree->merkle = hash;
+    return AVL_SUCCESS;
+}
+
+
+uint64_t
+avl_merkle_root(avl_tree *tree)
+{
+    return tree->merkle ? AVL_MERKLE_OF(tree, tree->root) : 0;
+}
+
+
+int
+avl_diff(avl_tree *a, avl_tree *b, avl_diff_fn diff, void *ctx)
+{
+    if (a->merkle == NULL || b->merkle == NULL) return -1;
+
+    return avl_diff_r(a, a->root, b, NULL, 0, NULL, AVL_MERKLE_OF(b, b->root), diff, ctx);
+}
@@ -0,0 +1,185 @@
+/*-----------------------------------------------------------------------------
+ * avl_optimize.c - access frequency driven reshaping of counted trees
+ *
+ * The tree is flattened to an array of nodes in key order and rebuilt top
+ * down.  A subtree of m nodes can have height h only if N(h) <= m <= 2^h - 1,
+ * where N(h) is the size of the sparsest AVL tree of height h.  Each subtree
+ * gets the set of heights its parent can accept, and its root is the node
+ * closest to the weighted median of its range (Mehlhorn's approximation of
+ * the optimal search tree) among those that leave some height feasible.
+ *-----------------------------------------------------------------------------
+ */
+
+#include <stdlib.h>
+#include "avl.h"
+#include "avl_private.h"
+
+
+/*
+ * struct avl_shape_t - State of one rebuild
+ *
+ *     Element: uint64_t *weight
+ *              Prefix sums: weight[i] is the weight of node[0 .. i-1]
+ *
+ *     Element: long min[]
+ *              min[h] is N(h), the fewest nodes of an AVL tree of height h
+ */
+typedef struct avl_shape_t {
+    avl_tree  *tree;
+    avl_node **node;
+    uint64_t  *weight;
+    long       min[AVL_MAX_HEIGHT + 1];
+} avl_shape;
+
+#define AVL_SHAPE_MAX(h) ((1L << (h)) - 1)
+
+
+/*
+ * avl_shape_median() - Size of the left subtree that best balances the
+ * weight of node[lo .. lo+m-1] around its root
+ */
+static long
+avl_shape_median(avl_shape *s, long lo, long m)
+{
+    uint64_t *w = s->weight;
+    long l = 0, r = m - 1, mid;
+
+    /* first root whose left side weighs at least its right side */
+    while ( l < r ) {
+        mid = (l + r) / 2;
+        if (w[lo + mid] - w[lo] >= w[lo + m] - w[lo + mid + 1]) r = mid; else l = mid + 1;
+    }
+    if (l > 0 && w[lo + l] - w[lo] - (w[lo + m] - w[lo + l + 1]) >
+                 w[lo + m] - w[lo + l] - (w[lo + l - 1] - w[lo])) {
+        l--;
+    }
+
+    return l;
+}
+
+
+/*
+ * avl_shape_fit() - Left subtree size range for a root of an m node subtree
+ * of height h whose children have heights a (left) and b (right)
+ */
+static int
+avl_shape_fit(avl_shape *s, long m, int a, int b, long *lmin, long *lmax)
+{
+    if (a < 0 || b < 0) return 0;
+
+    *lmin = s->min[a] > m - 1 - AVL_SHAPE_MAX(b) ? s->min[a] : m - 1 - AVL_SHAPE_MAX(b);
+    *lmax = AVL_SHAPE_MAX(a) < m - 1 - s->min[b] ? AVL_SHAPE_MAX(a) : m - 1 - s->min[b];
+
+    return *lmin <= *lmax;
+}
+
+
+/*
+ * avl_shape_build() - Build node[lo .. lo+m-1] into an AVL subtree whose
+ * height is one of the bits set in mask (the caller guarantees that one of
+ * them is feasible for m).  The height is returned in *height.
+ */
+static avl_node *
+avl_shape_build(avl_shape *s, long lo, long m, uint64_t mask, int *height)
+{
+    avl_node *node;
+    uint64_t lmask = 0, rmask = 0;
+    long target, best = -1, lmin, lmax, l;
+    int h, k, ha, hb;
+    unsigned count;
+
+    if (m == 0) {
+        *height = 0;
+        return NULL;
+    }
+
+    /* the root closest to the weighted median over all allowed shapes */
+    target = avl_shape_median(s, lo, m);
+    for (h = 1; h <= AVL_MAX_HEIGHT; h++) {
+        if ((mask >> h & 1) == 0) continue;
+        for (k = 0; k < 3; k++) {
+            if (!avl_shape_fit(s, m, h - 1 - (k == 2), h - 1 - (k == 1), &lmin, &lmax)) continue;
+            l = target < lmin ? lmin : target > lmax ? lmax : target;
+            if (best < 0 || labs(l - target) < labs(best - target)) best = l;
+        }
+    }
+
+    /* left heights that fit that root, then right heights that fit the left */
+    for (h = 1; h <= AVL_MAX_HEIGHT; h++) {
+        if ((mask >> h & 1) == 0) continue;
+        for (k = 0; k < 3; k++) {
+            if (!avl_shape_fit(s, m, h - 1 - (k == 2), h - 1 - (k == 1), &lmin, &lmax)) continue;
+            if (best >= lmin && best <= lmax) lmask |= 1ULL << (h - 1 - (k == 2));
+        }
+    }
+    node = s->node[lo + best];
+    node->child[0] = avl_shape_build(s, lo, best, lmask, &ha);
+
+    for (h = 1; h <= AVL_MAX_HEIGHT; h++) {
+        if ((mask >> h & 1) == 0) continue;
+        for (k = 0; k < 3; k++) {
+            if (h - 1 - (k == 2) != ha) continue;
+            if (!avl_shape_fit(s, m, ha, h - 1 - (k == 1), &lmin, &lmax)) continue;
+            if (best >= lmin && best <= lmax) rmask |= 1ULL << (h - 1 - (k == 1));
+        }
+    }
+    node->child[1] = avl_shape_build(s, lo + best + 1, m - 1 - best, rmask, &hb);
+
+    *height = (ha >= hb ? ha : hb) + 1;
+    node->balance = (s->tree->opts & AVL_WAVL) ? *height - 1 : hb - ha;
+
+    /* decay the count so the next rebuild follows recent accesses */
+    count = node->flags >> AVL_NODE_SHIFT;
+    node->flags = (node->flags & ((1u << AVL_NODE_SHIFT) - 1)) | ((count >> 1) << AVL_NODE_SHIFT);
+    if (AVL_AUGMENTED(s->tree)) avl_augment_node(s->tree, node);
+
+    return node;
+}
+
+
+int
+avl_optimize(avl_tree *tree)
+{
+    avl_shape shape;
+    avl_node *list;
+    uint64_t mask;
+    long n = tree->size + tree->dead, i;
+    int h;
+
+    if ((tree->opts & AVL_CNTD) == 0) return AVL_ERROR;
+    if (n == 0) return AVL_SUCCESS;
+
+    shape.tree = tree;
+    shape.node = (avl_node **)malloc(n * sizeof(avl_node *));
+    shape.weight = (uint64_t *)malloc((n + 1) * sizeof(uint64_t));
+    if (shape.node == NULL || shape.weight == NULL) {
+        free(shape.node);
+        free(shape.weight);
+        return AVL_ERROR;
+    }
+
+    /*
+     * A sampled hit stands for several lookups; nodes never sampled keep a
+     * small weight so that they still balance among themselves
+     */
+    avl_vine(tree, &list, 0);
+    shape.weight[0] = 0;
+    for (i = 0; i < n; i++, list = list->child[1]) {
+        shape.node[i] = list;
+        shape.weight[i + 1] = shape.weight[i] + ((uint64_t)(list->flags >> AVL_NODE_SHIFT) << 6) + 1;
+    }
+
+    /* any height an AVL tree of n nodes can have */
+    shape.min[0] = 0;
+    shape.min[1] = 1;
+    for (h = 2; h <= AVL_MAX_HEIGHT; h++) shape.min[h] = shape.min[h - 1] + shape.min[h - 2] + 1;
+    for (h = 1, mask = 0; h <= AVL_MAX_HEIGHT; h++) {
+        if (shape.min[h] <= n && n <= AVL_SHAPE_MAX(h)) mask |= 1ULL << h;
+    }
+
+    tree->root = avl_shape_build(&shape, 0, n, mask, &h);
+
+    free(shape.node);
+    free(shape.weight);
+    return AVL_SUCCESS;
+}
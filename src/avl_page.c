@@ -0,0 +1,956 @@
+/*-----------------------------------------------------------------------------
+ * avl_page.c - Out-of-core avl trees in a paged file
+ *
+ * Page 0 holds the file header; every other page holds a page header and an
+ * array of node records.  A node id is page * slots + slot, so id 0 (in the
+ * header page) doubles as the empty link.  Records are reached only through
+ * avl_page_node(), whose result is valid until the next call: nothing stays
+ * pinned, so any cache of 4 frames or more can run any operation.  Insert
+ * and remove are the classic recursive AVL algorithms over ids, re-fetching
+ * a node after each recursive call instead of keeping a pointer to it.
+ *
+ * Rotations move nodes across the subtrees that pages were filled by, so
+ * the clustering decays with updates; avl_page_repack() restores it by
+ * copying the tree into a new file, top pages first, each page a subtree
+ * in breadth-first order.
+ *
+ * A read error leaves a zeroed frame (an empty page) and a sticky error,
+ * which the next operation reports; memory is never at risk.
+ *-----------------------------------------------------------------------------
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "avl.h"
+#include "avl_page.h"
+
+
+#define AVL_PAGE_MAGIC 0x31454741504c5641ULL    /* "AVLPAGE1" */
+
+
+/*
+ * struct avl_page_head_t - File header, at the start of page 0
+ *
+ *     Element: uint32_t open
+ *              Page that takes new nodes whose parent's page is full
+ */
+typedef struct avl_page_head_t {
+    uint64_t magic;
+    uint32_t page_size;
+    uint32_t key_size;
+    uint32_t value_size;
+    uint32_t root;
+    uint32_t size;
+    uint32_t pages;
+    uint32_t open;
+    uint32_t pad;
+} avl_page_head;
+
+
+/*
+ * struct avl_page_hdr_t - Page header
+ *
+ *     Element: uint16_t fresh
+ *              Slots handed out at least once (slots above are unused)
+ *
+ *     Element: uint16_t free
+ *              First free slot + 1, 0 if none; free records chain through
+ *              child[0]
+ */
+typedef struct avl_page_hdr_t {
+    uint16_t used;
+    uint16_t fresh;
+    uint16_t free;
+    uint16_t pad;
+} avl_page_hdr;
+
+
+/*
+ * struct avl_page_rec_t - Node record: links, then key and value bytes
+ */
+typedef struct avl_page_rec_t {
+    uint32_t      child[2];
+    int32_t       balance;
+    uint32_t      pad;
+    unsigned char data[];
+} avl_page_rec;
+
+
+/*
+ * struct avl_page_frame_t - Buffer cache frame: LRU list and hash chain
+ */
+typedef struct avl_page_frame_t {
+    uint32_t page;
+    int      dirty;
+    int      prev;
+    int      next;
+    int      hnext;
+} avl_page_frame;
+
+
+struct avl_page_t {
+    int fd;
+    char *path;
+    int options;
+    int error;
+    avl_compare_fn comp;
+    size_t key_size;
+    size_t value_size;
+    size_t rec_size;
+    uint32_t slots;
+    avl_page_head head;
+    unsigned char *buf;
+    avl_page_frame *frame;
+    int frames;
+    uint32_t spare;
+    int used;
+    int mru;
+    int lru;
+    int *bucket;
+    int bits;
+    avl_page_stats stats;
+};
+
+
+#define AVL_PAGE_HASH(t, page) (((uint32_t)(page) * 0x9E3779B1u) >> (32 - (t)->bits))
+#define AVL_PAGE_BUF(t, f)     ((t)->buf + (size_t)(f) * AVL_PAGE_SIZE)
+#define AVL_PAGE_KEY(r)        ((void *)(r)->data)
+
+
+/*
+ * avl_page_lru_unlink() / avl_page_lru_push() - Take a frame off the LRU
+ * list, put it back as most recently used
+ */
+static void
+avl_page_lru_unlink(avl_page *t, int f)
+{
+    avl_page_frame *fr = &t->frame[f];
+
+    if (fr->prev >= 0) t->frame[fr->prev].next = fr->next;
+    else               t->mru = fr->next;
+    if (fr->next >= 0) t->frame[fr->next].prev = fr->prev;
+    else               t->lru = fr->prev;
+}
+
+static void
+avl_page_lru_push(avl_page *t, int f)
+{
+    t->frame[f].prev = -1;
+    t->frame[f].next = t->mru;
+    if (t->mru >= 0) t->frame[t->mru].prev = f;
+    t->mru = f;
+    if (t->lru < 0) t->lru = f;
+}
+
+
+/*
+ * avl_page_find() - Frame holding page, or -1
+ */
+static int
+avl_page_find(avl_page *t, uint32_t page)
+{
+    int f;
+
+    for (f = t->bucket[AVL_PAGE_HASH(t, page)]; f >= 0; f = t->frame[f].hnext) {
+        if (t->frame[f].page == page) return f;
+    }
+
+    return -1;
+}
+
+
+static void
+avl_page_write(avl_page *t, int f)
+{
+    off_t off = (off_t)t->frame[f].page * AVL_PAGE_SIZE;
+
+    if (pwrite(t->fd, AVL_PAGE_BUF(t, f), AVL_PAGE_SIZE, off) != AVL_PAGE_SIZE) t->error = 1;
+    t->frame[f].dirty = 0;
+    t->stats.writes++;
+}
+
+
+/*
+ * avl_page_read() - Read page from the file; pages past the end of the file
+ * read as empty pages
+ */
+static void
+avl_page_read(avl_page *t, uint32_t page, unsigned char *buf)
+{
+    ssize_t n = pread(t->fd, buf, AVL_PAGE_SIZE, (off_t)page * AVL_PAGE_SIZE);
+
+    if (n < 0) {
+        t->error = 1;
+        n = 0;
+    }
+    if (n < AVL_PAGE_SIZE) memset(buf + n, 0, AVL_PAGE_SIZE - n);
+}
+
+
+/*
+ * avl_page_prefetch() - Read page into the spare frame (the one past the
+ * cache) unless it is cached; the next avl_page_get() of it takes it from
+ * there instead of faulting.  Only pages not in the cache are read, so the
+ * file copy is current until then.
+ */
+static void
+avl_page_prefetch(avl_page *t, uint32_t page)
+{
+    if (page == t->spare || avl_page_find(t, page) >= 0) return;
+
+    avl_page_read(t, page, AVL_PAGE_BUF(t, t->frames));
+    t->spare = page;
+    t->stats.prefetches++;
+}
+
+
+/*
+ * avl_page_get() - Page buffer through the cache, marked dirty if the caller
+ * will write it.  Valid until the next call.
+ */
+static unsigned char *
+avl_page_get(avl_page *t, uint32_t page, int dirty)
+{
+    int f = avl_page_find(t, page), *link;
+
+    if (f >= 0) {
+        t->stats.hits++;
+        if (t->mru != f) {
+            avl_page_lru_unlink(t, f);
+            avl_page_lru_push(t, f);
+        }
+        t->frame[f].dirty |= dirty;
+        return AVL_PAGE_BUF(t, f);
+    }
+
+    if (t->used < t->frames) {
+        f = t->used++;
+    } else {
+        f = t->lru;
+        if (t->frame[f].dirty) avl_page_write(t, f);
+        avl_page_lru_unlink(t, f);
+        for (link = &t->bucket[AVL_PAGE_HASH(t, t->frame[f].page)]; *link != f; link = &t->frame[*link].hnext) ;
+        *link = t->frame[f].hnext;
+    }
+
+    if (page != 0 && page == t->spare) {
+        /* read ahead by avl_page_prefetch() */
+        memcpy(AVL_PAGE_BUF(t, f), AVL_PAGE_BUF(t, t->frames), AVL_PAGE_SIZE);
+        t->spare = 0;
+    } else {
+        avl_page_read(t, page, AVL_PAGE_BUF(t, f));
+        t->stats.faults++;
+    }
+
+    t->frame[f].page = page;
+    t->frame[f].dirty = dirty;
+    t->frame[f].hnext = t->bucket[AVL_PAGE_HASH(t, page)];
+    t->bucket[AVL_PAGE_HASH(t, page)] = f;
+    avl_page_lru_push(t, f);
+
+    return AVL_PAGE_BUF(t, f);
+}
+
+
+/*
+ * avl_page_node() - Record of node id, valid until the next cache access
+ */
+static avl_page_rec *
+avl_page_node(avl_page *t, uint32_t id, int dirty)
+{
+    unsigned char *p = avl_page_get(t, id / t->slots, dirty);
+
+    return (avl_page_rec *)(p + sizeof(avl_page_hdr) + (id % t->slots) * t->rec_size);
+}
+
+
+static int
+avl_page_cmp(avl_page *t, const void *a, const void *b)
+{
+    return t->comp ? t->comp((void *)a, (void *)b, NULL) : memcmp(a, b, t->key_size);
+}
+
+
+/*
+ * avl_page_alloc() - New node id, on page near if it has room, else on the
+ * open page, else on a new page
+ */
+static uint32_t
+avl_page_alloc(avl_page *t, uint32_t near)
+{
+    uint32_t page = 0, cand[2], slot;
+    avl_page_hdr *h;
+    avl_page_rec *r;
+    int i;
+
+    cand[0] = near;
+    cand[1] = t->head.open;
+    for (i = 0; i < 2 && page == 0; i++) {
+        if (cand[i] == 0) continue;
+        h = (avl_page_hdr *)avl_page_get(t, cand[i], 0);
+        if (h->free || h->fresh < t->slots) page = cand[i];
+    }
+    if (page == 0) page = t->head.open = t->head.pages++;
+
+    h = (avl_page_hdr *)avl_page_get(t, page, 1);
+    if (h->free) {
+        slot = h->free - 1;
+        r = (avl_page_rec *)((unsigned char *)h + sizeof(avl_page_hdr) + slot * t->rec_size);
+        h->free = (uint16_t)r->child[0];
+    } else {
+        slot = h->fresh++;
+    }
+    h->used++;
+
+    return page * t->slots + slot;
+}
+
+
+/*
+ * avl_page_release() - Give node id back to its page, which becomes the
+ * open page since it now has room
+ */
+static void
+avl_page_release(avl_page *t, uint32_t id)
+{
+    avl_page_hdr *h = (avl_page_hdr *)avl_page_get(t, id / t->slots, 1);
+    avl_page_rec *r = (avl_page_rec *)((unsigned char *)h + sizeof(avl_page_hdr) +
+                                       (id % t->slots) * t->rec_size);
+
+    r->child[0] = h->free;
+    h->free = (uint16_t)(id % t->slots + 1);
+    h->used--;
+    t->head.open = id / t->slots;
+}
+
+
+/*
+ * avl_page_fix() - Rebalance node n whose side d is two levels taller than
+ * the other; returns the new subtree root, and in *lower whether the
+ * subtree got a level lower in doing so
+ */
+static uint32_t
+avl_page_fix(avl_page *t, uint32_t n, int d, int *lower)
+{
+    avl_page_rec *r;
+    uint32_t c, g, cc[2], gc[2];
+    int D = d ? 1 : -1, cb, gb;
+
+    c = avl_page_node(t, n, 0)->child[d];
+    r = avl_page_node(t, c, 0);
+    cc[0] = r->child[0];
+    cc[1] = r->child[1];
+    cb = r->balance * D;
+
+    if (cb >= 0) {
+        r = avl_page_node(t, n, 1);
+        r->child[d] = cc[!d];
+        r->balance = cb ? 0 : D;
+        r = avl_page_node(t, c, 1);
+        r->child[!d] = n;
+        r->balance = cb ? 0 : -D;
+        *lower = (cb != 0);
+        return c;
+    }
+
+    g = cc[!d];
+    r = avl_page_node(t, g, 0);
+    gc[0] = r->child[0];
+    gc[1] = r->child[1];
+    gb = r->balance * D;
+
+    r = avl_page_node(t, n, 1);
+    r->child[d] = gc[!d];
+    r->balance = gb > 0 ? -D : 0;
+    r = avl_page_node(t, c, 1);
+    r->child[!d] = gc[d];
+    r->balance = gb < 0 ? D : 0;
+    r = avl_page_node(t, g, 1);
+    r->child[!d] = n;
+    r->child[d] = c;
+    r->balance = 0;
+    *lower = 1;
+    return g;
+}
+
+
+/*
+ * avl_page_ins() - Insert below n (a node of page near, for a new root
+ * 0); *grew is 1 if the subtree got taller, -1 if key was there already
+ */
+static uint32_t
+avl_page_ins(avl_page *t, uint32_t n, uint32_t near, const void *key, const void *value, int *grew)
+{
+    avl_page_rec *r;
+    uint32_t child;
+    int d, b, comp, lower;
+
+    if (n == 0) {
+        n = avl_page_alloc(t, near);
+        r = avl_page_node(t, n, 1);
+        r->child[0] = r->child[1] = 0;
+        r->balance = 0;
+        memcpy(r->data, key, t->key_size);
+        memcpy(r->data + t->key_size, value, t->value_size);
+        t->head.size++;
+        *grew = 1;
+        return n;
+    }
+
+    r = avl_page_node(t, n, 0);
+    comp = avl_page_cmp(t, AVL_PAGE_KEY(r), key);
+    if (comp == 0) {
+        *grew = -1;
+        return n;
+    }
+    d = comp < 0;
+    child = avl_page_ins(t, r->child[d], n / t->slots, key, value, grew);
+
+    r = avl_page_node(t, n, 1);
+    r->child[d] = child;
+    if (*grew != 1) return n;
+
+    b = r->balance + (d ? 1 : -1);
+    if (b == 0 || b == (d ? 1 : -1)) {
+        r->balance = b;
+        *grew = (b != 0);
+        return n;
+    }
+    *grew = 0;
+    return avl_page_fix(t, n, d, &lower);
+}
+
+
+/*
+ * avl_page_lowered() - Side d of n got a level lower: rebalance and tell in
+ * *lower whether n's subtree got lower too
+ */
+static uint32_t
+avl_page_lowered(avl_page *t, uint32_t n, int d, int *lower)
+{
+    avl_page_rec *r = avl_page_node(t, n, 1);
+    int b = r->balance - (d ? 1 : -1);
+
+    if (b == 0 || b == (d ? -1 : 1)) {
+        r->balance = b;
+        *lower = (b == 0);
+        return n;
+    }
+
+    return avl_page_fix(t, n, !d, lower);
+}
+
+
+/*
+ * avl_page_del_min() - Detach the smallest node below n into *min
+ */
+static uint32_t
+avl_page_del_min(avl_page *t, uint32_t n, uint32_t *min, int *lower)
+{
+    avl_page_rec *r = avl_page_node(t, n, 0);
+    uint32_t left = r->child[0];
+
+    if (left == 0) {
+        *min = n;
+        *lower = 1;
+        return r->child[1];
+    }
+
+    left = avl_page_del_min(t, left, min, lower);
+    avl_page_node(t, n, 1)->child[0] = left;
+
+    return *lower ? avl_page_lowered(t, n, 0, lower) : n;
+}
+
+
+/*
+ * avl_page_del() - Remove key below n; *lower as for avl_page_lowered()
+ */
+static uint32_t
+avl_page_del(avl_page *t, uint32_t n, const void *key, int *lower, int *found)
+{
+    avl_page_rec *r;
+    uint32_t child, left, right, min;
+    int d, comp, balance;
+
+    if (n == 0) {
+        *lower = 0;
+        return 0;
+    }
+
+    r = avl_page_node(t, n, 0);
+    comp = avl_page_cmp(t, AVL_PAGE_KEY(r), key);
+    if (comp != 0) {
+        d = comp < 0;
+        child = avl_page_del(t, r->child[d], key, lower, found);
+        avl_page_node(t, n, 1)->child[d] = child;
+        return *lower ? avl_page_lowered(t, n, d, lower) : n;
+    }
+
+    *found = 1;
+    t->head.size--;
+    left = r->child[0];
+    right = r->child[1];
+    balance = r->balance;
+
+    if (left == 0 || right == 0) {
+        avl_page_release(t, n);
+        *lower = 1;
+        return left ? left : right;
+    }
+
+    /* the successor takes the place of n */
+    right = avl_page_del_min(t, right, &min, lower);
+    r = avl_page_node(t, min, 1);
+    r->child[0] = left;
+    r->child[1] = right;
+    r->balance = balance;
+    avl_page_release(t, n);
+
+    return *lower ? avl_page_lowered(t, min, 1, lower) : min;
+}
+
+
+static int
+avl_page_walk_r(avl_page *t, uint32_t n, avl_walker_fn walk, void *ctx)
+{
+    avl_page_rec *r;
+
+    while ( n != 0 ) {
+        if (!avl_page_walk_r(t, avl_page_node(t, n, 0)->child[0], walk, ctx)) return AVL_ERROR;
+        r = avl_page_node(t, n, 0);
+        if (!walk(r->data, ctx)) return AVL_ERROR;
+        n = r->child[1];
+    }
+
+    return AVL_SUCCESS;
+}
+
+
+/*
+ * avl_page_height() - Height below n, -1 if some balance is off
+ */
+static int
+avl_page_height(avl_page *t, uint32_t n)
+{
+    avl_page_rec *r;
+    uint32_t right;
+    int lh, rh, balance;
+
+    if (n == 0) return 0;
+
+    r = avl_page_node(t, n, 0);
+    right = r->child[1];
+    balance = r->balance;
+    lh = avl_page_height(t, r->child[0]);
+    rh = avl_page_height(t, right);
+    if (lh < 0 || rh < 0 || rh - lh != balance || abs(balance) > 1) return -1;
+
+    return (lh > rh ? lh : rh) + 1;
+}
+
+
+/*
+ * avl_page_ordered() - Walker: keys strictly ascending; ctx holds the
+ * previous key after a flag byte
+ */
+struct avl_page_order {
+    avl_page *tree;
+    int seen;
+    unsigned char key[];
+};
+
+static int
+avl_page_ordered(void *n, void *ctx)
+{
+    struct avl_page_order *o = (struct avl_page_order *)ctx;
+
+    if (o->seen && avl_page_cmp(o->tree, o->key, n) >= 0) return AVL_ERROR;
+    memcpy(o->key, n, o->tree->key_size);
+    o->seen = 1;
+
+    return AVL_SUCCESS;
+}
+
+
+/*
+ * struct avl_page_job_t - Subtree whose top levels will fill page
+ */
+typedef struct avl_page_job_t {
+    uint32_t root;
+    uint32_t page;
+} avl_page_job;
+
+
+/*
+ * struct avl_page_pack_t - State of avl_page_repack()
+ *
+ *     Element: avl_page_job *job; uint32_t jobs
+ *              Subtrees too big for a bin, each with the page its top
+ *              levels will fill, in the order they were met
+ *
+ *     Element: unsigned char *bin; uint32_t bin_page, bin_used
+ *              Page being filled with whole small subtrees (0 if none yet)
+ *              and its slots in use
+ *
+ *     Element: uint32_t next
+ *              Next page of the new file
+ */
+typedef struct avl_page_pack_t {
+    avl_page *tree;
+    int fd;
+    int error;
+    avl_page_job *job;
+    uint32_t jobs;
+    uint32_t *queue;
+    unsigned char *page;
+    unsigned char *bin;
+    uint32_t bin_page;
+    uint32_t bin_used;
+    uint32_t next;
+} avl_page_pack;
+
+
+#define AVL_PAGE_SLOT(t, p, s) ((avl_page_rec *)((p) + sizeof(avl_page_hdr) + (size_t)(s) * (t)->rec_size))
+
+
+/*
+ * avl_page_count() - Nodes below n if at most limit, else limit + 1
+ */
+static uint32_t
+avl_page_count(avl_page *t, uint32_t n, uint32_t limit)
+{
+    avl_page_rec *r;
+    uint32_t right, count;
+
+    if (n == 0) return 0;
+    if (limit == 0) return 1;
+
+    r = avl_page_node(t, n, 0);
+    right = r->child[1];
+    count = 1 + avl_page_count(t, r->child[0], limit - 1);
+    if (count > limit) return limit + 1;
+
+    return count + avl_page_count(t, right, limit - count);
+}
+
+
+static void
+avl_page_pack_write(avl_page_pack *p, unsigned char *buf, uint32_t page, uint32_t used)
+{
+    avl_page_hdr *h = (avl_page_hdr *)buf;
+
+    h->used = h->fresh = (uint16_t)used;
+    h->free = 0;
+    if (pwrite(p->fd, buf, AVL_PAGE_SIZE, (off_t)page * AVL_PAGE_SIZE) != AVL_PAGE_SIZE) p->error = 1;
+}
+
+
+/*
+ * avl_page_pack_copy() - Copy subtree n in preorder to the bin; returns the
+ * new id of n
+ */
+static uint32_t
+avl_page_pack_copy(avl_page_pack *p, uint32_t n)
+{
+    avl_page *t = p->tree;
+    uint32_t slot = p->bin_used++;
+    avl_page_rec *r = AVL_PAGE_SLOT(t, p->bin, slot);
+    int d;
+
+    memcpy(r, avl_page_node(t, n, 0), t->rec_size);
+    for (d = 0; d < 2; d++) {
+        if (r->child[d]) r->child[d] = avl_page_pack_copy(p, r->child[d]);
+    }
+
+    return p->bin_page * t->slots + slot;
+}
+
+
+/*
+ * avl_page_pack_place() - New id of subtree n: a subtree that fits a page
+ * goes whole to the bin, a bigger one waits for a page of its own, where
+ * its root takes the first slot
+ */
+static uint32_t
+avl_page_pack_place(avl_page_pack *p, uint32_t n)
+{
+    avl_page *t = p->tree;
+    uint32_t count = avl_page_count(t, n, t->slots);
+
+    if (count > t->slots) {
+        p->job[p->jobs].root = n;
+        p->job[p->jobs].page = p->next++;
+        return p->job[p->jobs++].page * t->slots;
+    }
+
+    if (p->bin_page == 0 || p->bin_used + count > t->slots) {
+        if (p->bin_page) avl_page_pack_write(p, p->bin, p->bin_page, p->bin_used);
+        memset(p->bin, 0, AVL_PAGE_SIZE);
+        p->bin_page = p->next++;
+        p->bin_used = 0;
+    }
+
+    return avl_page_pack_copy(p, n);
+}
+
+
+/*
+ * avl_page_pack_job() - Fill page with the top levels of subtree root in
+ * breadth-first order, and place the subtrees hanging below them
+ */
+static void
+avl_page_pack_job(avl_page_pack *p, uint32_t root, uint32_t page)
+{
+    avl_page *t = p->tree;
+    avl_page_rec *r;
+    uint32_t i, tail = 1;
+    int d;
+
+    memset(p->page, 0, AVL_PAGE_SIZE);
+    p->queue[0] = root;
+    for (i = 0; i < tail; i++) {
+        r = AVL_PAGE_SLOT(t, p->page, i);
+        memcpy(r, avl_page_node(t, p->queue[i], 0), t->rec_size);
+        for (d = 0; d < 2; d++) {
+            if (r->child[d] == 0) continue;
+            if (tail < t->slots) {
+                p->queue[tail] = r->child[d];
+                r->child[d] = page * t->slots + tail++;
+            } else {
+                r->child[d] = avl_page_pack_place(p, r->child[d]);
+            }
+        }
+    }
+    avl_page_pack_write(p, p->page, page, tail);
+}
+
+
+avl_page *
+avl_page_open(const char *path, size_t key_size, size_t value_size, avl_compare_fn comp,
+              int cache_pages, int options)
+{
+    avl_page *t;
+    size_t rec_size = (sizeof(avl_page_rec) + key_size + value_size + 7) & ~(size_t)7;
+    int i;
+
+    if (cache_pages < 4 || key_size == 0 || rec_size > AVL_PAGE_SIZE - sizeof(avl_page_hdr)) return NULL;
+
+    t = (avl_page *)calloc(1, sizeof(avl_page));
+    if (t == NULL) return NULL;
+
+    t->options = options;
+    t->comp = comp;
+    t->key_size = key_size;
+    t->value_size = value_size;
+    t->rec_size = rec_size;
+    t->slots = (AVL_PAGE_SIZE - sizeof(avl_page_hdr)) / rec_size;
+    t->frames = cache_pages;
+    t->mru = t->lru = -1;
+    for (t->bits = 1; (1 << t->bits) < 2 * cache_pages; t->bits++) ;
+
+    t->fd = open(path, O_RDWR | O_CREAT | ((options & AVL_PAGE_TRUNCATE) ? O_TRUNC : 0), 0644);
+    t->path = strdup(path);
+    t->buf = (unsigned char *)malloc((size_t)(cache_pages + 1) * AVL_PAGE_SIZE);
+    t->frame = (avl_page_frame *)calloc(cache_pages, sizeof(avl_page_frame));
+    t->bucket = (int *)malloc(sizeof(int) << t->bits);
+    if (t->fd < 0 || !t->path || !t->buf || !t->frame || !t->bucket) goto fail;
+    for (i = 0; i < (1 << t->bits); i++) t->bucket[i] = -1;
+
+    i = (int)pread(t->fd, &t->head, sizeof(t->head), 0);
+    if (i == 0) {
+        t->head.magic = AVL_PAGE_MAGIC;
+        t->head.page_size = AVL_PAGE_SIZE;
+        t->head.key_size = (uint32_t)key_size;
+        t->head.value_size = (uint32_t)value_size;
+        t->head.pages = 1;
+    } else if (i != sizeof(t->head) || t->head.magic != AVL_PAGE_MAGIC ||
+               t->head.page_size != AVL_PAGE_SIZE || t->head.key_size != key_size ||
+               t->head.value_size != value_size) {
+        goto fail;
+    }
+
+    return t;
+
+fail:
+    if (t->fd >= 0) close(t->fd);
+    free(t->path);
+    free(t->bucket);
+    free(t->frame);
+    free(t->buf);
+    free(t);
+    return NULL;
+}
+
+
+int
+avl_page_sync(avl_page *t)
+{
+    int f;
+
+    for (f = 0; f < t->used; f++) {
+        if (t->frame[f].dirty) avl_page_write(t, f);
+    }
+    if (pwrite(t->fd, &t->head, sizeof(t->head), 0) != sizeof(t->head)) t->error = 1;
+
+    return t->error ? AVL_ERROR : AVL_SUCCESS;
+}
+
+
+int
+avl_page_close(avl_page *t)
+{
+    int rc = avl_page_sync(t);
+
+    if (close(t->fd) != 0) rc = AVL_ERROR;
+    free(t->path);
+    free(t->bucket);
+    free(t->frame);
+    free(t->buf);
+    free(t);
+
+    return rc;
+}
+
+
+int
+avl_page_insert(avl_page *t, const void *key, const void *value)
+{
+    int grew = 0;
+
+    t->head.root = avl_page_ins(t, t->head.root, 0, key, value, &grew);
+
+    return (grew >= 0 && !t->error) ? AVL_SUCCESS : AVL_ERROR;
+}
+
+
+int
+avl_page_lookup(avl_page *t, const void *key, void *value)
+{
+    avl_page_rec *r;
+    uint32_t n = t->head.root, next;
+    int comp;
+
+    while ( n != 0 ) {
+        r = avl_page_node(t, n, 0);
+        comp = avl_page_cmp(t, AVL_PAGE_KEY(r), key);
+        if (comp == 0) {
+            if (value) memcpy(value, r->data + t->key_size, t->value_size);
+            return t->error ? AVL_ERROR : AVL_SUCCESS;
+        }
+        next = r->child[comp < 0];
+        if ((t->options & AVL_PAGE_PREFETCH) && next != 0 && next / t->slots != n / t->slots) {
+            avl_page_prefetch(t, next / t->slots);
+        }
+        n = next;
+    }
+
+    return AVL_ERROR;
+}
+
+
+int
+avl_page_remove(avl_page *t, const void *key)
+{
+    int lower = 0, found = 0;
+
+    t->head.root = avl_page_del(t, t->head.root, key, &lower, &found);
+
+    return (found && !t->error) ? AVL_SUCCESS : AVL_ERROR;
+}
+
+
+int
+avl_page_walk(avl_page *t, avl_walker_fn walk, void *ctx)
+{
+    return avl_page_walk_r(t, t->head.root, walk, ctx);
+}
+
+
+int
+avl_page_size(avl_page *t)
+{
+    return (int)t->head.size;
+}
+
+
+int
+avl_page_validate(avl_page *t)
+{
+    struct avl_page_order *o = (struct avl_page_order *)calloc(1, sizeof(*o) + t->key_size);
+    int valid;
+
+    if (o == NULL) return AVL_ERROR;
+    o->tree = t;
+    valid = avl_page_height(t, t->head.root) >= 0 && avl_page_walk(t, avl_page_ordered, o);
+    free(o);
+
+    return valid ? AVL_SUCCESS : AVL_ERROR;
+}
+
+
+int
+avl_page_repack(avl_page *t)
+{
+    avl_page_pack p;
+    avl_page_head head = t->head;
+    char *tmp = (char *)malloc(strlen(t->path) + sizeof(".repack"));
+    int i, rc = AVL_ERROR;
+
+    memset(&p, 0, sizeof(p));
+    p.tree = t;
+    p.fd = -1;
+    p.next = 1;
+    p.job = (avl_page_job *)malloc((head.size / t->slots + 1) * sizeof(avl_page_job));
+    p.queue = (uint32_t *)malloc(t->slots * sizeof(uint32_t));
+    p.page = (unsigned char *)malloc(AVL_PAGE_SIZE);
+    p.bin = (unsigned char *)malloc(AVL_PAGE_SIZE);
+    if (t->error || !tmp || !p.job || !p.queue || !p.page || !p.bin) goto done;
+
+    sprintf(tmp, "%s.repack", t->path);
+    p.fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (p.fd < 0) goto done;
+
+    if (head.root) head.root = avl_page_pack_place(&p, head.root);
+    for (i = 0; (uint32_t)i < p.jobs; i++) avl_page_pack_job(&p, p.job[i].root, p.job[i].page);
+    if (p.bin_page) avl_page_pack_write(&p, p.bin, p.bin_page, p.bin_used);
+    head.pages = p.next;
+    head.open = p.bin_page;
+    if (pwrite(p.fd, &head, sizeof(head), 0) != sizeof(head)) p.error = 1;
+
+    if (t->error || p.error || fsync(p.fd) != 0 || rename(tmp, t->path) != 0) {
+        close(p.fd);
+        unlink(tmp);
+        goto done;
+    }
+
+    /* the cache holds pages of the old file: drop them unwritten */
+    close(t->fd);
+    t->fd = p.fd;
+    t->head = head;
+    t->used = 0;
+    t->spare = 0;
+    t->mru = t->lru = -1;
+    for (i = 0; i < (1 << t->bits); i++) t->bucket[i] = -1;
+    rc = AVL_SUCCESS;
+
+done:
+    free(p.bin);
+    free(p.page);
+    free(p.queue);
+    free(p.job);
+    free(tmp);
+    return rc;
+}
+
+
+void
+avl_page_counters(avl_page *t, avl_page_stats *stats)
+{
+    *stats = t->stats;
+    stats->pages = t->head.pages;
+}
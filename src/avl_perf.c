@@ -0,0 +1,190 @@
+/*-----------------------------------------------------------------------------
+ * avl_perf.c - Hardware counter instrumentation for tree benchmarks
+ *
+ * Each event is a separate perf event (not a group), so that one event the
+ * machine lacks does not take the others down.  When the kernel multiplexes
+ * counters, counts are scaled by time enabled / time running.
+ *-----------------------------------------------------------------------------
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "avl.h"
+#include "avl_perf.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+
+struct avl_perf_t {
+    int fd[AVL_PERF_EVENTS];
+    double start[AVL_PERF_EVENTS];
+    double total[AVL_PERF_REGIONS][AVL_PERF_EVENTS];
+    unsigned long ops[AVL_PERF_REGIONS];
+};
+
+
+static const char *avl_perf_names[AVL_PERF_EVENTS] = {
+    "nsec", "instr", "llc", "dtlb", "brmiss", "faults"
+};
+
+
+#ifdef __linux__
+
+/*
+ * avl_perf_open() - Open one counter of the calling thread, user space only
+ */
+static int
+avl_perf_open(unsigned type, unsigned long long config)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+
+/*
+ * avl_perf_read() - Current (scaled) count of an event
+ */
+static double
+avl_perf_read(int fd)
+{
+    unsigned long long v[3];
+
+    if (read(fd, v, sizeof(v)) != sizeof(v) || v[2] == 0) return 0;
+
+    return (double)v[0] * ((double)v[1] / (double)v[2]);
+}
+
+#endif
+
+
+static double
+avl_perf_nsec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+
+avl_perf *
+avl_perf_init(void)
+{
+    avl_perf *perf = (avl_perf *)calloc(1, sizeof(avl_perf));
+    int e;
+
+    if (perf == NULL) return NULL;
+    for (e = 0; e < AVL_PERF_EVENTS; e++) perf->fd[e] = -1;
+
+#ifdef __linux__
+    perf->fd[AVL_PERF_INSTRUCTIONS] = avl_perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    perf->fd[AVL_PERF_CACHE_MISSES] = avl_perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    perf->fd[AVL_PERF_TLB_MISSES] = avl_perf_open(PERF_TYPE_HW_CACHE,
+                                                  PERF_COUNT_HW_CACHE_DTLB |
+                                                  PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                                                  PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    perf->fd[AVL_PERF_BRANCH_MISSES] = avl_perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    perf->fd[AVL_PERF_PAGE_FAULTS] = avl_perf_open(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS);
+#endif
+
+    return perf;
+}
+
+
+void
+avl_perf_free(avl_perf *perf)
+{
+#ifdef __linux__
+    int e;
+
+    for (e = 0; e < AVL_PERF_EVENTS; e++) {
+        if (perf->fd[e] >= 0) close(perf->fd[e]);
+    }
+#endif
+    free(perf);
+}
+
+
+int
+avl_perf_available(avl_perf *perf, int event)
+{
+    return event == AVL_PERF_NSEC || perf->fd[event] >= 0;
+}
+
+
+void
+avl_perf_begin(avl_perf *perf, int region)
+{
+    int e;
+
+    (void)region;
+    for (e = 1; e < AVL_PERF_EVENTS; e++) {
+#ifdef __linux__
+        if (perf->fd[e] >= 0) perf->start[e] = avl_perf_read(perf->fd[e]);
+#endif
+    }
+    perf->start[AVL_PERF_NSEC] = avl_perf_nsec();
+}
+
+
+void
+avl_perf_end(avl_perf *perf, int region, unsigned long ops)
+{
+    int e;
+
+    perf->total[region][AVL_PERF_NSEC] += avl_perf_nsec() - perf->start[AVL_PERF_NSEC];
+    for (e = 1; e < AVL_PERF_EVENTS; e++) {
+#ifdef __linux__
+        if (perf->fd[e] >= 0) perf->total[region][e] += avl_perf_read(perf->fd[e]) - perf->start[e];
+#endif
+    }
+    perf->ops[region] += ops;
+}
+
+
+double
+avl_perf_average(avl_perf *perf, int region, int event)
+{
+    if (!avl_perf_available(perf, event) || perf->ops[region] == 0) return -1;
+
+    return perf->total[region][event] / perf->ops[region];
+}
+
+
+void
+avl_perf_report(avl_perf *perf, FILE *out, const char *name)
+{
+    static const char *regions[AVL_PERF_REGIONS] = { "insert", "lookup", "remove", "walk" };
+    int r, e;
+
+    for (r = 0; r < AVL_PERF_REGIONS; r++) {
+        if (perf->ops[r] == 0) continue;
+
+        fprintf(out, "%s %-6s: n = %7lu", name, regions[r], perf->ops[r]);
+        for (e = 0; e < AVL_PERF_EVENTS; e++) {
+            if (avl_perf_available(perf, e)) {
+                fprintf(out, " %s = %6.1f", avl_perf_names[e], avl_perf_average(perf, r, e));
+            } else {
+                fprintf(out, " %s = %6s", avl_perf_names[e], "-");
+            }
+        }
+        fprintf(out, "\n");
+    }
+
+    memset(perf->total, 0, sizeof(perf->total));
+    memset(perf->ops, 0, sizeof(perf->ops));
+}
@@ -8,16 +8,16 @@
 #ifndef _AVL_PRIVATE_H_
 #define _AVL_PRIVATE_H_
 
+#include <string.h>
+
 /*
  * Macros for source compaction
  */
 #define AVL_INTR AVL_TREE_INTRUSIVE
-
-
-/*
- * AVL_MAX_HEIGHT: Max height of an avl tree 
- */
-#define AVL_MAX_HEIGHT 48 
+#define AVL_WAVL AVL_TREE_WAVL
+#define AVL_LAZY AVL_TREE_LAZY
+#define AVL_DEAD AVL_NODE_DEAD
+#define AVL_CNTD AVL_TREE_COUNTED
 
 
 /*
@@ -28,4 +28,300 @@
 #define AVL_NODE(d, t) ((t->opts & AVL_INTR) ? (d-t->idx*sizeof(avl_node)) : d)
 
 
+/*
+ * avl_prefix_get() / avl_prefix_set() - Key prefix cached after the data
+ * pointer by prefix-caching trees.  The slot is only pointer aligned, so it
+ * is copied rather than dereferenced as a uint64_t.
+ */
+static inline uint64_t
+avl_prefix_get(avl_node *n)
+{
+    uint64_t pfx;
+
+    memcpy(&pfx, (char *)n->data + sizeof(void *), sizeof(pfx));
+    return pfx;
+}
+
+static inline void
+avl_prefix_set(avl_node *n, uint64_t pfx)
+{
+    memcpy((char *)n->data + sizeof(void *), &pfx, sizeof(pfx));
+}
+
+
+/*
+ * avl_merkle_get() / avl_merkle_set() - Subtree hash cached after the data
+ * pointer (and the prefix) by Merkle-hashed trees
+ */
+#define AVL_MERKLE_OFFSET(t) (sizeof(void *) + ((t)->prefix ? sizeof(uint64_t) : 0))
+
+static inline uint64_t
+avl_merkle_get(avl_tree *tree, avl_node *n)
+{
+    uint64_t hash;
+
+    memcpy(&hash, (char *)n->data + AVL_MERKLE_OFFSET(tree), sizeof(hash));
+    return hash;
+}
+
+static inline void
+avl_merkle_set(avl_tree *tree, avl_node *n, uint64_t hash)
+{
+    memcpy((char *)n->data + AVL_MERKLE_OFFSET(tree), &hash, sizeof(hash));
+}
+
+
+/*
+ * AVL_AUGMENTED: The tree keeps per-subtree values that rotations must fix
+ */
+#define AVL_AUGMENTED(t) ((t)->augment || (t)->merkle)
+
+
+/*
+ * AVL_ITEM_OFFSET: Offset of the inline copy of the element (avl_init_inline)
+ *                  in a non-intrusive node: after the header, data pointer,
+ *                  and the cached prefix and Merkle hash if any, rounded up
+ *                  to 8 bytes so the copy is aligned for any scalar field
+ *
+ * AVL_NODE_BYTES:  Size of a non-intrusive node, inline copy included
+ */
+#define AVL_ITEM_OFFSET(t) ((sizeof(avl_node) + sizeof(void *) +               \
+                             ((t)->prefix ? sizeof(uint64_t) : 0) +            \
+                             ((t)->merkle ? sizeof(uint64_t) : 0) +            \
+                             sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1))
+
+#define AVL_NODE_BYTES(t)  (AVL_ITEM_OFFSET(t) + (t)->item)
+
+
+/*
+ * AVL_FREE_NODE: Free the memory of a node of a non-intrusive tree, unless
+ *                it lives in the block of a clone (avl_clone)
+ */
+#define AVL_FREE_NODE(t, n) do {                                              \
+    if (((t)->opts & AVL_INTR) == 0 &&                                         \
+        ((uintptr_t)(n) - (uintptr_t)(t)->block) >= (t)->block_size) {         \
+        free(n);                                                               \
+    }                                                                          \
+} while (0)
+
+
+/*
+ * AVL_COMPARE: Compare a node with data whose key prefix is pfx (unused
+ *              unless the tree caches prefixes)
+ */
+#define AVL_COMPARE(t, n, d, pfx, ctx) \
+    ((t)->prefix && avl_prefix_get(n) != (pfx) ? (avl_prefix_get(n) < (pfx) ? -1 : 1) \
+                                               : (t)->comp(AVL_DATA(n, t), d, ctx))
+
+
+/*
+ * AVL_COUNT_ACCESS: Sample a lookup hit on node n of a counted tree.  The
+ *                   count lives in the flag bits above AVL_NODE_SHIFT and
+ *                   saturates; a cheap LCG picks about one hit in eight.
+ */
+#define AVL_COUNT_MAX (~0u >> AVL_NODE_SHIFT)
+
+#define AVL_COUNT_ACCESS(t, n) do {                                       \
+    if ((t)->opts & AVL_CNTD) {                                           \
+        (t)->sample = (t)->sample * 1103515245u + 12345u;                 \
+        if (((t)->sample >> 16 & 7) == 0 &&                               \
+            ((n)->flags >> AVL_NODE_SHIFT) != AVL_COUNT_MAX) {            \
+            (n)->flags += 1u << AVL_NODE_SHIFT;                           \
+        }                                                                 \
+    }                                                                     \
+} while (0)
+
+
+/*
+ * AVL_RANK: Rank of a node in a rank-balanced (AVL_TREE_WAVL) tree.  The rank
+ *           is kept in the balance field; missing children have rank -1.
+ */
+#define AVL_RANK(n) ((n) ? (n)->balance : -1)
+
+
+/*
+ * AVL_SLOT: Address of the child pointer (or tree root) at depth k of a path
+ *           recorded by a descent into up[] / upd[]
+ */
+#define AVL_SLOT(t, up, upd, k) ((k) ? &(up)[(k)-1]->child[(upd)[(k)-1]] : &(t)->root)
+
+
+/*
+ * avl_merkle_mix() - Spread an element hash over all 64 bits, so that sums
+ * of weak user hashes still tell sets apart
+ */
+static inline uint64_t
+avl_merkle_mix(uint64_t h)
+{
+    h ^= h >> 30;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 27;
+    h *= 0x94D049BB133111EBULL;
+    return h ^ (h >> 31);
+}
+
+
+/*
+ * avl_augment_node() - Recompute the aggregate of one node from its children
+ */
+static inline void
+avl_augment_node(avl_tree *tree, avl_node *n)
+{
+    avl_node *l = n->child[0], *r = n->child[1];
+
+    if (tree->merkle) {
+        avl_merkle_set(tree, n, avl_merkle_mix(tree->merkle(AVL_DATA(n, tree))) +
+                                (l ? avl_merkle_get(tree, l) : 0) + (r ? avl_merkle_get(tree, r) : 0));
+    }
+    if (tree->augment) {
+        tree->augment(AVL_DATA(n, tree), l ? AVL_DATA(l, tree) : NULL,
+                      r ? AVL_DATA(r, tree) : NULL, tree->augment_ctx);
+    }
+}
+
+
+/*
+ * avl_augment_rotated() - Recompute a rotated subtree: the new root's
+ * children (which include the demoted nodes) first, then the root itself
+ */
+#define avl_augment_rotated(tree, root) do {           \
+    if (AVL_AUGMENTED(tree)) {                         \
+        if (root->child[0])                            \
+            avl_augment_node(tree, root->child[0]);    \
+        if (root->child[1])                            \
+            avl_augment_node(tree, root->child[1]);    \
+        avl_augment_node(tree, root);                  \
+    }                                                  \
+} while (0)
+
+
+/*
+ * Two way single rotation 
+ */
+#define avl_single(tree, root, dir) do {               \
+    avl_node *save = root->child[!dir];                \
+    root->child[!dir] = save->child[dir];              \
+    save->child[dir] = root;                           \
+    root = save;                                       \
+    tree->rotations += 1;                              \
+    avl_augment_rotated(tree, root);                   \
+} while (0)
+
+
+/*
+ * Two way double rotation 
+ */
+#define avl_double(tree, root, dir) do {               \
+    avl_node *save = root->child[!dir]->child[dir];    \
+    root->child[!dir]->child[dir] = save->child[!dir]; \
+    save->child[!dir] = root->child[!dir];             \
+    root->child[!dir] = save;                          \
+    save = root->child[!dir];                          \
+    root->child[!dir] = save->child[dir];              \
+    save->child[dir] = root;                           \
+    root = save;                                       \
+    tree->rotations += 2;                              \
+    avl_augment_rotated(tree, root);                   \
+} while (0)
+
+
+/*
+ * avl_augment_path() - Recompute the aggregates of up[top-1] .. up[0]
+ */
+static inline void
+avl_augment_path(avl_tree *tree, avl_node **up, int top)
+{
+    while ( --top >= 0 ) {
+        avl_augment_node(tree, up[top]);
+    }
+}
+
+
+/*
+ * avl_link() / avl_unlink() - Balancing core shared by all descents.  The
+ * caller records the path from the root in up[] (nodes) and upd[] (direction
+ * taken at each node); top is the path length.  avl_link() hangs node off the
+ * end of the path and rebalances.  avl_unlink() detaches the node at the end
+ * of the path, rebalances and returns it.  Neither calls the comparator.
+ */
+void
+avl_link(avl_tree *tree, avl_node **up, int *upd, int top, avl_node *node);
+
+avl_node *
+avl_unlink(avl_tree *tree, avl_node **up, int *upd, int top);
+
+
+/*
+ * avl_find_path() - Record the path from node down to the slot holding
+ * target, comparing with target's own key (a run of equal keys is searched
+ * on both sides).  Returns the path length, or -1 if target is not below
+ * node.  Start with top == 0 and node == tree->root.
+ */
+int
+avl_find_path(avl_tree *tree, avl_node *node, avl_node *target, avl_node **up, int *upd, int top, void *ctx);
+
+
+/*
+ * avl_bound_link() / avl_bound_unlink() - Capacity bound hooks, see
+ * avl_bound.c.  avl_bound_link() is called once a new node is linked and
+ * counted; it evicts down to capacity and returns the node, or NULL if the
+ * node itself was evicted.  avl_bound_unlink() is called for every node
+ * unlinked other than by eviction.
+ */
+avl_node *
+avl_bound_link(avl_tree *tree, avl_node *node, void *ctx);
+
+void
+avl_bound_unlink(avl_tree *tree, avl_node *node);
+
+void
+avl_bound_free(avl_tree *tree);
+
+
+/*
+ * avl_hash_add() / avl_hash_del() / avl_hash_find() - Hash side-index hooks,
+ * see avl_hash.c.  Every live node of a hashed tree is in the index; the
+ * hooks are called wherever a node is linked, unlinked or marked dead.
+ */
+void
+avl_hash_add(avl_tree *tree, avl_node *node);
+
+void
+avl_hash_del(avl_tree *tree, avl_node *node);
+
+avl_node *
+avl_hash_find(avl_tree *tree, void *data, void *ctx);
+
+void
+avl_hash_free(avl_tree *tree);
+
+
+/*
+ * avl_vine() - Flatten a tree into its in-order list linked through child[1]
+ * and return the number of nodes on it.  If purge is set, dead nodes are
+ * freed instead of listed.  The tree is left empty.
+ */
+int
+avl_vine(avl_tree *tree, avl_node **head, int purge);
+
+
+/*
+ * avl_build() - Take the first n nodes off an in-order list made by avl_vine()
+ * and relink them into a perfectly balanced subtree of the given tree type.
+ * The subtree height is returned in *height.
+ */
+avl_node *
+avl_build(avl_tree *tree, avl_node **list, int n, int *height);
+
+
+/*
+ * Rank-balanced (weak AVL) rebalancing, see avl_wavl.c
+ */
+void
+avl_wavl_insert_balance(avl_tree *tree, avl_node **up, int *upd, int top);
+
+void
+avl_wavl_remove_balance(avl_tree *tree, avl_node **up, int *upd, int top);
+
+
 #endif /* AVL_PRIVATE_H_ */
@@ -0,0 +1,585 @@
+/*-----------------------------------------------------------------------------
+ * avl_shm.c - Position independent avl trees in shared memory
+ *
+ * Same balancing as the pointer trees in avl.c, with child links stored as
+ * offsets from the region start (0 is the null offset: the header lives
+ * there, so no node can).
+ *
+ * The writer lock is a robust mutex.  If a process dies holding it, the next
+ * one to lock it rebuilds the tree from the node slots: every node records
+ * whether it holds a live item, and the header names the node an insert or
+ * remove was working on, which is dropped (the dead writer's call never
+ * returned, so either outcome is allowed).
+ *-----------------------------------------------------------------------------
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include "avl_shm.h"
+
+
+#define AVL_SHM_MAGIC   0x41564c53      /* "AVLS" */
+#define AVL_SHM_RETRIES 64
+
+
+typedef uint64_t avl_off;
+
+
+/*
+ * Node states
+ */
+#define AVL_SHM_FREE 0
+#define AVL_SHM_LIVE 1
+
+
+/*
+ * struct avl_shm_node_t - Node in the region; the item follows it inline
+ */
+typedef struct avl_shm_node_t {
+    int32_t       balance;
+    uint32_t      state;
+    avl_off       child[2];
+    unsigned char item[0];
+} avl_shm_node;
+
+
+/*
+ * struct avl_shm_hdr_t - Region header, at offset 0
+ *
+ *     Element: avl_off first, limit
+ *              Offsets of the first node slot and of the region end
+ *
+ *     Element: avl_off brk
+ *              Next never used node slot
+ *
+ *     Element: avl_off free
+ *              Free list of recycled nodes, linked through child[0]
+ *
+ *     Element: avl_off busy
+ *              Node an insert or remove is linking or unlinking, 0 if none
+ *
+ *     Element: uint32_t seq
+ *              Sequence lock; odd while a writer is modifying the tree
+ *
+ *     Element: pthread_mutex_t lock
+ *              Process-shared writer lock
+ */
+typedef struct avl_shm_hdr_t {
+    uint32_t        magic;
+    uint32_t        node_size;
+    uint64_t        item_size;
+    avl_off         first;
+    avl_off         limit;
+    avl_off         brk;
+    avl_off         free;
+    avl_off         root;
+    int64_t         size;
+    avl_off         busy;
+    uint32_t        seq;
+    pthread_mutex_t lock;
+} avl_shm_hdr;
+
+
+struct avl_shm_t {
+    avl_shm_hdr    *hdr;
+    char           *base;
+    avl_compare_fn  comp;
+};
+
+
+#define SHM_NODE(s, off) ((avl_shm_node *)((s)->base + (off)))
+#define SHM_ITEM(s, off) ((void *)SHM_NODE(s, off)->item)
+#define SHM_CHILD(s, off, dir) (SHM_NODE(s, off)->child[dir])
+
+
+/*
+ * Two way single rotation, returns the new subtree root
+ */
+static avl_off
+avl_shm_single(avl_shm *s, avl_off root, int dir)
+{
+    avl_off save = SHM_CHILD(s, root, !dir);
+
+    SHM_CHILD(s, root, !dir) = SHM_CHILD(s, save, dir);
+    SHM_CHILD(s, save, dir) = root;
+    return save;
+}
+
+
+/*
+ * Two way double rotation, returns the new subtree root
+ */
+static avl_off
+avl_shm_double(avl_shm *s, avl_off root, int dir)
+{
+    SHM_CHILD(s, root, !dir) = avl_shm_single(s, SHM_CHILD(s, root, !dir), !dir);
+    return avl_shm_single(s, root, dir);
+}
+
+
+/*
+ * Adjust balance before double rotation
+ */
+static void
+avl_shm_adjust_balance(avl_shm *s, avl_off root, int dir, int bal)
+{
+    avl_shm_node *r = SHM_NODE(s, root);
+    avl_shm_node *n = SHM_NODE(s, r->child[dir]);
+    avl_shm_node *nn = SHM_NODE(s, n->child[!dir]);
+
+    if ( nn->balance == 0 )
+        r->balance = n->balance = 0;
+    else if ( nn->balance == bal ) {
+        r->balance = -bal;
+        n->balance = 0;
+    } else {
+        r->balance = 0;
+        n->balance = bal;
+    }
+    nn->balance = 0;
+}
+
+
+/*
+ * Rebalance after insertion, returns the new subtree root
+ */
+static avl_off
+avl_shm_insert_balance(avl_shm *s, avl_off root, int dir)
+{
+    avl_shm_node *n = SHM_NODE(s, SHM_CHILD(s, root, dir));
+    int bal = dir == 0 ? -1 : +1;
+
+    if ( n->balance == bal ) {
+        SHM_NODE(s, root)->balance = n->balance = 0;
+        return avl_shm_single(s, root, !dir);
+    }
+    avl_shm_adjust_balance(s, root, dir, bal);
+    return avl_shm_double(s, root, !dir);
+}
+
+
+/*
+ * Rebalance after deletion, returns the new subtree root
+ */
+static avl_off
+avl_shm_remove_balance(avl_shm *s, avl_off root, int dir, int *done)
+{
+    avl_shm_node *n = SHM_NODE(s, SHM_CHILD(s, root, !dir));
+    int bal = dir == 0 ? -1 : +1;
+
+    if ( n->balance == -bal ) {
+        SHM_NODE(s, root)->balance = n->balance = 0;
+        return avl_shm_single(s, root, dir);
+    }
+    if ( n->balance == bal ) {
+        avl_shm_adjust_balance(s, root, !dir, -bal);
+        return avl_shm_double(s, root, dir);
+    }
+    SHM_NODE(s, root)->balance = -bal;
+    n->balance = bal;
+    *done = 1;
+    return avl_shm_single(s, root, dir);
+}
+
+
+/*
+ * avl_shm_link() - Link node q, whose item is set, and rebalance
+ */
+static void
+avl_shm_link(avl_shm *shm, avl_off q, void *ctx)
+{
+    avl_shm_hdr *h = shm->hdr;
+    avl_off up[AVL_MAX_HEIGHT], node;
+    int upd[AVL_MAX_HEIGHT], top = 0, k;
+
+    SHM_NODE(shm, q)->balance = 0;
+    SHM_CHILD(shm, q, 0) = SHM_CHILD(shm, q, 1) = 0;
+
+    for (node = h->root; node != 0; node = SHM_CHILD(shm, node, upd[top++])) {
+        up[top] = node;
+        upd[top] = shm->comp(SHM_ITEM(shm, node), SHM_ITEM(shm, q), ctx) < 0;
+    }
+
+    if (top) SHM_CHILD(shm, up[top - 1], upd[top - 1]) = q;
+    else h->root = q;
+
+    for (k = top - 1; k >= 0; k--) {
+        SHM_NODE(shm, up[k])->balance += upd[k] == 0 ? -1 : +1;
+        if (SHM_NODE(shm, up[k])->balance == 0) break;
+        if (abs ( SHM_NODE(shm, up[k])->balance ) > 1) {
+            node = avl_shm_insert_balance(shm, up[k], upd[k]);
+            if (k) SHM_CHILD(shm, up[k - 1], upd[k - 1]) = node;
+            else h->root = node;
+            break;
+        }
+    }
+    h->size++;
+}
+
+
+/*
+ * avl_shm_repair() - Rebuild the tree after a process died holding the lock:
+ * relink every live node but the busy one, and put the others on the free
+ * list.  Only node states and the busy node are trusted, so a repair cut
+ * short by another death can start over.
+ */
+static void
+avl_shm_repair(avl_shm *s)
+{
+    avl_shm_hdr *h = s->hdr;
+    avl_off q, free = 0;
+
+    if (h->busy) SHM_NODE(s, h->busy)->state = AVL_SHM_FREE;
+    h->root = 0;
+    h->size = 0;
+
+    for (q = h->brk; q > h->first; ) {
+        q -= h->node_size;
+        if (SHM_NODE(s, q)->state == AVL_SHM_LIVE) {
+            avl_shm_link(s, q, NULL);
+        } else {
+            SHM_CHILD(s, q, 0) = free;
+            free = q;
+        }
+    }
+    h->free = free;
+    h->busy = 0;
+}
+
+
+/*
+ * avl_shm_lock() - Take the writer lock, repairing the tree if its last
+ * owner died.  Readers see an odd sequence number during the repair.
+ */
+static int
+avl_shm_lock(avl_shm *s)
+{
+    int rc = pthread_mutex_lock(&s->hdr->lock);
+
+    if (rc == EOWNERDEAD) {
+        if ((s->hdr->seq & 1) == 0) __atomic_add_fetch(&s->hdr->seq, 1, __ATOMIC_ACQ_REL);
+        avl_shm_repair(s);
+        __atomic_add_fetch(&s->hdr->seq, 1, __ATOMIC_RELEASE);
+        rc = pthread_mutex_consistent(&s->hdr->lock);
+    }
+
+    return rc == 0 ? AVL_SUCCESS : AVL_ERROR;
+}
+
+
+/*
+ * avl_shm_set_busy() - Name the node a writer is about to change.  The
+ * compiler must not move the node updates above this store: a writer can
+ * die between any two of them.
+ */
+static void
+avl_shm_set_busy(avl_shm *s, avl_off node)
+{
+    __atomic_store_n(&s->hdr->busy, node, __ATOMIC_RELAXED);
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+}
+
+
+/*
+ * Writer side of the sequence lock
+ */
+static int
+avl_shm_write_lock(avl_shm *s)
+{
+    if (!avl_shm_lock(s)) return AVL_ERROR;
+    __atomic_add_fetch(&s->hdr->seq, 1, __ATOMIC_ACQ_REL);
+    return AVL_SUCCESS;
+}
+
+
+static void
+avl_shm_write_unlock(avl_shm *s)
+{
+    __atomic_store_n(&s->hdr->busy, 0, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&s->hdr->seq, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&s->hdr->lock);
+}
+
+
+/*
+ * Check an offset read without the lock before following it
+ */
+static int
+avl_shm_valid(avl_shm *s, avl_off off)
+{
+    avl_shm_hdr *h = s->hdr;
+
+    return off >= h->first && off < h->limit && (off - h->first) % h->node_size == 0;
+}
+
+
+avl_shm *
+avl_shm_create(void *region, size_t size, size_t item_size, avl_compare_fn comp)
+{
+    avl_shm_hdr *hdr = (avl_shm_hdr *)region;
+    pthread_mutexattr_t attr;
+
+    if (size < sizeof(avl_shm_hdr) || ((uintptr_t)region & 7)) return NULL;
+
+    memset(hdr, 0, sizeof(avl_shm_hdr));
+    hdr->node_size = (sizeof(avl_shm_node) + item_size + 7) & ~(size_t)7;
+    hdr->item_size = item_size;
+    hdr->first = (sizeof(avl_shm_hdr) + 7) & ~(size_t)7;
+    hdr->limit = size;
+    hdr->brk = hdr->first;
+
+    if (pthread_mutexattr_init(&attr) != 0) return NULL;
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    if (pthread_mutex_init(&hdr->lock, &attr) != 0) {
+        pthread_mutexattr_destroy(&attr);
+        return NULL;
+    }
+    pthread_mutexattr_destroy(&attr);
+
+    __atomic_store_n(&hdr->magic, AVL_SHM_MAGIC, __ATOMIC_RELEASE);
+
+    return avl_shm_attach(region, comp);
+}
+
+
+avl_shm *
+avl_shm_attach(void *region, avl_compare_fn comp)
+{
+    avl_shm *shm;
+
+    if (comp == NULL) return NULL;
+    if (__atomic_load_n(&((avl_shm_hdr *)region)->magic, __ATOMIC_ACQUIRE) != AVL_SHM_MAGIC) return NULL;
+
+    shm = (avl_shm *)calloc(1, sizeof(avl_shm));
+    if (shm == NULL) return NULL;
+
+    shm->hdr = (avl_shm_hdr *)region;
+    shm->base = (char *)region;
+    shm->comp = comp;
+
+    return shm;
+}
+
+
+void
+avl_shm_detach(avl_shm *shm)
+{
+    free(shm);
+}
+
+
+int
+avl_shm_insert(avl_shm *shm, void *item, void *ctx)
+{
+    avl_shm_hdr *h = shm->hdr;
+    avl_off q;
+
+    if (!avl_shm_write_lock(shm)) return AVL_ERROR;
+
+    if (h->free) {
+        q = h->free;
+        avl_shm_set_busy(shm, q);
+        h->free = SHM_CHILD(shm, q, 0);
+    } else if (h->brk + h->node_size <= h->limit) {
+        q = h->brk;
+        avl_shm_set_busy(shm, q);
+        h->brk += h->node_size;
+    } else {
+        avl_shm_write_unlock(shm);
+        return AVL_ERROR;
+    }
+    memcpy(SHM_ITEM(shm, q), item, h->item_size);
+    SHM_NODE(shm, q)->state = AVL_SHM_LIVE;
+    avl_shm_link(shm, q, ctx);
+
+    avl_shm_write_unlock(shm);
+    return AVL_SUCCESS;
+}
+
+
+int
+avl_shm_remove(avl_shm *shm, void *key, void *ctx)
+{
+    avl_shm_hdr *h = shm->hdr;
+    avl_off up[AVL_MAX_HEIGHT], node, temp, *slot;
+    int upd[AVL_MAX_HEIGHT], top = 0, n, comp, done = 0;
+
+    if (!avl_shm_write_lock(shm)) return AVL_ERROR;
+
+    for (node = h->root; node != 0; node = SHM_CHILD(shm, node, upd[top++])) {
+        comp = shm->comp(SHM_ITEM(shm, node), key, ctx);
+        if (comp == 0) break;
+        up[top] = node;
+        upd[top] = comp < 0;
+    }
+    if (node == 0) {
+        avl_shm_write_unlock(shm);
+        return AVL_ERROR;
+    }
+    avl_shm_set_busy(shm, node);
+
+    slot = top ? &SHM_CHILD(shm, up[top - 1], upd[top - 1]) : &h->root;
+    if (SHM_CHILD(shm, node, 0) == 0 || SHM_CHILD(shm, node, 1) == 0) {
+        *slot = SHM_CHILD(shm, node, SHM_CHILD(shm, node, 0) == 0);
+    } else {
+        temp = SHM_CHILD(shm, node, 1);
+        upd[top] = 1;
+        up[top] = node;
+        n = top++;
+        while ( SHM_CHILD(shm, temp, 0) != 0 ) {
+            upd[top] = 0;
+            up[top++] = temp;
+            temp = SHM_CHILD(shm, temp, 0);
+        }
+        SHM_CHILD(shm, up[top - 1], upd[top - 1]) = SHM_CHILD(shm, temp, 1);
+        SHM_CHILD(shm, temp, 0) = SHM_CHILD(shm, node, 0);
+        SHM_CHILD(shm, temp, 1) = SHM_CHILD(shm, node, 1);
+        SHM_NODE(shm, temp)->balance = SHM_NODE(shm, node)->balance;
+        up[n] = temp;
+        *slot = temp;
+    }
+
+    while ( --top >= 0 && !done ) {
+        SHM_NODE(shm, up[top])->balance += upd[top] != 0 ? -1 : +1;
+        if (abs ( SHM_NODE(shm, up[top])->balance ) == 1) {
+            break;
+        } else if (abs ( SHM_NODE(shm, up[top])->balance ) > 1) {
+            up[top] = avl_shm_remove_balance(shm, up[top], upd[top], &done);
+            if (top) SHM_CHILD(shm, up[top - 1], upd[top - 1]) = up[top];
+            else h->root = up[top];
+        }
+    }
+
+    SHM_NODE(shm, node)->state = AVL_SHM_FREE;
+    SHM_CHILD(shm, node, 0) = h->free;
+    h->free = node;
+    h->size--;
+
+    avl_shm_write_unlock(shm);
+    return AVL_SUCCESS;
+}
+
+
+/*
+ * avl_shm_search() - One lookup attempt.  Returns 1 found, 0 not found, -1 if
+ * an offset read was implausible (a writer got in the way).
+ */
+static int
+avl_shm_search(avl_shm *shm, void *key, void *out, void *ctx)
+{
+    avl_off node = __atomic_load_n(&shm->hdr->root, __ATOMIC_RELAXED);
+    int comp, depth;
+
+    for (depth = 0; node != 0; depth++) {
+        if (depth == AVL_MAX_HEIGHT || !avl_shm_valid(shm, node)) return -1;
+        comp = shm->comp(SHM_ITEM(shm, node), key, ctx);
+        if (comp == 0) {
+            if (out) memcpy(out, SHM_ITEM(shm, node), shm->hdr->item_size);
+            return 1;
+        }
+        node = __atomic_load_n(&SHM_CHILD(shm, node, comp < 0), __ATOMIC_RELAXED);
+    }
+    return 0;
+}
+
+
+int
+avl_shm_lookup(avl_shm *shm, void *key, void *out, void *ctx)
+{
+    uint32_t seq;
+    int tries, found;
+
+    for (tries = 0; tries < AVL_SHM_RETRIES; tries++) {
+        seq = __atomic_load_n(&shm->hdr->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) continue;
+        found = avl_shm_search(shm, key, out, ctx);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (found >= 0 && __atomic_load_n(&shm->hdr->seq, __ATOMIC_RELAXED) == seq) {
+            return found ? AVL_SUCCESS : AVL_ERROR;
+        }
+    }
+
+    /*
+     * Too much write traffic: take the writer lock to get a stable view
+     */
+    if (!avl_shm_lock(shm)) return AVL_ERROR;
+    found = avl_shm_search(shm, key, out, ctx);
+    pthread_mutex_unlock(&shm->hdr->lock);
+
+    return found > 0 ? AVL_SUCCESS : AVL_ERROR;
+}
+
+
+int
+avl_shm_walk(avl_shm *shm, avl_walker_fn walk, void *ctx)
+{
+    avl_off up[AVL_MAX_HEIGHT], node;
+    int top = 0, rc = AVL_SUCCESS;
+
+    if (!avl_shm_lock(shm)) return AVL_ERROR;
+
+    node = shm->hdr->root;
+    while ( rc && (node != 0 || top > 0) ) {
+        while ( node != 0 ) {
+            up[top++] = node;
+            node = SHM_CHILD(shm, node, 0);
+        }
+        node = up[--top];
+        rc = walk(SHM_ITEM(shm, node), ctx);
+        node = SHM_CHILD(shm, node, 1);
+    }
+
+    pthread_mutex_unlock(&shm->hdr->lock);
+    return rc ? AVL_SUCCESS : AVL_ERROR;
+}
+
+
+int
+avl_shm_size(avl_shm *shm)
+{
+    return (int)shm->hdr->size;
+}
+
+
+/*
+ * avl_shm_check() - Height of the subtree at node, or -1 if it is not a valid
+ * AVL subtree with items between lo and hi (NULL for no bound)
+ */
+static int
+avl_shm_check(avl_shm *shm, avl_off node, void *lo, void *hi, int depth, int64_t *count, void *ctx)
+{
+    void *item;
+    int lh, rh, bal;
+
+    if (node == 0) return 0;
+    if (depth == AVL_MAX_HEIGHT || !avl_shm_valid(shm, node)) return -1;
+
+    item = SHM_ITEM(shm, node);
+    if ((lo && shm->comp(lo, item, ctx) > 0) || (hi && shm->comp(item, hi, ctx) > 0)) return -1;
+
+    lh = avl_shm_check(shm, SHM_CHILD(shm, node, 0), lo, item, depth + 1, count, ctx);
+    rh = avl_shm_check(shm, SHM_CHILD(shm, node, 1), item, hi, depth + 1, count, ctx);
+    bal = SHM_NODE(shm, node)->balance;
+    if (lh < 0 || rh < 0 || bal != rh - lh || abs(bal) > 1) return -1;
+    (*count)++;
+
+    return (lh > rh ? lh : rh) + 1;
+}
+
+
+int
+avl_shm_validate(avl_shm *shm, void *ctx)
+{
+    int64_t count = 0;
+    int valid;
+
+    if (!avl_shm_lock(shm)) return AVL_ERROR;
+    valid = avl_shm_check(shm, shm->hdr->root, NULL, NULL, 0, &count, ctx) >= 0 && count == shm->hdr->size;
+    pthread_mutex_unlock(&shm->hdr->lock);
+
+    return valid ? AVL_SUCCESS : AVL_ERROR;
+}
@@ -0,0 +1,115 @@
+/*-----------------------------------------------------------------------------
+ * avl_wavl.c - rank-balanced (weak AVL) rebalancing
+ *
+ * Every node stores a rank in its balance field.  The rank difference of a
+ * child is its parent's rank minus its own (missing children have rank -1).
+ * All rank differences are 1 or 2 and every leaf has rank 0.  Insertion
+ * rebalancing is the same as in an AVL tree; removal demotes nodes on the way
+ * up and finishes with at most one single or double rotation.
+ *-----------------------------------------------------------------------------
+ */
+
+#include <stdlib.h>
+#include "avl.h"
+#include "avl_private.h"
+
+
+/*
+ * The path up[0..top-1] leads to a node that was just linked as a leaf.  Walk
+ * back up promoting 0-children until a rotation or a 1,2 node ends it.
+ */
+void
+avl_wavl_insert_balance(avl_tree *tree, avl_node **up, int *upd, int top)
+{
+    avl_node *p, *x, *y;
+    int k, dir;
+
+    for (k = top - 1; k >= 0; k--) {
+        p = up[k];
+        dir = upd[k];
+        x = p->child[dir];
+
+        if (AVL_RANK(p) != AVL_RANK(x)) break;
+
+        if (AVL_RANK(p) - AVL_RANK(p->child[!dir]) == 1) {
+            p->balance++;
+            continue;
+        }
+
+        /*
+         * p is a 0,2 node: rotate x (single) or x's inner child (double) up
+         */
+        y = x->child[!dir];
+        if (AVL_RANK(x) - AVL_RANK(y) == 2) {
+            p->balance--;
+            avl_single ( tree, p, !dir );
+        } else {
+            y->balance++;
+            x->balance--;
+            p->balance--;
+            avl_double ( tree, p, !dir );
+        }
+        *AVL_SLOT(tree, up, upd, k) = p;
+        break;
+    }
+}
+
+
+/*
+ * The path up[0..top-1] leads to the slot whose subtree just lost a node.
+ * Demote 2,2 leaves and parents of 3-children on the way up; a 3-child whose
+ * sibling cannot be demoted is fixed by one rotation, which ends the walk.
+ */
+void
+avl_wavl_remove_balance(avl_tree *tree, avl_node **up, int *upd, int top)
+{
+    avl_node *p, *x, *y, *z;
+    int k, dir;
+
+    for (k = top - 1; k >= 0; k--) {
+        p = up[k];
+        dir = upd[k];
+        x = p->child[dir];
+        y = p->child[!dir];
+
+        if (x == NULL && y == NULL) {
+            if (p->balance == 0) break;
+            p->balance = 0;
+            continue;
+        }
+
+        if (AVL_RANK(p) - AVL_RANK(x) < 3) break;
+
+        if (AVL_RANK(p) - AVL_RANK(y) == 2) {
+            p->balance--;
+            continue;
+        }
+
+        if (AVL_RANK(y) - AVL_RANK(y->child[0]) == 2 &&
+            AVL_RANK(y) - AVL_RANK(y->child[1]) == 2) {
+            p->balance--;
+            y->balance--;
+            continue;
+        }
+
+        /*
+         * y is a 1-child with a 1-child: rotate on the outer (z) or the inner
+         * grandchild
+         */
+        z = y->child[!dir];
+        if (AVL_RANK(y) - AVL_RANK(z) == 1) {
+            y->balance++;
+            p->balance--;
+            if (x == NULL && y->child[dir] == NULL) p->balance--;
+            avl_single ( tree, p, dir );
+        } else {
+            z = y->child[dir];
+            z->balance += 2;
+            y->balance--;
+            p->balance -= 2;
+            avl_double ( tree, p, dir );
+        }
+        *AVL_SLOT(tree, up, upd, k) = p;
+        break;
+    }
+}
@@ -0,0 +1,351 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <malloc.h>
+#include <sys/time.h>
+#include "avl.h"
+#include "avl_compress.h"
+
+#define NNN 200000
+
+
+/*
+ * Integer keyed records (a sparse id space) and string keyed ones
+ */
+typedef struct irec_t {
+    uint64_t key;
+    int      value;
+} irec;
+
+typedef struct srec_t {
+    char key[24];
+    int  value;
+} srec;
+
+int order[NNN];
+
+
+int irec_compare(void *a, void *b, void *ctx)
+{
+    uint64_t x = ((irec*)a)->key, y = ((irec*)b)->key;
+
+    return (x > y) - (x < y);
+}
+
+
+int irec_descending(void *a, void *b, void *ctx)
+{
+    return irec_compare(b, a, ctx);
+}
+
+
+int srec_compare(void *a, void *b, void *ctx)
+{
+    return strcmp(((srec*)a)->key, ((srec*)b)->key);
+}
+
+
+void irec_record(void *n, avl_record *rec)
+{
+    rec->ikey = ((irec*)n)->key;
+    rec->value = &((irec*)n)->value;
+    rec->value_len = sizeof(int);
+}
+
+
+void srec_record(void *n, avl_record *rec)
+{
+    rec->key = ((srec*)n)->key;
+    rec->key_len = strlen(((srec*)n)->key);
+    rec->value = &((srec*)n)->value;
+    rec->value_len = sizeof(int);
+}
+
+
+/*
+ * Orders by key only, so records with one key are kept side by side
+ */
+int irec_dup_compare(void *a, void *b, void *ctx)
+{
+    int comp = irec_compare(a, b, ctx);
+
+    return comp ? comp : (a > b) - (a < b);
+}
+
+
+/*
+ * Walker: counts the records of ctx[1]'s key into ctx[0]
+ */
+int irec_dup_scanned(void *n, void *ctx)
+{
+    const avl_record *rec = (const avl_record*)n;
+    uint64_t *seen = (uint64_t*)ctx;
+
+    if (rec->ikey == seen[1]) seen[0]++;
+    return AVL_SUCCESS;
+}
+
+
+/*
+ * Walker: records come in order, with the value of their key; ctx holds
+ * the count and the previous key
+ */
+int irec_scanned(void *n, void *ctx)
+{
+    const avl_record *rec = (const avl_record*)n;
+    uint64_t *seen = (uint64_t*)ctx;
+    int value;
+
+    memcpy(&value, rec->value, sizeof(int));
+    assert(rec->value_len == sizeof(int) && (uint64_t)value * 7 + 1000 == rec->ikey);
+    assert(seen[0] == 0 || rec->ikey > seen[1]);
+    seen[0]++;
+    seen[1] = rec->ikey;
+
+    return AVL_SUCCESS;
+}
+
+
+int srec_scanned(void *n, void *ctx)
+{
+    const avl_record *rec = (const avl_record*)n;
+    char key[24];
+    int value;
+
+    memcpy(&value, rec->value, sizeof(int));
+    snprintf(key, sizeof(key), "user:%08d", value);
+    assert(rec->key_len == strlen(key) && memcmp(rec->key, key, rec->key_len) == 0);
+    (*(int*)ctx)++;
+
+    return AVL_SUCCESS;
+}
+
+
+static long
+msec(struct timeval *start)
+{
+    struct timeval end;
+
+    gettimeofday(&end, NULL);
+    return (end.tv_sec - start->tv_sec) * 1000 + (end.tv_usec - start->tv_usec) / 1000;
+}
+
+
+static void
+shuffle(int seed)
+{
+    int i, j, t;
+
+    for (i = 0; i < NNN; i++) order[i] = i;
+    for (i = NNN - 1, srand(seed); i > 0; i--) {
+        j = rand() % (i + 1);
+        t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+}
+
+
+static void
+int_test(void)
+{
+    avl_tree *tree = avl_init(irec_compare, free, 0);
+    avl_compressed *packed;
+    avl_record key, lo, hi, rec;
+    struct timeval start;
+    size_t heap = mallinfo2().uordblks, live;
+    uint64_t seen[2] = { 0, 0 };
+    long tree_ms, packed_ms;
+    irec item, *r;
+    int i, value;
+
+    shuffle(47);
+    for (i = 0; i < NNN; i++) {
+        r = (irec*)malloc(sizeof(irec));
+        r->key = (uint64_t)order[i] * 7 + 1000;
+        r->value = order[i];
+        avl_insert(tree, r, NULL);
+    }
+    live = mallinfo2().uordblks - heap;
+
+    packed = avl_compress(tree, irec_record, AVL_COMPRESS_INT);
+    assert(packed != NULL && avl_compressed_size(packed) == NNN);
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < NNN; i++) {
+        item.key = (uint64_t)order[i] * 7 + 1000;
+        assert(avl_lookup(tree, &item, NULL) != NULL);
+    }
+    tree_ms = msec(&start);
+
+    memset(&key, 0, sizeof(key));
+    gettimeofday(&start, NULL);
+    for (i = 0; i < NNN; i++) {
+        key.ikey = (uint64_t)order[i] * 7 + 1000;
+        assert(avl_compressed_lookup(packed, &key, &rec) == AVL_SUCCESS);
+        memcpy(&value, rec.value, sizeof(int));
+        assert(value == order[i]);
+    }
+    packed_ms = msec(&start);
+
+    /* keys between and around the stored ones */
+    for (key.ikey = 0; key.ikey < 3000; key.ikey++) {
+        assert(avl_compressed_lookup(packed, &key, NULL) ==
+               (key.ikey >= 1000 && (key.ikey - 1000) % 7 == 0 ? AVL_SUCCESS : AVL_ERROR));
+    }
+    key.ikey = (uint64_t)NNN * 7 + 1000;
+    assert(avl_compressed_lookup(packed, &key, NULL) == AVL_ERROR);
+
+    /* the whole snapshot, then a range with bounds between keys */
+    assert(avl_compressed_scan(packed, NULL, NULL, irec_scanned, seen) == AVL_SUCCESS);
+    assert(seen[0] == NNN);
+    memset(&lo, 0, sizeof(lo));
+    memset(&hi, 0, sizeof(hi));
+    lo.ikey = 1000 + 7 * 500 - 3;
+    hi.ikey = 1000 + 7 * 1500 + 3;
+    seen[0] = 0;
+    assert(avl_compressed_scan(packed, &lo, &hi, irec_scanned, seen) == AVL_SUCCESS);
+    assert(seen[0] == 1001 && seen[1] == 1000 + 7 * 1500);
+
+    printf("INT   : n = %d tree %zu bytes, packed %zu bytes (%.1fx), lookups %ld / %ld msec\n",
+           NNN, live, avl_compressed_bytes(packed), (double)live / avl_compressed_bytes(packed),
+           tree_ms, packed_ms);
+    /* (glibc heap only; other allocators report nothing) */
+    assert(live == 0 || live > 5 * avl_compressed_bytes(packed));
+
+    avl_free(tree);
+    /* the snapshot does not need the tree */
+    key.ikey = 1000 + 7 * 12345;
+    assert(avl_compressed_lookup(packed, &key, NULL) == AVL_SUCCESS);
+    avl_compressed_free(packed);
+}
+
+
+static void
+string_test(void)
+{
+    avl_tree *tree = avl_init(srec_compare, free, 0);
+    avl_compressed *packed;
+    avl_record key, rec;
+    size_t heap = mallinfo2().uordblks, live;
+    char buf[24];
+    srec *r;
+    int i, value, count = 0;
+
+    shuffle(53);
+    for (i = 0; i < NNN; i++) {
+        r = (srec*)malloc(sizeof(srec));
+        snprintf(r->key, sizeof(r->key), "user:%08d", order[i]);
+        r->value = order[i];
+        avl_insert(tree, r, NULL);
+    }
+    live = mallinfo2().uordblks - heap;
+
+    packed = avl_compress(tree, srec_record, AVL_COMPRESS_BYTES);
+    assert(packed != NULL && avl_compressed_size(packed) == NNN);
+
+    memset(&key, 0, sizeof(key));
+    key.key = buf;
+    for (i = 0; i < NNN; i++) {
+        key.key_len = snprintf(buf, sizeof(buf), "user:%08d", order[i]);
+        assert(avl_compressed_lookup(packed, &key, &rec) == AVL_SUCCESS);
+        memcpy(&value, rec.value, sizeof(int));
+        assert(value == order[i]);
+    }
+    key.key_len = snprintf(buf, sizeof(buf), "user:");
+    assert(avl_compressed_lookup(packed, &key, NULL) == AVL_ERROR);
+    key.key_len = snprintf(buf, sizeof(buf), "user:%08d0", 77);
+    assert(avl_compressed_lookup(packed, &key, NULL) == AVL_ERROR);
+    key.key_len = snprintf(buf, sizeof(buf), "zzz");
+    assert(avl_compressed_lookup(packed, &key, NULL) == AVL_ERROR);
+
+    /* "user:0000100*": 10 keys */
+    key.key_len = snprintf(buf, sizeof(buf), "user:0000100");
+    rec = key;
+    rec.key = "user:0000100~";
+    rec.key_len = strlen("user:0000100~");
+    assert(avl_compressed_scan(packed, &key, &rec, srec_scanned, &count) == AVL_SUCCESS);
+    assert(count == 10);
+    count = 0;
+    assert(avl_compressed_scan(packed, NULL, NULL, srec_scanned, &count) == AVL_SUCCESS);
+    assert(count == NNN);
+
+    printf("BYTES : n = %d tree %zu bytes, packed %zu bytes (%.1fx)\n",
+           NNN, live, avl_compressed_bytes(packed), (double)live / avl_compressed_bytes(packed));
+    /* (glibc heap only; other allocators report nothing) */
+    assert(live == 0 || live > 5 * avl_compressed_bytes(packed));
+
+    avl_free(tree);
+    avl_compressed_free(packed);
+}
+
+
+/*
+ * A run of one key that starts near the end of a block and goes on into the
+ * next: a scan from that key must see the whole run
+ */
+static void
+dup_test(void)
+{
+    avl_tree *tree = avl_init(irec_dup_compare, NULL, 0);
+    avl_compressed *packed;
+    avl_record lo;
+    irec item[100];
+    uint64_t seen[2];
+    int i;
+
+    for (i = 0; i < 100; i++) {
+        item[i].key = i < 20 ? i : i < 60 ? 20 : i;
+        item[i].value = i;
+        avl_insert(tree, &item[i], NULL);
+    }
+    packed = avl_compress(tree, irec_record, AVL_COMPRESS_INT);
+    assert(packed != NULL && avl_compressed_size(packed) == 100);
+
+    memset(&lo, 0, sizeof(lo));
+    lo.ikey = seen[1] = 20;
+    seen[0] = 0;
+    assert(avl_compressed_scan(packed, &lo, &lo, irec_dup_scanned, seen) == AVL_SUCCESS);
+    assert(seen[0] == 40);
+    assert(avl_compressed_lookup(packed, &lo, NULL) == AVL_SUCCESS);
+
+    avl_compressed_free(packed);
+    avl_free(tree);
+}
+
+
+int main(int argc, char *argv[])
+{
+    avl_tree *tree;
+    avl_compressed *packed;
+    avl_record key;
+    irec a = { 1, 0 }, b = { 2, 0 };
+
+    printf("\nCOMPRESS (%d records per block):\n", AVL_COMPRESS_BLOCK);
+
+    int_test();
+    string_test();
+    dup_test();
+
+    /* an empty tree compresses to an empty snapshot */
+    tree = avl_init(irec_compare, NULL, 0);
+    packed = avl_compress(tree, irec_record, AVL_COMPRESS_INT);
+    memset(&key, 0, sizeof(key));
+    assert(packed && avl_compressed_size(packed) == 0);
+    assert(avl_compressed_lookup(packed, &key, NULL) == AVL_ERROR);
+    assert(avl_compressed_scan(packed, NULL, NULL, irec_scanned, NULL) == AVL_SUCCESS);
+    avl_compressed_free(packed);
+
+    avl_free(tree);
+
+    /* a tree not in ascending key order is refused */
+    tree = avl_init(irec_descending, NULL, 0);
+    avl_insert(tree, &a, NULL);
+    avl_insert(tree, &b, NULL);
+    assert(avl_compress(tree, irec_record, AVL_COMPRESS_INT) == NULL);
+    avl_free(tree);
+    printf("\n");
+
+    return 0;
+}
@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <sys/time.h>
+#include <assert.h>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+#include "avl.hpp"
+
+#define NNN 60000
+
+
+/*
+ * Allocator that counts live node allocations
+ */
+static long live_nodes;
+
+template <class T>
+struct counting_alloc {
+    typedef T value_type;
+
+    counting_alloc() {}
+    template <class U> counting_alloc(const counting_alloc<U> &) {}
+
+    T *allocate(std::size_t n) { live_nodes += n; return std::allocator<T>().allocate(n); }
+    void deallocate(T *p, std::size_t n) { live_nodes -= n; std::allocator<T>().deallocate(p, n); }
+
+    template <class U> bool operator==(const counting_alloc<U> &) const { return true; }
+    template <class U> bool operator!=(const counting_alloc<U> &) const { return false; }
+};
+
+
+struct item {
+    avl_node hook;
+    int      key;
+
+    bool operator<(const item &other) const { return key < other.key; }
+};
+
+
+struct item_less {
+    bool operator()(const item &a, const item &b) const { return a.key < b.key; }
+    bool operator()(int a, const item &b) const { return a < b.key; }
+    bool operator()(const item &a, int b) const { return a.key < b; }
+};
+
+
+int int_compare(void *a, void *b, void *ctx)
+{
+    return *((int*)a) - *((int*)b);
+}
+
+
+static long
+msec(struct timeval *start, struct timeval *finish)
+{
+    return (long)(finish->tv_sec - start->tv_sec) * 1000 + (finish->tv_usec - start->tv_usec) / 1000;
+}
+
+
+int main(int argc, char *argv[])
+{
+    struct timeval start, finish;
+    std::vector<int> keys(NNN);
+    int i;
+
+    for (i = 0; i < NNN; i++) keys[i] = (i * 7919) % NNN;
+
+    printf("\nC++ TREE:\n");
+    {
+        typedef avl::tree<int, std::unique_ptr<std::string>, std::less<int>,
+                          counting_alloc<std::pair<const int, std::unique_ptr<std::string> > > > map;
+        map tree;
+
+        gettimeofday(&start, NULL);
+        for (i = 0; i < NNN; i++) {
+            std::unique_ptr<std::string> value(new std::string(std::to_string(keys[i])));
+            assert(tree.emplace(keys[i], std::move(value)).second);
+        }
+        gettimeofday(&finish, NULL);
+        assert(!tree.emplace(keys[0], nullptr).second);
+        assert(!tree.try_emplace(keys[0]).second);
+
+        /* the iterator an insert returns carries a usable path */
+        for (i = NNN; i < NNN + 100; i++) {
+            map::iterator it = i % 2 ? tree.try_emplace(i).first : tree.emplace(i, nullptr).first;
+            assert(it->first == i && std::prev(it)->first == i - 1 && std::next(it) == tree.end());
+        }
+        for (i = NNN; i < NNN + 100; i++) assert(tree.erase(i) == 1);
+        assert(live_nodes == NNN && (long)tree.size() == NNN);
+        printf("INSERT: n = %7d v = %d (%ld msec)\n", (int)tree.size(),
+                                                     std::is_sorted(tree.begin(), tree.end(),
+                                                                    [](const map::value_type &a, const map::value_type &b) {
+                                                                        return a.first < b.first;
+                                                                    }),
+                                                     msec(&start, &finish));
+
+        gettimeofday(&start, NULL);
+        for (i = 0; i < NNN; i++) assert(*tree.find(keys[i])->second == std::to_string(keys[i]));
+        gettimeofday(&finish, NULL);
+        printf("LOOKUP: n = %7d v = %d (%ld msec)\n", NNN,
+                                                     std::distance(tree.begin(), tree.end()) == NNN &&
+                                                     std::distance(tree.rbegin(), tree.rend()) == NNN,
+                                                     msec(&start, &finish));
+
+        assert(tree.lower_bound(100)->first == 100 && tree.upper_bound(100)->first == 101);
+        assert(tree.find(NNN) == tree.end() && tree.lower_bound(NNN) == tree.end());
+        assert((--tree.end())->first == NNN - 1 && tree.rbegin()->first == NNN - 1);
+        assert(std::count_if(tree.begin(), tree.end(),
+                             [](const map::value_type &v) { return v.first % 2 == 0; }) == NNN / 2);
+
+        gettimeofday(&start, NULL);
+        for (map::iterator it = tree.begin(); it != tree.end(); ) {
+            if (it->first % 2) it = tree.erase(it); else ++it;
+        }
+        for (i = 0; i < NNN; i += 4) assert(tree.erase(i) == 1);
+        gettimeofday(&finish, NULL);
+        assert(tree.erase(1) == 0 && live_nodes == (long)tree.size());
+        printf("REMOVE: n = %7d v = %d (%ld msec)\n", (int)tree.size(),
+                                                     tree.begin()->first == 2 && tree.find(4) == tree.end(),
+                                                     msec(&start, &finish));
+
+        map moved(std::move(tree));
+        assert(tree.empty() && moved.size() == NNN / 4);
+        moved[1] = nullptr;
+        assert(moved.begin()->first == 1);
+        moved.clear();
+        assert(live_nodes == 0);
+    }
+
+    printf("\nC++ INTRUSIVE:\n");
+    {
+        std::vector<item> items(NNN);
+        avl::intrusive_tree<item, &item::hook, item_less> tree(item_less(), AVL_TREE_WAVL);
+
+        for (i = 0; i < NNN; i++) items[i].key = keys[i];
+
+        gettimeofday(&start, NULL);
+        for (i = 0; i < NNN; i++) assert(tree.insert(items[i]).second);
+        gettimeofday(&finish, NULL);
+        printf("INSERT: n = %7d r = %6lu (%ld msec)\n", (int)tree.size(), tree.rotations(),
+                                                       msec(&start, &finish));
+
+        assert(&*tree.find(keys[5]) == &items[5] && tree.count(NNN) == 0);
+        assert(tree.erase(items[5]) == &items[5] && tree.find(keys[5]) == tree.end());
+        for (i = 0; i < NNN; i += 3) tree.erase(items[i]);
+
+        /* erase and insert hand back iterators with the path after rebalancing */
+        for (auto it = tree.begin(); it != tree.end(); ) {
+            int key = it->key;
+            if (key % 5 == 1) {
+                it = tree.erase(it);
+                assert(it == tree.end() || it->key > key);
+                assert(it == tree.begin() || std::prev(it)->key < key);
+            } else {
+                ++it;
+            }
+        }
+        for (i = 0; i < NNN; i++) {
+            if (keys[i] % 5 != 1 || i % 3 == 0 || i == 5) continue;
+            auto in = tree.insert(items[i]);
+            assert(in.second && &*in.first == &items[i]);
+            assert(in.first == tree.begin() || std::prev(in.first)->key < keys[i]);
+            assert(std::next(in.first) == tree.end() || std::next(in.first)->key > keys[i]);
+        }
+        assert(std::adjacent_find(tree.begin(), tree.end(),
+                                  [](const item &a, const item &b) { return !(a < b); }) == tree.end());
+        printf("REMOVE: n = %7d v = %d\n", (int)tree.size(), (int)std::distance(tree.begin(), tree.end()) == (int)tree.size());
+        tree.clear();
+    }
+
+    printf("\nC TREE (same keys):\n");
+    {
+        avl_tree *tree = avl_init(int_compare, NULL, 0);
+
+        gettimeofday(&start, NULL);
+        for (i = 0; i < NNN; i++) avl_insert(tree, &keys[i], NULL);
+        for (i = 0; i < NNN; i++) assert(avl_lookup(tree, &keys[i], NULL));
+        gettimeofday(&finish, NULL);
+        printf("INS+LU: n = %7d (%ld msec)\n\n", avl_size(tree), msec(&start, &finish));
+        avl_free(tree);
+    }
+
+    return 0;
+}
@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <sys/time.h>
+#include "avl.h"
+#include "avl_fat.h"
+
+#define NNN 60000
+
+int  ndata[NNN];
+long compares;
+
+
+int int_compare(void *a, void *b, void *ctx)
+{
+    compares++;
+    return *((int*)a) - *((int*)b);
+}
+
+
+int int_check(void *n, void *ctx)
+{
+    int *last = (int*)ctx;
+
+    if (*(int*)n <= *last) return AVL_ERROR;
+    *last = *(int*)n;
+    return AVL_SUCCESS;
+}
+
+
+static long
+msec(struct timeval *start, struct timeval *finish)
+{
+    return (long)(finish->tv_sec - start->tv_sec) * 1000 + (finish->tv_usec - start->tv_usec) / 1000;
+}
+
+
+/*
+ * Insert, look up and remove the same keys in a bucketed tree
+ */
+static void
+fat_test(char *name, int bucket_size, int *order)
+{
+    avl_fat *tree = avl_fat_init(int_compare, NULL, bucket_size);
+    struct timeval start, finish;
+    int i, last;
+
+    assert(tree != NULL);
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < NNN; i++) assert(avl_fat_insert(tree, &ndata[order[i]], NULL) == AVL_SUCCESS);
+    gettimeofday(&finish, NULL);
+    assert(avl_fat_insert(tree, &ndata[0], NULL) == AVL_ERROR && avl_fat_size(tree) == NNN);
+    last = -1;
+    printf("%s: INSERT n = %7d b = %5d h = %2d v = %d (%ld msec)\n", name,
+                                                           avl_fat_size(tree),
+                                                           avl_fat_buckets(tree),
+                                                           avl_fat_height(tree),
+                                                           avl_fat_walk(tree, int_check, &last) && last == NNN - 1,
+                                                           msec(&start, &finish));
+
+    compares = 0;
+    gettimeofday(&start, NULL);
+    for (i = 0; i < NNN; i++) assert(avl_fat_lookup(tree, &ndata[order[i]], NULL) == &ndata[order[i]]);
+    gettimeofday(&finish, NULL);
+    printf("%s: LOOKUP compares/lookup = %5.2f (%ld msec)\n", name, (double)compares / NNN, msec(&start, &finish));
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < NNN; i++) {
+        if (order[i] % 4) assert(avl_fat_remove(tree, &ndata[order[i]], NULL) == AVL_SUCCESS);
+    }
+    gettimeofday(&finish, NULL);
+    for (i = 0; i < NNN; i++) assert((avl_fat_lookup(tree, &ndata[i], NULL) != NULL) == (i % 4 == 0));
+    assert(avl_fat_remove(tree, &ndata[1], NULL) == AVL_ERROR);
+    last = -1;
+    printf("%s: REMOVE n = %7d b = %5d h = %2d v = %d (%ld msec)\n", name,
+                                                           avl_fat_size(tree),
+                                                           avl_fat_buckets(tree),
+                                                           avl_fat_height(tree),
+                                                           avl_fat_walk(tree, int_check, &last),
+                                                           msec(&start, &finish));
+
+    for (i = 0; i < NNN; i += 4) assert(avl_fat_remove(tree, &ndata[i], NULL) == AVL_SUCCESS);
+    assert(avl_fat_size(tree) == 0 && avl_fat_buckets(tree) == 0);
+    avl_fat_free(tree);
+}
+
+
+int main(int argc, char *argv[])
+{
+    struct timeval start, finish;
+    static int shuffled[NNN], ascending[NNN];
+    avl_tree *tree;
+    int i;
+
+    for (i = 0; i < NNN; i++) {
+        ndata[i] = i;
+        ascending[i] = i;
+        shuffled[i] = (int)(((long)i * 7919) % NNN);
+    }
+
+    printf("\nAVL-TREE (one key per node):\n");
+
+    tree = avl_init(int_compare, NULL, 0);
+    for (i = 0; i < NNN; i++) avl_insert(tree, &ndata[shuffled[i]], NULL);
+    compares = 0;
+    gettimeofday(&start, NULL);
+    for (i = 0; i < NNN; i++) assert(avl_lookup(tree, &ndata[shuffled[i]], NULL) == &ndata[shuffled[i]]);
+    gettimeofday(&finish, NULL);
+    printf("LOOKUP: n = %7d compares/lookup = %5.2f (%ld msec)\n", avl_size(tree),
+                                                                  (double)compares / NNN,
+                                                                  msec(&start, &finish));
+    avl_free(tree);
+
+    printf("\nFAT-TREE (bucketed):\n");
+
+    fat_test("B=8  RANDOM", 8, shuffled);
+    fat_test("B=32 RANDOM", 32, shuffled);
+    fat_test("B=16 ASCEND", 0, ascending);
+    assert(avl_fat_init(int_compare, NULL, AVL_FAT_MAX + 1) == NULL);
+    printf("\n");
+
+    return 0;
+}
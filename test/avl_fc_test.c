@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "avl.h"
+#include "avl_fc.h"
+
+#define NNN 60000
+#define TTT 8
+
+int ndata[NNN];
+
+avl_tree       *tree;
+avl_fc         *fc;
+pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+int int_compare(void *a, void *b, void *ctx)
+{
+    return *((int*)a) - *((int*)b);
+}
+
+
+static long
+msec(struct timeval *start, struct timeval *finish)
+{
+    return (long)(finish->tv_sec - start->tv_sec) * 1000 + (finish->tv_usec - start->tv_usec) / 1000;
+}
+
+
+/*
+ * Worker t owns the keys k with k % TTT == t: insert them, look them all up,
+ * remove every second one and check what is left
+ */
+static void *
+fc_worker(void *arg)
+{
+    long t = (long)arg;
+    int slot = avl_fc_attach(fc), k;
+
+    assert(slot >= 0);
+    for (k = t; k < NNN; k += TTT) assert(avl_fc_insert(fc, slot, &ndata[k], NULL) != NULL);
+    for (k = t; k < NNN; k += TTT) assert(avl_fc_lookup(fc, slot, &ndata[k], NULL) == &ndata[k]);
+    for (k = t; k < NNN; k += 2 * TTT) assert(avl_fc_remove(fc, slot, &ndata[k], NULL) == AVL_SUCCESS);
+    for (k = t; k < NNN; k += TTT) {
+        assert((avl_fc_lookup(fc, slot, &ndata[k], NULL) != NULL) == ((k - t) % (2 * TTT) != 0));
+    }
+    avl_fc_detach(fc, slot);
+
+    return NULL;
+}
+
+
+/*
+ * Same work under one mutex
+ */
+static void *
+lock_worker(void *arg)
+{
+    long t = (long)arg;
+    void *found;
+    int k;
+
+    for (k = t; k < NNN; k += TTT) {
+        pthread_mutex_lock(&lock);
+        assert(avl_insert(tree, &ndata[k], NULL) != NULL);
+        pthread_mutex_unlock(&lock);
+    }
+    for (k = t; k < NNN; k += TTT) {
+        pthread_mutex_lock(&lock);
+        found = avl_lookup(tree, &ndata[k], NULL);
+        pthread_mutex_unlock(&lock);
+        assert(found == &ndata[k]);
+    }
+    for (k = t; k < NNN; k += 2 * TTT) {
+        pthread_mutex_lock(&lock);
+        assert(avl_remove(tree, &ndata[k], NULL) == AVL_SUCCESS);
+        pthread_mutex_unlock(&lock);
+    }
+    for (k = t; k < NNN; k += TTT) {
+        pthread_mutex_lock(&lock);
+        found = avl_lookup(tree, &ndata[k], NULL);
+        pthread_mutex_unlock(&lock);
+        assert((found != NULL) == ((k - t) % (2 * TTT) != 0));
+    }
+
+    return NULL;
+}
+
+
+static void
+run(char *name, void *(*worker)(void *))
+{
+    struct timeval start, finish;
+    pthread_t thread[TTT];
+    long t;
+
+    tree = avl_init(int_compare, NULL, 0);
+    fc = avl_fc_init(tree, TTT);
+    assert(tree && fc);
+
+    gettimeofday(&start, NULL);
+    for (t = 0; t < TTT; t++) assert(pthread_create(&thread[t], NULL, worker, (void *)t) == 0);
+    for (t = 0; t < TTT; t++) pthread_join(thread[t], NULL);
+    gettimeofday(&finish, NULL);
+
+    printf("%s: threads = %d n = %7d v = %d (%ld msec)\n", name, TTT,
+                                                          avl_size(tree),
+                                                          avl_validate(tree, tree->root, NULL),
+                                                          msec(&start, &finish));
+    assert(avl_size(tree) == NNN / 2);
+    avl_fc_free(fc);
+    avl_free(tree);
+}
+
+
+int main(int argc, char *argv[])
+{
+    unsigned long batches, ops;
+    int i, slot;
+
+    for (i = 0; i < NNN; i++) ndata[i] = i;
+
+    printf("\nFC-TREE (%d threads, %d keys):\n", TTT, NNN);
+
+    run("MUTEX ", lock_worker);
+    run("FC    ", fc_worker);
+
+    /* slots run out and come back */
+    tree = avl_init(int_compare, NULL, 0);
+    fc = avl_fc_init(tree, 2);
+    assert(avl_fc_attach(fc) == 0 && (slot = avl_fc_attach(fc)) == 1 && avl_fc_attach(fc) == -1);
+    avl_fc_detach(fc, slot);
+    assert(avl_fc_attach(fc) == 1);
+    for (i = 0; i < 100; i++) avl_fc_insert(fc, 1, &ndata[i], NULL);
+    batches = avl_fc_batches(fc, &ops);
+    printf("SINGLE: batches = %lu ops = %lu\n\n", batches, ops);
+    assert(ops == 100 && avl_size(tree) == 100);
+    avl_fc_free(fc);
+    avl_free(tree);
+
+    return 0;
+}
@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include "avl.h"
+#include "avl_page.h"
+
+#define NNN 100000
+#define CACHE 64
+
+
+typedef struct val_t {
+    int v[3];
+} val;
+
+int order[NNN];
+
+
+int key_compare(void *a, void *b, void *ctx)
+{
+    int x = *(int*)a, y = *(int*)b;
+
+    return (x > y) - (x < y);
+}
+
+
+/*
+ * Walker: keys come in order, values match keys; ctx counts records
+ */
+int page_check(void *n, void *ctx)
+{
+    int key = *(int*)n;
+    val *v = (val*)((char*)n + sizeof(int));
+
+    assert(key % 2 == 1);
+    assert(v->v[0] == key && v->v[2] == -key);
+    (*(int*)ctx)++;
+
+    return AVL_SUCCESS;
+}
+
+
+static long
+msec(struct timeval *start)
+{
+    struct timeval end;
+
+    gettimeofday(&end, NULL);
+    return (end.tv_sec - start->tv_sec) * 1000 + (end.tv_usec - start->tv_usec) / 1000;
+}
+
+
+/*
+ * Look up every key in random order through a fresh cache, with the file
+ * dropped from the kernel page cache first, and report the page faults
+ * per lookup, and the page reads (faults and prefetches)
+ */
+static double
+lookup_bench(char *path, char *name, int options)
+{
+    avl_page *tree = avl_page_open(path, sizeof(int), sizeof(val), key_compare, CACHE, options);
+    avl_page_stats stats;
+    struct timeval start;
+    unsigned long reads;
+    val v;
+    int fd, i;
+
+    assert(tree != NULL);
+    fd = open(path, O_RDONLY);
+    assert(fd >= 0);
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+    gettimeofday(&start, NULL);
+    for (i = 0; i < NNN; i++) {
+        assert(avl_page_lookup(tree, &order[i], &v) == (order[i] % 2 ? AVL_SUCCESS : AVL_ERROR));
+    }
+    avl_page_counters(tree, &stats);
+    reads = stats.faults + stats.prefetches;
+    printf("%s: %ld ms, %.2f faults / lookup, %.2f reads / lookup, hit ratio %.3f\n", name,
+           msec(&start), (double)stats.faults / NNN, (double)reads / NNN,
+           (double)stats.hits / (stats.hits + reads));
+    assert(avl_page_close(tree) == AVL_SUCCESS);
+
+    return (double)stats.faults / NNN;
+}
+
+
+int main(int argc, char *argv[])
+{
+    char path[] = "/tmp/avl_page_XXXXXX";
+    avl_page *tree;
+    avl_page_stats stats;
+    val v;
+    int fd, i, j, t, count;
+
+    fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+
+    for (i = 0; i < NNN; i++) order[i] = i;
+    for (i = NNN - 1, srand(43); i > 0; i--) {
+        j = rand() % (i + 1);
+        t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+
+    printf("\nPAGE (%d keys, %d page cache):\n", NNN, CACHE);
+
+    /* sizes must fit a page, and the cache must hold a few pages */
+    assert(avl_page_open(path, sizeof(int), AVL_PAGE_SIZE, NULL, CACHE, 0) == NULL);
+    assert(avl_page_open(path, sizeof(int), sizeof(val), NULL, 3, 0) == NULL);
+
+    tree = avl_page_open(path, sizeof(int), sizeof(val), key_compare, CACHE, AVL_PAGE_TRUNCATE);
+    assert(tree != NULL);
+    for (i = 0; i < NNN; i++) {
+        v.v[0] = order[i];
+        v.v[1] = 0;
+        v.v[2] = -order[i];
+        assert(avl_page_insert(tree, &order[i], &v) == AVL_SUCCESS);
+    }
+    assert(avl_page_insert(tree, &order[0], &v) == AVL_ERROR);
+    assert(avl_page_size(tree) == NNN);
+    assert(avl_page_validate(tree) == AVL_SUCCESS);
+
+    for (i = 0; i < NNN; i++) {
+        assert(avl_page_lookup(tree, &order[i], &v) == AVL_SUCCESS);
+        assert(v.v[0] == order[i] && v.v[2] == -order[i]);
+    }
+
+    /* remove the even keys; freed slots are reused by the next inserts */
+    for (i = 0; i < NNN; i++) {
+        if (order[i] % 2 == 0) assert(avl_page_remove(tree, &order[i]) == AVL_SUCCESS);
+    }
+    assert(avl_page_remove(tree, &order[0]) == (order[0] % 2 ? AVL_SUCCESS : AVL_ERROR));
+    if (order[0] % 2) {
+        v.v[0] = order[0];
+        v.v[2] = -order[0];
+        assert(avl_page_insert(tree, &order[0], &v) == AVL_SUCCESS);
+    }
+    assert(avl_page_size(tree) == NNN / 2);
+    assert(avl_page_validate(tree) == AVL_SUCCESS);
+    avl_page_counters(tree, &stats);
+    printf("BUILD : %lu pages, %lu faults, %lu writes\n", stats.pages, stats.faults, stats.writes);
+    assert(avl_page_close(tree) == AVL_SUCCESS);
+
+    /* the tree persists; sizes must match the file */
+    assert(avl_page_open(path, sizeof(int), sizeof(int), key_compare, CACHE, 0) == NULL);
+    tree = avl_page_open(path, sizeof(int), sizeof(val), key_compare, CACHE, 0);
+    assert(tree != NULL);
+    assert(avl_page_size(tree) == NNN / 2);
+    assert(avl_page_validate(tree) == AVL_SUCCESS);
+    count = 0;
+    assert(avl_page_walk(tree, page_check, &count) == AVL_SUCCESS);
+    assert(count == NNN / 2);
+    assert(avl_page_close(tree) == AVL_SUCCESS);
+
+    lookup_bench(path, "LOOKUP  ", 0);
+    lookup_bench(path, "PREFETCH", AVL_PAGE_PREFETCH);
+
+    /* rotations scattered the subtrees over pages; repacking regroups them */
+    tree = avl_page_open(path, sizeof(int), sizeof(val), key_compare, CACHE, 0);
+    assert(avl_page_repack(tree) == AVL_SUCCESS);
+    assert(avl_page_size(tree) == NNN / 2);
+    assert(avl_page_validate(tree) == AVL_SUCCESS);
+    count = 0;
+    assert(avl_page_walk(tree, page_check, &count) == AVL_SUCCESS);
+    assert(count == NNN / 2);
+    avl_page_counters(tree, &stats);
+    printf("REPACK: %lu pages\n", stats.pages);
+    assert(stats.pages <= NNN / 2 / 100 + 2);
+    assert(avl_page_close(tree) == AVL_SUCCESS);
+    assert(lookup_bench(path, "REPACKED", 0) < 2.0);
+    assert(lookup_bench(path, "REPACKED+PREFETCH", AVL_PAGE_PREFETCH) < 0.01);
+
+    /* an emptied tree is still valid */
+    tree = avl_page_open(path, sizeof(int), sizeof(val), key_compare, CACHE, 0);
+    for (i = 1; i < NNN; i += 2) assert(avl_page_remove(tree, &i) == AVL_SUCCESS);
+    assert(avl_page_size(tree) == 0);
+    assert(avl_page_validate(tree) == AVL_SUCCESS);
+    assert(avl_page_lookup(tree, &order[0], NULL) == AVL_ERROR);
+    assert(avl_page_close(tree) == AVL_SUCCESS);
+    printf("\n");
+
+    unlink(path);
+
+    return 0;
+}
@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "avl.h"
+#include "avl_perf.h"
+
+#define NNN 200000
+
+
+typedef struct rec_t {
+    int  key;
+    int  value[7];
+} rec;
+
+rec *nrec[NNN];
+int  order[NNN];
+
+
+int rec_compare(void *a, void *b, void *ctx)
+{
+    return ((rec*)a)->key - ((rec*)b)->key;
+}
+
+
+int rec_sum(void *n, void *ctx)
+{
+    *(long*)ctx += ((rec*)n)->value[0];
+    return AVL_SUCCESS;
+}
+
+
+/*
+ * Insert, look up, walk and remove NNN records in random order, one region
+ * per operation kind
+ */
+static void
+bench(avl_perf *perf, char *name, avl_tree *tree)
+{
+    rec item;
+    long sum = 0;
+    int i;
+
+    avl_perf_begin(perf, AVL_PERF_INSERT);
+    for (i = 0; i < NNN; i++) avl_insert(tree, nrec[order[i]], NULL);
+    avl_perf_end(perf, AVL_PERF_INSERT, NNN);
+
+    avl_perf_begin(perf, AVL_PERF_LOOKUP);
+    for (i = 0; i < NNN; i++) {
+        item.key = order[NNN - 1 - i];
+        assert(avl_lookup(tree, &item, NULL) != NULL);
+    }
+    avl_perf_end(perf, AVL_PERF_LOOKUP, NNN);
+
+    avl_perf_begin(perf, AVL_PERF_WALK);
+    avl_walk(tree, rec_sum, &sum, AVL_WALK_INORDER);
+    avl_perf_end(perf, AVL_PERF_WALK, NNN);
+    assert(sum == (long)NNN * (NNN - 1) / 2);
+
+    avl_perf_begin(perf, AVL_PERF_REMOVE);
+    for (i = 0; i < NNN; i++) {
+        item.key = order[i];
+        assert(avl_remove(tree, &item, NULL) == AVL_SUCCESS);
+    }
+    avl_perf_end(perf, AVL_PERF_REMOVE, NNN);
+    assert(avl_size(tree) == 0);
+
+    assert(avl_perf_average(perf, AVL_PERF_LOOKUP, AVL_PERF_NSEC) > 0);
+    avl_perf_report(perf, stdout, name);
+    assert(avl_perf_average(perf, AVL_PERF_LOOKUP, AVL_PERF_NSEC) == -1);
+    avl_free(tree);
+}
+
+
+int main(int argc, char *argv[])
+{
+    avl_perf *perf = avl_perf_init();
+    int i, j, t;
+
+    assert(perf != NULL);
+    for (i = 0; i < NNN; i++) order[i] = i;
+    for (i = NNN - 1, srand(31); i > 0; i--) {
+        j = rand() % (i + 1);
+        t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+    /* allocated in random key order, so neighbours in the tree are far apart */
+    for (i = 0; i < NNN; i++) {
+        nrec[order[i]] = (rec*)calloc(1, sizeof(rec));
+        nrec[order[i]]->key = order[i];
+        nrec[order[i]]->value[0] = order[i];
+    }
+
+    printf("\nPERF (per operation%s):\n", avl_perf_available(perf, AVL_PERF_INSTRUCTIONS) ? ""
+                                              : ", no hardware counters here");
+
+    bench(perf, "PTR   ", avl_init(rec_compare, NULL, 0));
+    bench(perf, "INLINE", avl_init_inline(rec_compare, NULL, 0, sizeof(rec)));
+    bench(perf, "WAVL  ", avl_init(rec_compare, NULL, AVL_TREE_WAVL));
+    printf("\n");
+
+    for (i = 0; i < NNN; i++) free(nrec[i]);
+    avl_perf_free(perf);
+
+    return 0;
+}
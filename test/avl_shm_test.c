@@ -0,0 +1,262 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include "avl_shm.h"
+
+#define NNN 60000
+#define SSS (16 << 20)
+#define DIE (-1)
+
+typedef struct item {
+    int key;
+    int val;
+} item;
+
+
+int item_compare(void *a, void *b, void *ctx)
+{
+    return ((item*)a)->key - ((item*)b)->key;
+}
+
+
+/*
+ * Kills the process when asked to place the DIE item: the writer dies with
+ * the lock held, the item in a node and the sequence number odd
+ */
+int item_die(void *a, void *b, void *ctx)
+{
+    if (((item*)b)->key == DIE) raise(SIGKILL);
+    return item_compare(a, b, ctx);
+}
+
+
+int item_check(void *n, void *ctx)
+{
+    int *last = (int*)ctx;
+
+    if (((item*)n)->key <= *last || ((item*)n)->val != ((item*)n)->key * 2) return AVL_ERROR;
+    *last = ((item*)n)->key;
+    return AVL_SUCCESS;
+}
+
+
+static long
+msec(struct timeval *start, struct timeval *finish)
+{
+    return (long)(finish->tv_sec - start->tv_sec) * 1000 + (finish->tv_usec - start->tv_usec) / 1000;
+}
+
+
+/*
+ * Reader process: map the region at its own address and look up the stable
+ * (even) keys while the parent churns the odd ones
+ */
+static int
+reader(int fd)
+{
+    void *region = mmap(NULL, SSS, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    avl_shm *shm = avl_shm_attach(region, item_compare);
+    item key, out;
+    int i, round;
+
+    if (shm == NULL) return 1;
+    for (round = 0; round < 20; round++) {
+        for (i = 0; i < NNN; i += 2) {
+            key.key = i;
+            if (avl_shm_lookup(shm, &key, &out, NULL) != AVL_SUCCESS || out.val != i * 2) return 2;
+        }
+    }
+    avl_shm_detach(shm);
+    munmap(region, SSS);
+    return 0;
+}
+
+
+/*
+ * Writer processes that die holding the lock: once at a known point of an
+ * insert, then at random points of a stream of inserts and removes.  The
+ * next process to take the lock repairs the tree.
+ */
+static void
+robust_test(void *region)
+{
+    avl_shm *shm = avl_shm_create(region, SSS, sizeof(item), item_compare), *child;
+    struct timespec pause = { 0, 20 * 1000 * 1000 };
+    item it, out;
+    int i, round, status, last;
+    pid_t pid;
+
+    assert(shm != NULL && avl_shm_size(shm) == 0);
+    for (i = 0; i < NNN; i += 2) {
+        it.key = i;
+        it.val = i * 2;
+        assert(avl_shm_insert(shm, &it, NULL) == AVL_SUCCESS);
+    }
+
+    pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        child = avl_shm_attach(region, item_die);
+        it.key = 1;
+        it.val = 2;
+        avl_shm_insert(child, &it, NULL);
+        it.key = DIE;
+        avl_shm_insert(child, &it, NULL);
+        _exit(0);
+    }
+    assert(waitpid(pid, &status, 0) == pid && WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL);
+
+    /* a reader gets through (and repairs), the half-done insert is gone */
+    it.key = 1;
+    assert(avl_shm_lookup(shm, &it, &out, NULL) == AVL_SUCCESS && out.val == 2);
+    it.key = DIE;
+    assert(avl_shm_lookup(shm, &it, NULL, NULL) == AVL_ERROR);
+    assert(avl_shm_validate(shm, NULL) == AVL_SUCCESS && avl_shm_size(shm) == NNN / 2 + 1);
+
+    for (round = 0; round < 5; round++) {
+        pid = fork();
+        assert(pid >= 0);
+        if (pid == 0) {
+            for (i = 1; ; i = (i + 2) % NNN) {
+                it.key = i;
+                it.val = i * 2;
+                avl_shm_remove(shm, &it, NULL);
+                if (avl_shm_insert(shm, &it, NULL) != AVL_SUCCESS) _exit(1);
+            }
+        }
+        nanosleep(&pause, NULL);
+        kill(pid, SIGKILL);
+        assert(waitpid(pid, &status, 0) == pid && WIFSIGNALED(status));
+
+        assert(avl_shm_validate(shm, NULL) == AVL_SUCCESS);
+        for (i = 0; i < NNN; i += 2) {
+            it.key = i;
+            assert(avl_shm_lookup(shm, &it, &out, NULL) == AVL_SUCCESS && out.val == i * 2);
+        }
+        last = -1;
+        assert(avl_shm_walk(shm, item_check, &last) == AVL_SUCCESS);
+    }
+    it.key = NNN + 1;
+    it.val = it.key * 2;
+    assert(avl_shm_insert(shm, &it, NULL) == AVL_SUCCESS && avl_shm_validate(shm, NULL) == AVL_SUCCESS);
+    printf("ROBUST: n = %7d v = %d\n\n", avl_shm_size(shm), avl_shm_validate(shm, NULL));
+
+    avl_shm_detach(shm);
+}
+
+
+int main(int argc, char *argv[])
+{
+    char path[] = "/tmp/avl_shm_XXXXXX";
+    struct timeval start, finish;
+    void *a, *b;
+    avl_shm *wr, *rd;
+    item it, out;
+    int fd, i, last, status;
+    pid_t pid;
+
+    fd = mkstemp(path);
+    assert(fd >= 0 && ftruncate(fd, SSS) == 0);
+    unlink(path);
+
+    /*
+     * Two mappings of the same region at different addresses in one process
+     */
+    a = mmap(NULL, SSS, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    b = mmap(NULL, SSS, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    assert(a != MAP_FAILED && b != MAP_FAILED && a != b);
+
+    printf("\nSHM-TREE:\n");
+
+    wr = avl_shm_create(a, SSS, sizeof(item), item_compare);
+    assert(wr != NULL);
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < NNN; i++) {
+        it.key = (i * 7919) % NNN;
+        it.val = it.key * 2;
+        assert(avl_shm_insert(wr, &it, NULL) == AVL_SUCCESS);
+    }
+    gettimeofday(&finish, NULL);
+    printf("INSERT: n = %7d v = %d (%ld msec)\n", avl_shm_size(wr), avl_shm_validate(wr, NULL),
+                                                  msec(&start, &finish));
+    assert(avl_shm_validate(wr, NULL) == AVL_SUCCESS);
+
+    rd = avl_shm_attach(b, item_compare);
+    assert(rd != NULL && avl_shm_size(rd) == NNN);
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < NNN; i++) {
+        it.key = i;
+        assert(avl_shm_lookup(rd, &it, &out, NULL) == AVL_SUCCESS && out.val == i * 2);
+    }
+    gettimeofday(&finish, NULL);
+    last = -1;
+    printf("LOOKUP: n = %7d v = %d (%ld msec, second mapping)\n", NNN,
+                                                                 avl_shm_walk(rd, item_check, &last) && last == NNN - 1,
+                                                                 msec(&start, &finish));
+
+    /*
+     * One writer (this process) and one reader process sharing the tree
+     */
+    pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) _exit(reader(fd));
+
+    gettimeofday(&start, NULL);
+    for (i = 1; i < NNN; i += 2) {
+        it.key = i;
+        assert(avl_shm_remove(wr, &it, NULL) == AVL_SUCCESS);
+    }
+    for (i = 1; i < NNN; i += 2) {
+        it.key = i;
+        it.val = i * 2;
+        assert(avl_shm_insert(wr, &it, NULL) == AVL_SUCCESS);
+    }
+    for (i = 1; i < NNN; i += 2) {
+        it.key = i;
+        assert(avl_shm_remove(wr, &it, NULL) == AVL_SUCCESS);
+    }
+    gettimeofday(&finish, NULL);
+    assert(waitpid(pid, &status, 0) == pid);
+
+    it.key = 1;
+    assert(avl_shm_lookup(rd, &it, NULL, NULL) == AVL_ERROR && avl_shm_remove(rd, &it, NULL) == AVL_ERROR);
+    last = -1;
+    printf("REMOVE: n = %7d v = %d reader = %d (%ld msec)\n", avl_shm_size(rd),
+                                                             avl_shm_walk(wr, item_check, &last),
+                                                             WIFEXITED(status) ? WEXITSTATUS(status) : -1,
+                                                             msec(&start, &finish));
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    assert(avl_shm_validate(rd, NULL) == AVL_SUCCESS);
+
+    /* the region is full once every node slot is used */
+    for (i = NNN; avl_shm_insert(wr, &it, NULL) == AVL_SUCCESS; i++) it.key = i;
+    printf("FILLED: n = %7d\n", avl_shm_size(wr));
+    assert(avl_shm_validate(wr, NULL) == AVL_SUCCESS);
+
+    /* emptying the tree rebalances through every removal case */
+    for (i = 0; i < NNN; i++) {
+        it.key = (i * 7919) % NNN;
+        avl_shm_remove(wr, &it, NULL);
+        if (i % 1000 == 0) assert(avl_shm_validate(wr, NULL) == AVL_SUCCESS);
+    }
+    assert(avl_shm_validate(wr, NULL) == AVL_SUCCESS);
+
+    robust_test(a);
+
+    avl_shm_detach(rd);
+    avl_shm_detach(wr);
+    munmap(a, SSS);
+    munmap(b, SSS);
+    close(fd);
+
+    return 0;
+}
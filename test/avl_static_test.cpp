@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <assert.h>
+#include <stdexcept>
+#include "avl.hpp"
+#include "avl_static.hpp"
+
+#define LLL 4000000
+
+
+/*
+ * Protocol status codes, fixed at build time
+ */
+constexpr avl::entry<int, const char *> status[] = {
+    {100, "Continue"}, {101, "Switching Protocols"}, {200, "OK"}, {201, "Created"},
+    {202, "Accepted"}, {204, "No Content"}, {206, "Partial Content"}, {301, "Moved Permanently"},
+    {302, "Found"}, {303, "See Other"}, {304, "Not Modified"}, {307, "Temporary Redirect"},
+    {308, "Permanent Redirect"}, {400, "Bad Request"}, {401, "Unauthorized"}, {403, "Forbidden"},
+    {404, "Not Found"}, {405, "Method Not Allowed"}, {406, "Not Acceptable"}, {408, "Request Timeout"},
+    {409, "Conflict"}, {410, "Gone"}, {411, "Length Required"}, {412, "Precondition Failed"},
+    {413, "Content Too Large"}, {414, "URI Too Long"}, {415, "Unsupported Media Type"},
+    {416, "Range Not Satisfiable"}, {417, "Expectation Failed"}, {421, "Misdirected Request"},
+    {422, "Unprocessable Content"}, {426, "Upgrade Required"}, {428, "Precondition Required"},
+    {429, "Too Many Requests"}, {431, "Request Header Fields Too Large"},
+    {451, "Unavailable For Legal Reasons"}, {500, "Internal Server Error"}, {501, "Not Implemented"},
+    {502, "Bad Gateway"}, {503, "Service Unavailable"}, {504, "Gateway Timeout"},
+    {505, "HTTP Version Not Supported"}
+};
+
+constexpr auto codes = avl::make_static_map(status);
+
+static_assert(codes.size() == 42, "size");
+static_assert(codes.find(404)[0][4] == 'F', "found at compile time");
+static_assert(codes.find(200)[0][0] == 'O', "found at compile time");
+static_assert(!codes.find(418) && !codes.find(99) && !codes.find(600), "missing at compile time");
+static_assert(codes.slot(2).key < codes.slot(1).key && codes.slot(1).key < codes.slot(3).key, "search tree order");
+
+
+/*
+ * Config names, ordered by a constexpr strcmp
+ */
+constexpr int
+str_cmp(const char *a, const char *b)
+{
+    return *a != *b || *a == 0 ? (unsigned char)*a - (unsigned char)*b : str_cmp(a + 1, b + 1);
+}
+
+struct str_less {
+    constexpr bool operator()(const char *a, const char *b) const { return str_cmp(a, b) < 0; }
+};
+
+enum level { DEBUG, INFO, WARN, ERROR };
+
+constexpr avl::entry<const char *, level> level_names[] = {
+    {"debug", DEBUG}, {"error", ERROR}, {"info", INFO}, {"warn", WARN}, {"warning", WARN}
+};
+
+constexpr avl::static_map<const char *, level, 5, str_less> levels(level_names);
+
+static_assert(*levels.find("warning") == WARN && *levels.find("debug") == DEBUG, "string keys");
+static_assert(!levels.find("warn ") && !levels.find(""), "string keys");
+
+
+/*
+ * A 1023 entry table (every level full) and a 1000 entry one (last level
+ * partial): key 3i+1 maps to i
+ */
+#define E1(i)   {3 * (i) + 1, (i)}
+#define E4(i)   E1(i), E1((i) + 1), E1((i) + 2), E1((i) + 3)
+#define E16(i)  E4(i), E4((i) + 4), E4((i) + 8), E4((i) + 12)
+#define E64(i)  E16(i), E16((i) + 16), E16((i) + 32), E16((i) + 48)
+#define E256(i) E64(i), E64((i) + 64), E64((i) + 128), E64((i) + 192)
+
+constexpr avl::entry<int, int> full[] = {
+    E256(0), E256(256), E256(512), E64(768), E64(832), E64(896), E16(960), E16(976), E16(992),
+    E4(1008), E4(1012), E4(1016), E1(1020), E1(1021), E1(1022)
+};
+
+constexpr avl::entry<int, int> partial[] = {
+    E256(0), E256(256), E256(512), E64(768), E64(832), E64(896), E16(960), E16(976), E4(992), E4(996)
+};
+
+constexpr auto table = avl::make_static_map(full);
+constexpr auto ptable = avl::make_static_map(partial);
+
+static_assert(table.size() == 1023 && ptable.size() == 1000, "size");
+static_assert(*table.find(1) == 0 && *table.find(3067) == 1022 && !table.find(3070), "full");
+static_assert(*ptable.find(2998) == 999 && !ptable.find(2999) && !ptable.find(0), "partial");
+
+
+int int_compare(void *a, void *b, void *ctx)
+{
+    return *((int*)a) - *((int*)b);
+}
+
+
+static long
+msec(struct timeval *start, struct timeval *finish)
+{
+    return (long)(finish->tv_sec - start->tv_sec) * 1000 + (finish->tv_usec - start->tv_usec) / 1000;
+}
+
+
+/*
+ * Every key and every gap of a table agrees between find(), lookup() and the
+ * initializer
+ */
+template <class Map, std::size_t N>
+static int
+check(const Map &map, const avl::entry<int, int> (&sorted)[N])
+{
+    std::size_t i;
+    int k;
+
+    for (i = 0, k = sorted[0].key - 2; i < N; k++) {
+        if (k == sorted[i].key) {
+            if (*map.find(k) != sorted[i].value || map.lookup(k) != map.find(k)) return 0;
+            i++;
+        } else if (map.find(k) || map.lookup(k)) {
+            return 0;
+        }
+    }
+    return map.find(k) == 0 && map.lookup(k) == 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    struct timeval start, finish;
+    long sum;
+    int i, k;
+
+    printf("\nSTATIC MAP:\n");
+
+    printf("CHECK : n = %4d v = %d\n", (int)table.size(), check(table, full));
+    printf("CHECK : n = %4d v = %d\n", (int)ptable.size(), check(ptable, partial));
+    assert(check(table, full) && check(ptable, partial));
+    assert(codes.lookup(503) == codes.find(503) && !codes.lookup(0) && !codes.lookup(1000));
+    assert(*levels.lookup("info") == INFO && !levels.lookup("verbose"));
+
+    /* unsorted input is caught at run time too */
+    {
+        avl::entry<int, int> unsorted[] = {{1, 1}, {3, 3}, {2, 2}};
+        bool thrown = false;
+
+        try {
+            avl::make_static_map(unsorted);
+        } catch (const std::logic_error &) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+
+    printf("\nLOOKUPS (%d, 1000 keys):\n", LLL);
+    {
+        avl::tree<int, int> tree;
+        avl_tree *ctree = avl_init(int_compare, NULL, 0);
+
+        for (i = 0; i < 1000; i++) {
+            tree.emplace(partial[i].key, partial[i].value);
+            avl_insert(ctree, (void *)&partial[i].key, NULL);
+        }
+
+        gettimeofday(&start, NULL);
+        for (i = 0, sum = 0; i < LLL; i++) sum += *ptable.lookup(3 * ((i % 1000) * 7919 % 1000) + 1);
+        gettimeofday(&finish, NULL);
+        printf("STATIC: sum = %ld (%ld msec)\n", sum, msec(&start, &finish));
+
+        gettimeofday(&start, NULL);
+        for (i = 0, sum = 0; i < LLL; i++) sum += tree.find(3 * ((i % 1000) * 7919 % 1000) + 1)->second;
+        gettimeofday(&finish, NULL);
+        printf("C++   : sum = %ld (%ld msec)\n", sum, msec(&start, &finish));
+
+        gettimeofday(&start, NULL);
+        for (i = 0, sum = 0; i < LLL; i++) {
+            k = 3 * ((i % 1000) * 7919 % 1000) + 1;
+            sum += ((avl::entry<int, int> *)avl_lookup(ctree, &k, NULL))->value;
+        }
+        gettimeofday(&finish, NULL);
+        printf("C     : sum = %ld (%ld msec)\n\n", sum, msec(&start, &finish));
+
+        avl_free(ctree);
+    }
+
+    return 0;
+}
@@ -4,6 +4,7 @@
 #include <string.h>
 #include <time.h>
 #include <assert.h>
+#include <unistd.h>
 #include "avl.h"
 #include "../src/avl_private.h"
 
@@ -71,6 +72,1204 @@ int multi_print_1(void *n, void *c)
 }
 
 
+/*
+ * Remove data from tree, tracking the total and the worst per-call rotation
+ * count
+ */
+void
+rotation_remove(avl_tree *tree, void *data, unsigned long *total, unsigned long *worst)
+{
+    unsigned long before = tree->rotations;
+
+    avl_remove(tree, data, NULL);
+    *total += tree->rotations - before;
+    if (tree->rotations - before > *worst) *worst = tree->rotations - before;
+}
+
+
+/*
+ * Delete-heavy churn on a tree built with the given options, used to compare
+ * rotation counts between classic and rank-balanced trees
+ */
+void
+rotation_bench(char *name, int options)
+{
+    avl_tree *tree;
+    struct timeval start, finish;
+    int i, x, t, rounds;
+    unsigned long total = 0, worst = 0;
+
+    for (i = 0; i < NNN; i++) ndata[i] = i;
+    for (i = NNN - 1, srand(1); i > 0; i--) {
+        x = rand() % (i + 1);
+        t = ndata[i]; ndata[i] = ndata[x]; ndata[x] = t;
+    }
+
+    tree = avl_init(int_compare, NULL, options);
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < NNN; i++) avl_insert(tree, &ndata[i], NULL);
+    for (rounds = 0; rounds < 4; rounds++) {
+        for (i = 0; i < NNN; i += 2) rotation_remove(tree, &ndata[i], &total, &worst);
+        assert(avl_validate(tree, tree->root, NULL));
+        for (i = 0; i < NNN; i += 2) avl_insert(tree, &ndata[i], NULL);
+    }
+    for (i = 0; i < NNN; i++) rotation_remove(tree, &ndata[i], &total, &worst);
+    gettimeofday(&finish, NULL);
+
+    printf("%s: n = %7d r = %6lu (max %lu per remove) v = %d (%ld msec)\n", name,
+                                                                avl_size(tree),
+                                                                total,
+                                                                worst,
+                                                                avl_validate(tree, tree->root, NULL),
+                                                                (long)(finish.tv_sec  - start.tv_sec ) * 1000 +
+                                                                (long)(finish.tv_usec - start.tv_usec) / 1000);
+    avl_free(tree);
+}
+
+
+typedef struct ival {
+    int  lo, hi;
+    int  max;
+    long sum;
+} ival;
+
+ival ivals[NNN];
+
+
+int ival_compare(void *a, void *b, void *ctx)
+{
+    if (((ival*)a)->lo != ((ival*)b)->lo) return ((ival*)a)->lo - ((ival*)b)->lo;
+    return ((ival*)a)->hi - ((ival*)b)->hi;
+}
+
+
+/* subtree max end (for stabbing) and sum of lengths (for range sums) */
+void ival_augment(void *n, void *l, void *r, void *ctx)
+{
+    ival *v = (ival*)n;
+
+    v->max = v->hi;
+    v->sum = v->hi - v->lo;
+    if (l) { v->max = ((ival*)l)->max > v->max ? ((ival*)l)->max : v->max; v->sum += ((ival*)l)->sum; }
+    if (r) { v->max = ((ival*)r)->max > v->max ? ((ival*)r)->max : v->max; v->sum += ((ival*)r)->sum; }
+}
+
+
+typedef struct ival_query {
+    ival point;
+    long sum;
+    int  hits;
+} ival_query;
+
+
+int ival_span(void *n, int subtree, void *ctx)
+{
+    ((ival_query*)ctx)->sum += subtree ? ((ival*)n)->sum : ((ival*)n)->hi - ((ival*)n)->lo;
+    return 1;
+}
+
+
+int ival_reach(void *n, void *ctx)
+{
+    return ((ival*)n)->max >= ((ival_query*)ctx)->point.lo;
+}
+
+
+int ival_stabbed(void *n, void *ctx)
+{
+    if (((ival*)n)->hi >= ((ival_query*)ctx)->point.lo) ((ival_query*)ctx)->hits++;
+    return 1;
+}
+
+
+/*
+ * Check interval stabbing and range sums against brute force while the tree
+ * changes under them
+ */
+void
+augment_test(char *name, int options)
+{
+    avl_tree *tree = avl_init(ival_compare, NULL, options);
+    ival_query q, lo, hi;
+    long sum;
+    int i, j, hits, live = NNN;
+
+    for (i = 0, srand(3); i < NNN; i++) {
+        ivals[i].lo = rand() % (NNN * 4);
+        ivals[i].hi = ivals[i].lo + rand() % 1000;
+        avl_insert(tree, &ivals[i], NULL);
+    }
+    assert(avl_set_augment(tree, ival_augment, NULL) == AVL_SUCCESS);
+    for (i = 0; i < NNN; i += 3, live--) avl_remove(tree, &ivals[i], NULL);
+
+    for (j = 0; j < 200; j++) {
+        memset(&q, 0, sizeof(q));
+        q.point.lo = rand() % (NNN * 4); q.point.hi = 1 << 30;
+        lo.point.lo = rand() % (NNN * 4); lo.point.hi = 0;
+        hi.point.lo = lo.point.lo + rand() % 4000; hi.point.hi = 1 << 30;
+        avl_stab(tree, &q.point, ival_reach, ival_stabbed, &q);
+        avl_aggregate(tree, &lo.point, &hi.point, ival_span, &q);
+        for (i = 0, hits = 0, sum = 0; i < NNN; i++) {
+            if ((i % 3 == 0) != (i < j * 3 && i % 12 == 0) || (i < j * 3 && i % 12 == 1)) continue;
+            if (ivals[i].lo <= q.point.lo && ivals[i].hi >= q.point.lo) hits++;
+            if (ivals[i].lo >= lo.point.lo && ivals[i].lo <= hi.point.lo) sum += ivals[i].hi - ivals[i].lo;
+        }
+        assert(hits == q.hits && sum == q.sum);
+        if (j % 4 == 0) {
+            /* the records themselves never change, so equal keys are interchangeable */
+            avl_insert(tree, &ivals[j * 3], NULL);
+            avl_remove(tree, &ivals[j * 3 + 1], NULL);
+        }
+    }
+    assert(avl_size(tree) == live);
+    memset(&q, 0, sizeof(q));
+    avl_aggregate(tree, NULL, NULL, ival_span, &q);
+    printf("%s: n = %7d h = %2d v = %d max = %d sum = %ld\n", name, avl_size(tree), avl_height(tree),
+                                                                avl_validate(tree, tree->root, NULL),
+                                                                ((ival*)AVL_DATA(tree->root, tree))->max, q.sum);
+    avl_free(tree);
+}
+
+
+char  sdata[NNN][16];
+long  scompares;
+
+
+int str_compare(void *a, void *b, void *ctx)
+{
+    scompares++;
+    return strcmp((char*)a, (char*)b);
+}
+
+
+uint64_t str_prefix(void *data)
+{
+    return avl_prefix_bytes(data, strlen((char*)data));
+}
+
+
+/*
+ * String keyed tree with and without cached key prefixes
+ */
+void
+prefix_bench(char *name, int cached)
+{
+    avl_tree *tree = avl_init(str_compare, NULL, 0);
+    struct timeval start, finish;
+    char key[16];
+    int i, j;
+
+    if (cached) assert(avl_set_prefix(tree, str_prefix) == AVL_SUCCESS);
+    for (i = 0, srand(5); i < NNN; i++) {
+        for (j = 0; j < 15; j++) sdata[i][j] = 'a' + rand() % (j < 4 ? 2 : 26);
+        sdata[i][15] = 0;
+        avl_insert(tree, sdata[i], NULL);
+    }
+
+    scompares = 0;
+    gettimeofday(&start, NULL);
+    for (j = 0; j < 4; j++) {
+        for (i = 0; i < NNN; i++) {
+            strcpy(key, sdata[i]);
+            assert(avl_lookup(tree, key, NULL) != NULL);
+        }
+    }
+    gettimeofday(&finish, NULL);
+    for (i = 0; i < NNN; i += 2) avl_remove(tree, sdata[i], NULL);
+    for (i = 0; i < NNN; i++) assert((avl_lookup(tree, sdata[i], NULL) != NULL) == (i & 1));
+
+    printf("%s: n = %7d h = %2d v = %d compares/lookup = %5.2f (%ld msec)\n", name,
+                                                                avl_size(tree),
+                                                                avl_height(tree),
+                                                                avl_validate(tree, tree->root, NULL),
+                                                                (double)scompares / (4 * NNN),
+                                                                (long)(finish.tv_sec  - start.tv_sec ) * 1000 +
+                                                                (long)(finish.tv_usec - start.tv_usec) / 1000);
+    avl_free(tree);
+}
+
+
+int int_count(void *n, void *ctx)
+{
+    (*(int*)ctx)++;
+    return 1;
+}
+
+
+#define CAP 1000
+
+char  bpresent[NNN];
+char  bgone[NNN];
+int   nevicted;
+
+
+void int_evict(void *n, void *ctx)
+{
+    assert(!bgone[*(int*)n]);
+    bgone[*(int*)n] = 1;
+    nevicted++;
+}
+
+
+/*
+ * Capacity bounded tree: keep the CAP largest / smallest / newest keys
+ */
+void
+bound_test(char *name, int options, int policy)
+{
+    avl_tree *tree = avl_init(int_compare, NULL, options);
+    struct timeval start, finish;
+    int i, k, oldest = 0, live = 0, self = 0;
+
+    for (i = 0; i < NNN; i++) ndata[i] = i;
+    memset(bpresent, 0, sizeof(bpresent));
+    memset(bgone, 0, sizeof(bgone));
+    nevicted = 0;
+    assert(avl_set_capacity(tree, CAP, policy, int_evict, NULL) == AVL_SUCCESS);
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < NNN; i++) {
+        k = (i * 7919) % NNN;
+        if (avl_insert(tree, &ndata[k], NULL) == NULL) self++;
+        bpresent[k] = 1;
+        live++;
+
+        /* now and then remove a recent element by hand */
+        if (policy == AVL_EVICT_OLDEST && i % 3 == 0 && i >= 5) {
+            k = ((i - 5) * 7919) % NNN;
+            assert(avl_remove(tree, &ndata[k], NULL) == AVL_SUCCESS);
+            bpresent[k] = 0;
+            live--;
+        }
+        while (policy == AVL_EVICT_OLDEST && live > CAP) {
+            for ( ; !bpresent[(oldest * 7919) % NNN]; oldest++) ;
+            bpresent[(oldest++ * 7919) % NNN] = 0;
+            live--;
+        }
+    }
+    gettimeofday(&finish, NULL);
+
+    for (i = 0; i < NNN; i++) {
+        if (policy == AVL_EVICT_MIN) bpresent[i] = (i >= NNN - CAP);
+        if (policy == AVL_EVICT_MAX) bpresent[i] = (i < CAP);
+        assert((avl_lookup(tree, &ndata[i], NULL) != NULL) == bpresent[i]);
+        assert(bgone[i] != bpresent[i] || (policy == AVL_EVICT_OLDEST && !bgone[i]));
+    }
+    assert(avl_size(tree) == CAP && nevicted + CAP <= NNN);
+    printf("%s: n = %7d e = %7d self = %5d v = %d (%ld msec)\n", name,
+                                                                avl_size(tree),
+                                                                nevicted,
+                                                                self,
+                                                                avl_validate(tree, tree->root, NULL),
+                                                                (long)(finish.tv_sec  - start.tv_sec ) * 1000 +
+                                                                (long)(finish.tv_usec - start.tv_usec) / 1000);
+
+    /* shrinking a min/max bound evicts the excess at once */
+    if (policy != AVL_EVICT_OLDEST) {
+        assert(avl_set_capacity(tree, CAP / 2, policy, int_evict, NULL) == AVL_SUCCESS);
+        assert(avl_size(tree) == CAP / 2 && avl_validate(tree, tree->root, NULL));
+    } else {
+        assert(avl_set_capacity(tree, CAP / 2, policy, int_evict, NULL) == AVL_ERROR);
+    }
+    avl_free(tree);
+}
+
+
+/*
+ * Oldest-first eviction from runs of equal keys: each element holds its key
+ * and its insertion number
+ */
+long bcompares;
+int  bnext;
+
+
+int dup_compare(void *a, void *b, void *ctx)
+{
+    bcompares++;
+    return ((int*)a)[0] - ((int*)b)[0];
+}
+
+
+void dup_evict(void *n, void *ctx)
+{
+    assert(((int*)n)[1] == bnext);
+    bnext++;
+}
+
+
+void
+bound_dup_test(void)
+{
+    avl_tree *tree = avl_init(dup_compare, NULL, AVL_TREE_DEFAULT);
+    static int item[NNN][2];
+    int i;
+
+    bcompares = 0;
+    bnext = 0;
+    assert(avl_set_capacity(tree, CAP, AVL_EVICT_OLDEST, dup_evict, NULL) == AVL_SUCCESS);
+    for (i = 0; i < NNN; i++) {
+        item[i][0] = i % 3;
+        item[i][1] = i;
+        assert(avl_insert(tree, item[i], NULL) != NULL);
+    }
+    assert(avl_size(tree) == CAP && bnext == NNN - CAP && avl_validate(tree, tree->root, NULL));
+    printf("DUPS  : n = %7d compares per insert = %.1f\n", avl_size(tree), (double)bcompares / NNN);
+
+    /* an insert and an eviction, each one descent of the tree */
+    assert(bcompares < 2L * 16 * NNN);
+    avl_free(tree);
+}
+
+
+/*
+ * Capacity bound on nodes linked through a recorded path
+ */
+void
+bound_path_test(void)
+{
+    avl_tree *tree = avl_init(intr_compare, NULL, AVL_TREE_INTRUSIVE);
+    static intr item[4];
+    avl_path path;
+    avl_node *node;
+    int i, dir;
+
+    assert(avl_set_capacity(tree, 2, AVL_EVICT_MIN, NULL, NULL) == AVL_SUCCESS);
+    for (i = 0; i < 4; i++) item[i].data = (i + 1) * 10;
+    assert(avl_insert(tree, &item[1], NULL) && avl_insert(tree, &item[2], NULL));
+
+    /* below the minimum of a full tree: evicted at once; above it: kept */
+    for (i = 0; i < 4; i += 3) {
+        dir = (i == 3);
+        path.top = 0;
+        for (node = tree->root; node != NULL; node = node->child[dir]) {
+            path.up[path.top] = node;
+            path.upd[path.top++] = dir;
+        }
+        assert(avl_path_link(tree, &path, &item[i].avl) == (i ? &item[i].avl : NULL));
+        assert(avl_size(tree) == 2 && avl_validate(tree, tree->root, NULL));
+    }
+    assert(avl_lookup(tree, &item[3], NULL) && !avl_lookup(tree, &item[1], NULL));
+    avl_free(tree);
+}
+
+
+double zcdf[NNN];
+long   icompares;
+
+
+int int_counted(void *a, void *b, void *ctx)
+{
+    icompares++;
+    return *((int*)a) - *((int*)b);
+}
+
+
+/*
+ * zipf_key() - Key of Zipfian (s = 1) rank; ranks are scattered over the
+ * key space so hot keys are not clustered
+ */
+int
+zipf_key(void)
+{
+    double u = (double)rand() / RAND_MAX * zcdf[NNN - 1];
+    int lo = 0, hi = NNN - 1, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (zcdf[mid] < u) lo = mid + 1; else hi = mid;
+    }
+    return (int)(((long)lo * 7919) % NNN);
+}
+
+
+/*
+ * Compares per Zipfian lookup before and after avl_optimize()
+ */
+void
+optimize_test(char *name, int options)
+{
+    avl_tree *tree = avl_init(int_counted, NULL, options | AVL_TREE_COUNTED);
+    struct timeval start, finish;
+    double before, after;
+    long hot[2];
+    int i, h[2];
+
+    for (i = 0; i < NNN; i++) {
+        ndata[i] = i;
+        zcdf[i] = (i ? zcdf[i - 1] : 0) + 1.0 / (i + 1);
+    }
+    for (i = 0; i < NNN; i++) avl_insert(tree, &ndata[i], NULL);
+
+    srand(7);
+    icompares = 0;
+    for (i = 0; i < 4 * NNN; i++) assert(avl_lookup(tree, &ndata[zipf_key()], NULL) != NULL);
+    before = (double)icompares / (4 * NNN);
+    h[0] = avl_height(tree);
+    for (i = 0, icompares = 0; i < 16; i++) avl_lookup(tree, &ndata[(int)(((long)i * 7919) % NNN)], NULL);
+    hot[0] = icompares;
+
+    gettimeofday(&start, NULL);
+    assert(avl_optimize(tree) == AVL_SUCCESS);
+    gettimeofday(&finish, NULL);
+    assert(avl_validate(tree, tree->root, NULL) && avl_size(tree) == NNN);
+    h[1] = avl_height(tree);
+
+    srand(8);
+    icompares = 0;
+    for (i = 0; i < 4 * NNN; i++) assert(avl_lookup(tree, &ndata[zipf_key()], NULL) != NULL);
+    after = (double)icompares / (4 * NNN);
+    for (i = 0, icompares = 0; i < 16; i++) avl_lookup(tree, &ndata[(int)(((long)i * 7919) % NNN)], NULL);
+    hot[1] = icompares;
+
+    /* the reshaped tree stays an ordinary, updatable tree */
+    for (i = 0; i < NNN; i += 2) assert(avl_remove(tree, &ndata[i], NULL) == AVL_SUCCESS);
+    assert(avl_validate(tree, tree->root, NULL));
+
+    printf("%s: n = %7d h = %2d -> %2d compares/lookup = %5.2f -> %5.2f hot16 = %5.2f -> %5.2f (%ld msec)\n", name,
+                                                                NNN,
+                                                                h[0],
+                                                                h[1],
+                                                                before,
+                                                                after,
+                                                                hot[0] / 16.0,
+                                                                hot[1] / 16.0,
+                                                                (long)(finish.tv_sec  - start.tv_sec ) * 1000 +
+                                                                (long)(finish.tv_usec - start.tv_usec) / 1000);
+    assert(after < before && hot[1] < hot[0]);
+    avl_free(tree);
+}
+
+
+int       kdata[NNN];
+avl_node *knode[NNN];
+
+
+void int_rekey(void *n, void *ctx)
+{
+    *(int*)n = *(int*)ctx;
+}
+
+
+int int_sorted(void *n, void *ctx)
+{
+    if (*(int*)n < *(int*)ctx) return AVL_ERROR;
+    *(int*)ctx = *(int*)n;
+    return AVL_SUCCESS;
+}
+
+
+/*
+ * Rekey random nodes in place, half by small steps and half anywhere.  First
+ * move every other node past its successor: the relink starts near the old
+ * place, so it costs a few comparisons on top of the search by identity.
+ */
+void
+rekey_test(char *name, int options)
+{
+    avl_tree *tree = avl_init(int_counted, NULL, options);
+    avl_path path;
+    struct timeval start, finish;
+    int i, r, key, last = -1;
+    long found;
+
+    for (i = 0; i < NNN; i++) {
+        kdata[i] = 2 * i;
+        knode[i] = avl_insert(tree, &kdata[i], NULL);
+    }
+
+    icompares = 0;
+    for (i = 0; i + 1 < NNN; i += 2) {
+        assert(avl_find_path(tree, tree->root, knode[i], path.up, path.upd, 0, NULL) >= 0);
+    }
+    found = icompares;
+    icompares = 0;
+    for (i = 0; i + 1 < NNN; i += 2) {
+        key = kdata[i + 1] + 1;
+        assert(avl_update_key(tree, knode[i], int_rekey, &key) == AVL_SUCCESS);
+    }
+    printf("%s: %.1f compares / neighbour move, %.1f to find the node\n", name,
+           (double)icompares / (NNN / 2), (double)found / (NNN / 2));
+    assert(icompares - found < 12L * (NNN / 2));
+    assert(avl_validate(tree, tree->root, NULL));
+
+    gettimeofday(&start, NULL);
+    for (r = 0, srand(11); r < NNN; r++) {
+        i = rand() % NNN;
+        key = (r & 1) ? kdata[i] + rand() % 3 - 1 : rand() % (2 * NNN);
+        assert(avl_update_key(tree, knode[i], int_rekey, &key) == AVL_SUCCESS);
+        assert(kdata[i] == key);
+    }
+    gettimeofday(&finish, NULL);
+
+    for (i = 0; i < NNN; i++) assert(*(int*)avl_lookup(tree, &kdata[i], NULL) == kdata[i]);
+    printf("%s: n = %7d v = %d s = %d (%ld msec)\n", name,
+                                                     avl_size(tree),
+                                                     avl_validate(tree, tree->root, NULL),
+                                                     avl_walk(tree, int_sorted, &last, AVL_WALK_INORDER),
+                                                     (long)(finish.tv_sec  - start.tv_sec ) * 1000 +
+                                                     (long)(finish.tv_usec - start.tv_usec) / 1000);
+    avl_free(tree);
+}
+
+
+int  rfreed;
+
+
+void int_freed(void *n)
+{
+    rfreed++;
+}
+
+
+/*
+ * Remove random key ranges and check the rest of the tree against bpresent[]
+ */
+void
+range_test(char *name, int options)
+{
+    avl_tree *tree = avl_init(int_compare, NULL, options);
+    struct timeval start, finish;
+    int i, r, lo, hi, k, removed = 0;
+    long usec = 0;
+
+    for (i = 0; i < NNN; i++) {
+        ndata[i] = i;
+        bpresent[i] = 1;
+        avl_insert(tree, &ndata[i], NULL);
+    }
+    if (options & AVL_TREE_LAZY) {
+        for (i = 0; i < NNN; i += 3) avl_remove(tree, &ndata[i], NULL);
+        for (i = 0; i < NNN; i += 3) bpresent[i] = 0;
+    }
+
+    for (r = 0, srand(13); r < 200; r++) {
+        lo = rand() % NNN;
+        hi = lo + rand() % (r < 100 ? 64 : 2048);
+        if (hi >= NNN) hi = NNN - 1;
+        for (i = lo, k = 0; i <= hi; i++) k += bpresent[i];
+        for (i = lo; i <= hi; i++) bpresent[i] = 0;
+
+        rfreed = 0;
+        gettimeofday(&start, NULL);
+        assert(avl_remove_range(tree, &ndata[lo], &ndata[hi], int_freed, NULL) == k);
+        gettimeofday(&finish, NULL);
+        usec += (long)(finish.tv_sec - start.tv_sec) * 1000000 + (finish.tv_usec - start.tv_usec);
+        assert(rfreed >= k && (r % 50 || avl_validate(tree, tree->root, NULL)));
+        removed += k;
+    }
+
+    /* open ended ranges */
+    for (i = 0, k = 0; i < 100; i++) k += bpresent[i];
+    assert(avl_remove_range(tree, NULL, &ndata[99], NULL, NULL) == k);
+    for (i = NNN - 100, r = 0; i < NNN; i++) r += bpresent[i];
+    assert(avl_remove_range(tree, &ndata[NNN - 100], NULL, NULL, NULL) == r);
+    for (i = 0; i < 100; i++) bpresent[i] = bpresent[NNN - 1 - i] = 0;
+    removed += k + r;
+
+    for (i = 0; i < NNN; i++) assert((avl_lookup(tree, &ndata[i], NULL) != NULL) == bpresent[i]);
+    printf("%s: n = %7d k = %7d h = %2d v = %d (%ld msec)\n", name,
+                                                              avl_size(tree),
+                                                              removed,
+                                                              avl_height(tree),
+                                                              avl_validate(tree, tree->root, NULL),
+                                                              usec / 1000);
+    k = avl_size(tree);
+    assert(avl_remove_range(tree, NULL, NULL, NULL, NULL) == k);
+    assert(avl_size(tree) == 0 && tree->dead == 0 && tree->root == NULL);
+    avl_free(tree);
+}
+
+
+uint64_t str_hash(void *data)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    unsigned char *c;
+
+    for (c = (unsigned char*)data; *c; c++) h = (h ^ *c) * 0x100000001b3ULL;
+
+    return h;
+}
+
+
+void str_rekey(void *n, void *ctx)
+{
+    ((char*)n)[0] = 'c';
+}
+
+
+/*
+ * String keyed tree with and without a hash side-index: lookups through the
+ * hash must agree with lookups through the tree after every kind of update
+ */
+void
+hash_test(char *name, int options, int hashed)
+{
+    avl_tree *tree = avl_init(str_compare, NULL, options);
+    struct timeval start, finish;
+    avl_node *node[NNN / 2];
+    char key[16], *found;
+    long compares;
+    int i, j;
+
+    for (i = 0, srand(17); i < NNN; i++) {
+        for (j = 0; j < 15; j++) sdata[i][j] = 'a' + rand() % (j < 4 ? 2 : 26);
+        sdata[i][15] = 0;
+        bpresent[i] = 1;
+        if (i < NNN / 2) {
+            node[i] = avl_insert(tree, sdata[i], NULL);
+        } else {
+            if (i == NNN / 2 && hashed) assert(avl_set_hash(tree, str_hash) == AVL_SUCCESS);
+            avl_insert(tree, sdata[i], NULL);
+        }
+    }
+
+    scompares = 0;
+    gettimeofday(&start, NULL);
+    for (j = 0; j < 4; j++) {
+        for (i = 0; i < NNN; i++) {
+            strcpy(key, sdata[i]);
+            assert(avl_lookup(tree, key, NULL) != NULL);
+        }
+    }
+    gettimeofday(&finish, NULL);
+    compares = scompares;
+
+    /* remove, remove a range, move keys */
+    for (i = 1; i < NNN; i += 3) {
+        avl_remove(tree, sdata[i], NULL);
+        bpresent[i] = 0;
+    }
+    strcpy(key, "abba");
+    avl_remove_range(tree, key, "abbb", NULL, NULL);
+    for (i = 0; i < NNN; i++) {
+        if (strncmp(sdata[i], "abba", 4) == 0) bpresent[i] = 0;
+    }
+    for (i = 0; i < NNN / 2; i += 7) {
+        if (bpresent[i] == 0) continue;
+        strcpy(key, sdata[i]);
+        assert(avl_update_key(tree, node[i], str_rekey, NULL) == AVL_SUCCESS);
+        assert(avl_lookup(tree, key, NULL) == NULL);
+    }
+
+    for (i = 0; i < NNN; i++) {
+        found = (char*)avl_lookup(tree, sdata[i], NULL);
+        assert(found == (char*)avl_lookup_compare(tree, str_compare, sdata[i], NULL));
+        assert((found != NULL) == bpresent[i] && (found == NULL || strcmp(found, sdata[i]) == 0));
+    }
+
+    printf("%s: n = %7d h = %2d v = %d compares/lookup = %5.2f (%ld msec)\n", name,
+                                                                avl_size(tree),
+                                                                avl_height(tree),
+                                                                avl_validate(tree, tree->root, NULL),
+                                                                (double)compares / (4 * NNN),
+                                                                (long)(finish.tv_sec  - start.tv_sec ) * 1000 +
+                                                                (long)(finish.tv_usec - start.tv_usec) / 1000);
+    if (hashed) {
+        assert(avl_set_hash(tree, NULL) == AVL_SUCCESS && tree->hash == NULL);
+        for (i = 0; i < NNN; i++) assert((avl_lookup(tree, sdata[i], NULL) != NULL) == bpresent[i]);
+    }
+    avl_free(tree);
+}
+
+
+typedef struct rec_t {
+    int  key;
+    int  value[3];
+} rec;
+
+rec *nrec[NNN];
+int  rfinal;
+long rcompares;
+
+
+int rec_compare(void *a, void *b, void *ctx)
+{
+    rcompares++;
+    return ((rec*)a)->key - ((rec*)b)->key;
+}
+
+
+void rec_final(void *n)
+{
+    assert(((rec*)n)->value[0] == ((rec*)n)->key * 3);
+    rfinal++;
+}
+
+
+/*
+ * Elements pointed to by the nodes (separately allocated, in random order)
+ * or copied into them
+ */
+void
+inline_test(char *name, int inlined)
+{
+    avl_tree *tree;
+    struct timeval start, finish;
+    rec item, *found;
+    avl_node *node;
+    int i, j;
+
+    tree = inlined ? avl_init_inline(rec_compare, rec_final, 0, sizeof(rec))
+                   : avl_init(rec_compare, NULL, 0);
+    /* every key once, in random order; the records are scattered on the heap */
+    for (i = 0; i < NNN; i++) bpresent[i] = 0;
+    for (i = 0, srand(19); i < 2 * NNN; i++) {
+        j = (i < NNN) ? rand() % NNN : i - NNN;
+        if (bpresent[j]) continue;
+        bpresent[j] = 1;
+        item.key = j;
+        item.value[0] = 3 * j;
+        if (inlined) {
+            node = avl_insert(tree, &item, NULL);
+            assert(node && avl_data(node) == (void*)((char*)node + AVL_ITEM_OFFSET(tree)));
+            assert((uintptr_t)avl_data(node) % sizeof(uint64_t) == 0);
+        } else {
+            nrec[j] = (rec*)malloc(sizeof(rec));
+            *nrec[j] = item;
+            avl_insert(tree, nrec[j], NULL);
+        }
+    }
+    item.value[0] = -1;
+
+    gettimeofday(&start, NULL);
+    for (j = 0; j < 4; j++) {
+        for (i = 0, srand(23); i < NNN; i++) {
+            item.key = rand() % NNN;
+            found = (rec*)avl_lookup(tree, &item, NULL);
+            assert(found && found->value[0] == 3 * item.key);
+        }
+    }
+    gettimeofday(&finish, NULL);
+
+    printf("%s: n = %7d h = %2d v = %d (%ld msec)\n", name,
+                                                     avl_size(tree),
+                                                     avl_height(tree),
+                                                     avl_validate(tree, tree->root, NULL),
+                                                     (long)(finish.tv_sec  - start.tv_sec ) * 1000 +
+                                                     (long)(finish.tv_usec - start.tv_usec) / 1000);
+    assert(avl_size(tree) == NNN);
+
+    if (inlined) {
+        rfinal = 0;
+        for (i = 0; i < NNN; i += 2) {
+            item.key = i;
+            assert(avl_remove(tree, &item, NULL) == AVL_SUCCESS);
+        }
+        assert(rfinal == NNN / 2);
+        avl_free(tree);
+        assert(rfinal == NNN);
+    } else {
+        avl_free(tree);
+        for (i = 0; i < NNN; i++) {
+            free(nrec[i]);
+            nrec[i] = NULL;
+        }
+    }
+}
+
+
+#define DIFF 50
+
+char dkind[NNN];
+rec  dseen[3 * DIFF];
+int  ndseen;
+
+
+uint64_t rec_hash(void *n)
+{
+    return (uint64_t)((rec*)n)->key << 32 | (uint32_t)((rec*)n)->value[0];
+}
+
+
+void rec_revalue(void *n, void *ctx)
+{
+    ((rec*)n)->value[0] = -1;
+}
+
+
+/*
+ * Expect the kind of difference planted for the key: 1 missing from a,
+ * 2 missing from b, 3 changed in b.  Keep the kind and b's side in dseen[]
+ * to sync a afterwards.
+ */
+void rec_diff(void *a, void *b, void *ctx)
+{
+    rec *r = a ? (rec*)a : (rec*)b;
+
+    assert(dkind[r->key] == (a == NULL ? 1 : b == NULL ? 2 : 3));
+    assert(dkind[r->key] != 3 || ((rec*)b)->value[0] == -1);
+    dseen[ndseen] = b ? *(rec*)b : *r;
+    dseen[ndseen++].value[1] = dkind[r->key];
+    dkind[r->key] = 0;
+}
+
+
+/*
+ * Replicas built in different orders (and shapes) diverge in a few keys;
+ * avl_diff() must find exactly those without visiting the whole tree
+ */
+void
+merkle_test(char *name, int options)
+{
+    avl_tree *a = avl_init_inline(rec_compare, NULL, 0, sizeof(rec));
+    avl_tree *b = avl_init_inline(rec_compare, NULL, options, sizeof(rec));
+    avl_node *node;
+    rec item;
+    long scan;
+    int i, j, k;
+
+    assert(avl_set_merkle(a, rec_hash) == AVL_SUCCESS && avl_set_merkle(b, rec_hash) == AVL_SUCCESS);
+    for (i = 0; i < NNN; i++) {
+        item.key = i;
+        item.value[0] = 3 * i;
+        avl_insert(a, &item, NULL);
+        dkind[i] = 0;
+    }
+    for (i = 0, srand(29); i < 2 * NNN; i++) {
+        j = (i < NNN) ? rand() % NNN : i - NNN;
+        item.key = j;
+        item.value[0] = 3 * j;
+        if (avl_lookup(b, &item, NULL) == NULL) avl_insert(b, &item, NULL);
+    }
+    assert(avl_merkle_root(a) == avl_merkle_root(b) && avl_diff(a, b, rec_diff, NULL) == 0);
+
+    /* plant DIFF differences of each kind */
+    for (k = 0; k < 3 * DIFF; ) {
+        item.key = rand() % NNN;
+        if (dkind[item.key]) continue;
+        dkind[item.key] = 1 + k++ / DIFF;
+        if (dkind[item.key] == 1) assert(avl_remove(a, &item, NULL) == AVL_SUCCESS);
+        if (dkind[item.key] == 2) assert(avl_remove(b, &item, NULL) == AVL_SUCCESS);
+        if (dkind[item.key] == 3) {
+            for (node = b->root; rec_compare(avl_data(node), &item, NULL) != 0; ) {
+                node = node->child[rec_compare(avl_data(node), &item, NULL) < 0];
+            }
+            assert(avl_update_key(b, node, rec_revalue, NULL) == AVL_SUCCESS);
+        }
+    }
+    assert(avl_merkle_root(a) != avl_merkle_root(b));
+
+    ndseen = 0;
+    rcompares = 0;
+    assert(avl_diff(a, b, rec_diff, NULL) == 3 * DIFF && ndseen == 3 * DIFF);
+    scan = rcompares;
+    for (i = 0; i < NNN; i++) assert(dkind[i] == 0);
+
+    /* sync a from b */
+    for (i = 0; i < ndseen; i++) {
+        k = dseen[i].value[1];
+        dseen[i].value[1] = 0;
+        if (k != 1) assert(avl_remove(a, &dseen[i], NULL) == AVL_SUCCESS);
+        if (k != 2) avl_insert(a, &dseen[i], NULL);
+    }
+    assert(avl_merkle_root(a) == avl_merkle_root(b) && avl_diff(a, b, rec_diff, NULL) == 0);
+
+    printf("%s: n = %7d d = %3d v = %d compares = %ld\n", name,
+                                                        avl_size(b),
+                                                        3 * DIFF,
+                                                        avl_validate(b, b->root, NULL),
+                                                        scan);
+    assert(scan < NNN / 2);
+    avl_free(a);
+    avl_free(b);
+}
+
+
+int  ffreed;
+
+
+void int_reclaimed(void *n)
+{
+    __atomic_add_fetch(&ffreed, 1, __ATOMIC_RELEASE);
+}
+
+
+static long
+usec_since(struct timeval *start)
+{
+    struct timeval finish;
+
+    gettimeofday(&finish, NULL);
+    return (long)(finish.tv_sec - start->tv_sec) * 1000000 + (finish.tv_usec - start->tv_usec);
+}
+
+
+/*
+ * Tear down a tree of NNN elements in one call, in bounded steps, or on a
+ * background thread; report the longest stall of the calling thread
+ */
+void
+free_test(char *name, int options, int mode)
+{
+    avl_tree *tree = avl_init(int_compare, int_reclaimed, options);
+    struct timeval start;
+    long stall = 0, t;
+    int i, left, steps = 0;
+
+    for (i = 0; i < NNN; i++) {
+        ndata[i] = i;
+        avl_insert(tree, &ndata[i], NULL);
+    }
+    if (options & AVL_TREE_LAZY) {
+        for (i = 0; i < NNN; i += 4) assert(avl_remove(tree, &ndata[i], NULL) == AVL_SUCCESS);
+    }
+    ffreed = 0;
+
+    if (mode == 0) {
+        gettimeofday(&start, NULL);
+        avl_free(tree);
+        stall = usec_since(&start);
+        steps = 1;
+    } else if (mode == 1) {
+        left = NNN;
+        do {
+            gettimeofday(&start, NULL);
+            i = left;
+            left = avl_free_step(tree, 256);
+            t = usec_since(&start);
+            if (t > stall) stall = t;
+            assert(left == 0 ? ffreed == NNN : i - left == 256 && ffreed == NNN - left);
+            steps++;
+        } while ( left );
+    } else {
+        gettimeofday(&start, NULL);
+        assert(avl_free_async(tree) == AVL_SUCCESS);
+        stall = usec_since(&start);
+        steps = 1;
+        while ( __atomic_load_n(&ffreed, __ATOMIC_ACQUIRE) < NNN ) usleep(1000);
+    }
+
+    assert(__atomic_load_n(&ffreed, __ATOMIC_ACQUIRE) == NNN);
+    printf("%s: n = %7d steps = %4d longest stall = %ld usec\n", name, NNN, steps, stall);
+}
+
+
+/*
+ * Remove the middle half of a tree with the frees on a background thread:
+ * the range must be gone, and the counts right, before they run
+ */
+void
+range_free_test(char *name, int options)
+{
+    avl_tree *tree = avl_init(int_compare, NULL, options);
+    struct timeval start;
+    long stall;
+    int i, k = 0, dead = 0, lo = NNN / 4, hi = 3 * NNN / 4 - 1;
+
+    for (i = 0; i < NNN; i++) {
+        ndata[i] = i;
+        avl_insert(tree, &ndata[i], NULL);
+    }
+    for (i = 0; i < NNN; i++) {
+        if ((options & AVL_TREE_LAZY) && i % 4 == 0) {
+            assert(avl_remove(tree, &ndata[i], NULL) == AVL_SUCCESS);
+            if (i < lo || i > hi) dead++;
+        } else if (i >= lo && i <= hi) {
+            k++;
+        }
+    }
+    ffreed = 0;
+
+    gettimeofday(&start, NULL);
+    assert(avl_remove_range_async(tree, &ndata[lo], &ndata[hi], int_reclaimed, NULL) == k);
+    stall = usec_since(&start);
+    assert(avl_size(tree) == NNN - (NNN / 4) * !!(options & AVL_TREE_LAZY) - k && tree->dead == dead);
+    assert(avl_validate(tree, tree->root, NULL));
+    for (i = 0; i < NNN; i++) {
+        assert((avl_lookup(tree, &ndata[i], NULL) != NULL) ==
+               ((i < lo || i > hi) && !((options & AVL_TREE_LAZY) && i % 4 == 0)));
+    }
+
+    while ( __atomic_load_n(&ffreed, __ATOMIC_ACQUIRE) < hi - lo + 1 ) usleep(1000);
+    printf("%s: n = %7d k = %7d stall = %ld usec\n", name, avl_size(tree), k, stall);
+    avl_free(tree);
+}
+
+
+#define PARTS 24
+
+int  udup;
+
+
+int int_order(const void *a, const void *b)
+{
+    return **(int**)a - **(int**)b;
+}
+
+
+int int_collect(void *n, void *ctx)
+{
+    ((int**)ctx)[udup++] = (int*)n;
+    return AVL_SUCCESS;
+}
+
+
+void int_dup(void *kept, void *dup, void *ctx)
+{
+    assert(*(int*)kept == *(int*)dup);
+    (*(int*)ctx)++;
+}
+
+
+/*
+ * One tree per partition, every key in one or two of them.  Scan the union
+ * by merging, against walking every tree and sorting the results.
+ */
+void
+merge_test(char *name, int options)
+{
+    avl_tree *part[PARTS];
+    avl_merge_iter *merge;
+    struct timeval start, finish;
+    int **all = (int**)malloc(2 * NNN * sizeof(int*));
+    int *data, i, j, n, dups, prev;
+    long msec[2];
+
+    for (i = 0; i < PARTS; i++) part[i] = avl_init(int_compare, NULL, options);
+    for (i = 0, n = 0, srand(37); i < NNN; i++) {
+        avl_insert(part[rand() % PARTS], &ndata[i], NULL);
+        n++;
+        if (i % 8 == 0) {
+            avl_insert(part[rand() % PARTS], &ndata[i], NULL);
+            n++;
+        }
+    }
+
+    gettimeofday(&start, NULL);
+    udup = 0;
+    for (i = 0; i < PARTS; i++) avl_walk(part[i], int_collect, all, AVL_WALK_INORDER);
+    qsort(all, udup, sizeof(int*), int_order);
+    gettimeofday(&finish, NULL);
+    msec[0] = (long)(finish.tv_sec - start.tv_sec) * 1000 + (finish.tv_usec - start.tv_usec) / 1000;
+    assert(udup == n);
+
+    /* all elements, duplicates included, in the same order */
+    merge = avl_merge_init(part, PARTS, NULL, NULL, NULL);
+    gettimeofday(&start, NULL);
+    for (data = avl_merge_first(merge, NULL, NULL), j = 0; data; data = avl_merge_next(merge), j++) {
+        assert(*data == *all[j]);
+    }
+    gettimeofday(&finish, NULL);
+    msec[1] = (long)(finish.tv_sec - start.tv_sec) * 1000 + (finish.tv_usec - start.tv_usec) / 1000;
+    assert(j == n);
+    avl_merge_free(merge);
+
+    /* a range, each key once, the other copies to the callback */
+    dups = 0;
+    merge = avl_merge_init(part, PARTS, int_compare, int_dup, &dups);
+    prev = NNN / 3 - 1;
+    for (data = avl_merge_first(merge, &ndata[NNN / 3], &ndata[NNN / 2]); data; data = avl_merge_next(merge)) {
+        assert(*data == prev + 1);
+        prev = *data;
+    }
+    assert(prev == NNN / 2);
+    for (i = NNN / 3, j = 0; i <= NNN / 2; i++) j += (i % 8 == 0);
+    assert(dups == j);
+    assert(avl_merge_first(merge, &ndata[NNN - 1], NULL) == &ndata[NNN - 1]);
+    assert(avl_merge_next(merge) == NULL);
+    avl_merge_free(merge);
+
+    printf("%s: n = %7d trees = %d dups = %d (sort %ld msec, merge %ld msec)\n", name,
+                                                         n, PARTS, dups, msec[0], msec[1]);
+    for (i = 0; i < PARTS; i++) avl_free(part[i]);
+    free(all);
+}
+
+
+int rec_copy(void *n, void *ctx)
+{
+    return avl_insert((avl_tree*)ctx, n, NULL) != NULL;
+}
+
+
+/*
+ * Copy a tree by walking and inserting, then by cloning; the clone must
+ * match the original without calling the comparator, and stay independent
+ * of it
+ */
+void
+clone_test(char *name, int options, int inlined, int parallel)
+{
+    avl_tree *tree, *copy, *clone;
+    struct timeval start, finish;
+    avl_iter a, b;
+    rec item, *x, *y;
+    long usec[4];
+    int i, j, n;
+
+    tree = inlined ? avl_init_inline(rec_compare, NULL, options, sizeof(rec))
+                   : avl_init(rec_compare, NULL, options);
+    if (inlined) assert(avl_set_merkle(tree, rec_hash) == AVL_SUCCESS);
+    for (i = 0, srand(41); i < NNN; i++) {
+        j = (i * 7919) % NNN;
+        nrec[j] = (rec*)malloc(sizeof(rec));
+        nrec[j]->key = j;
+        nrec[j]->value[0] = 3 * j;
+        avl_insert(tree, nrec[j], NULL);
+    }
+    if (options & AVL_TREE_LAZY) {
+        for (i = 0; i < NNN; i += 4) assert(avl_remove(tree, nrec[i], NULL) == AVL_SUCCESS);
+    }
+    n = avl_size(tree);
+
+    copy = inlined ? avl_init_inline(rec_compare, NULL, options, sizeof(rec))
+                   : avl_init(rec_compare, NULL, options);
+    if (inlined) avl_set_merkle(copy, rec_hash);
+    gettimeofday(&start, NULL);
+    avl_walk(tree, rec_copy, copy, AVL_WALK_INORDER);
+    gettimeofday(&finish, NULL);
+    usec[0] = (long)(finish.tv_sec - start.tv_sec) * 1000000 + (finish.tv_usec - start.tv_usec);
+    assert(avl_size(copy) == n);
+    avl_free(copy);
+
+    rcompares = 0;
+    gettimeofday(&start, NULL);
+    clone = avl_clone(tree, parallel ? AVL_CLONE_PARALLEL : 0);
+    gettimeofday(&finish, NULL);
+    usec[1] = (long)(finish.tv_sec - start.tv_sec) * 1000000 + (finish.tv_usec - start.tv_usec);
+    assert(clone != NULL && rcompares == 0);
+    assert(avl_size(clone) == n && avl_height(clone) == avl_height(tree));
+    assert(avl_validate(clone, clone->root, NULL));
+    if (inlined) assert(avl_merkle_root(clone) == avl_merkle_root(tree));
+
+    /* same elements in the same order; inline elements are copies */
+    for (x = avl_iter_first(&a, tree), y = avl_iter_first(&b, clone); x; x = avl_iter_next(&a), y = avl_iter_next(&b)) {
+        assert(y && x->key == y->key && x->value[0] == y->value[0]);
+        assert(inlined ? (x != y && (char*)y >= (char*)clone->block &&
+                         (size_t)((char*)y - (char*)clone->block) < clone->block_size) : x == y);
+    }
+    assert(y == NULL);
+
+    for (j = 2; j < 4; j++) {
+        gettimeofday(&start, NULL);
+        for (i = 0, srand(43); i < NNN; i++) {
+            item.key = rand() % NNN;
+            avl_lookup(j == 2 ? tree : clone, &item, NULL);
+        }
+        gettimeofday(&finish, NULL);
+        usec[j] = (long)(finish.tv_sec - start.tv_sec) * 1000000 + (finish.tv_usec - start.tv_usec);
+    }
+
+    /* changes to the clone (in and out of its block) leave the tree alone */
+    for (i = 1; i < NNN; i += 2) assert(avl_remove(clone, nrec[i], NULL) == AVL_SUCCESS);
+    for (i = 1; i < NNN; i += 4) avl_insert(clone, nrec[i], NULL);
+    assert(avl_validate(clone, clone->root, NULL) && avl_validate(tree, tree->root, NULL));
+    assert(avl_size(tree) == n);
+    avl_free(clone);
+
+    printf("%s: n = %7d v = %d copy = %5ld usec clone = %4ld usec (lookups %ld / %ld usec)\n", name,
+                                                             n,
+                                                             avl_validate(tree, tree->root, NULL),
+                                                             usec[0], usec[1], usec[2], usec[3]);
+    avl_free(tree);
+    for (i = 0; i < NNN; i++) {
+        free(nrec[i]);
+        nrec[i] = NULL;
+    }
+}
+
+
 void
 avl_dump(avl_tree *tree, avl_node *node, int level)
 {
@@ -307,7 +1506,169 @@ int main(int argc, char *argv[])
                                                                    (int)         (finish.tv_sec  - start.tv_sec ),
                                                                    (unsigned int)(finish.tv_usec - start.tv_usec)/1000); 
 
-  
+
+
+    printf("\nL-TREE:\n");
+
+    for (i = 0; i < NNN; i++) ndata[i] = i;
+
+    ptree = avl_init(int_compare, NULL, AVL_TREE_LAZY);
+    for (i = 0; i < NNN; i++) avl_insert(ptree, &ndata[i], NULL);
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < NNN; i += 2) avl_remove(ptree, &ndata[i], NULL);
+    gettimeofday(&finish, NULL);
+    for (i = 0; i < NNN; i++) assert((avl_lookup(ptree, &ndata[i], NULL) != NULL) == (i & 1));
+    x = 0;
+    avl_walk(ptree, int_count, &x, AVL_WALK_INORDER);
+    assert(x == avl_size(ptree) && ptree->dead == NNN / 2);
+    {
+        avl_iter iter;
+        int *p, last = -1;
+
+        for (x = 0, p = avl_iter_first(&iter, ptree); p; p = avl_iter_next(&iter), x++) {
+            assert(*p > last && (*p & 1));
+            last = *p;
+        }
+        assert(x == avl_size(ptree) && *(int*)avl_iter_prev(&iter) == NNN - 1);
+    }
+    assert(avl_remove(ptree, &ndata[0], NULL) == AVL_ERROR);
+    printf("REMOVE: n = %7d d = %7d v = %d (%ld msec)\n", avl_size(ptree),
+                                                          ptree->dead,
+                                                          avl_validate(ptree, ptree->root, NULL),
+                                                          (long)(finish.tv_sec  - start.tv_sec ) * 1000 +
+                                                          (long)(finish.tv_usec - start.tv_usec) / 1000);
+
+    /* a re-inserted key is found even with its tombstone still in place */
+    avl_insert(ptree, &ndata[0], NULL);
+    assert(avl_lookup(ptree, &ndata[0], NULL) == &ndata[0]);
+    assert(avl_compact(ptree, 60) == 0);
+
+    gettimeofday(&start, NULL);
+    x = avl_compact(ptree, 45);
+    gettimeofday(&finish, NULL);
+    assert(x == NNN / 2 && ptree->dead == 0);
+    for (i = 0; i < NNN; i++) assert((avl_lookup(ptree, &ndata[i], NULL) != NULL) == (i == 0 || (i & 1)));
+    printf("COMPCT: n = %7d h = %2d v = %d (%ld msec)\n", avl_size(ptree),
+                                                          avl_height(ptree),
+                                                          avl_validate(ptree, ptree->root, NULL),
+                                                          (long)(finish.tv_sec  - start.tv_sec ) * 1000 +
+                                                          (long)(finish.tv_usec - start.tv_usec) / 1000);
+    avl_free(ptree);
+
+
+    printf("\nA-TREE (interval stabbing, range sums):\n");
+
+    augment_test("AVL   ", AVL_TREE_DEFAULT);
+    augment_test("WAVL  ", AVL_TREE_WAVL);
+
+
+    printf("\nS-TREE (string keys):\n");
+
+    prefix_bench("PLAIN ", 0);
+    prefix_bench("PREFIX", 1);
+    assert(avl_set_prefix(ptree = avl_init(int_compare, NULL, AVL_TREE_INTRUSIVE), str_prefix) == AVL_ERROR);
+    avl_free(ptree);
+
+
+    printf("\nC-TREE (capacity bound):\n");
+
+    bound_test("MIN   ", AVL_TREE_DEFAULT, AVL_EVICT_MIN);
+    bound_test("MAX   ", AVL_TREE_WAVL, AVL_EVICT_MAX);
+    bound_test("OLDEST", AVL_TREE_DEFAULT, AVL_EVICT_OLDEST);
+    bound_dup_test();
+    bound_path_test();
+    assert(avl_set_capacity(ptree = avl_init(int_compare, NULL, AVL_TREE_LAZY), CAP, AVL_EVICT_MIN, NULL, NULL) == AVL_ERROR);
+    avl_free(ptree);
+
+
+    printf("\nO-TREE (Zipfian lookups, reshaped):\n");
+
+    optimize_test("AVL   ", AVL_TREE_DEFAULT);
+    optimize_test("WAVL  ", AVL_TREE_WAVL);
+    assert(avl_optimize(ptree = avl_init(int_compare, NULL, 0)) == AVL_ERROR);
+    avl_free(ptree);
+
+
+    printf("\nK-TREE (in-place rekey):\n");
+
+    rekey_test("AVL   ", AVL_TREE_DEFAULT);
+    rekey_test("WAVL  ", AVL_TREE_WAVL);
+    ptree = avl_init(int_compare, NULL, 0);
+    itree = avl_init(int_compare, NULL, 0);
+    x = 0;
+    assert(avl_update_key(itree, avl_insert(ptree, &ndata[0], NULL), int_rekey, &x) == AVL_ERROR);
+    avl_free(itree);
+    avl_free(ptree);
+
+
+    printf("\nR-TREE (range removal):\n");
+
+    range_test("AVL   ", AVL_TREE_DEFAULT);
+    range_test("WAVL  ", AVL_TREE_WAVL);
+    range_test("LAZY  ", AVL_TREE_LAZY);
+
+
+    printf("\nH-TREE (string keys, hash side-index):\n");
+
+    hash_test("PLAIN ", AVL_TREE_DEFAULT, 0);
+    hash_test("HASH  ", AVL_TREE_DEFAULT, 1);
+    hash_test("LAZY  ", AVL_TREE_LAZY, 1);
+
+
+    printf("\nN-TREE (inline elements):\n");
+
+    inline_test("PTR   ", 0);
+    inline_test("INLINE", 1);
+    assert(avl_init_inline(intr_compare, NULL, AVL_TREE_INTRUSIVE, sizeof(intr)) == NULL);
+    assert(avl_init_inline(int_compare, NULL, 0, 0) == NULL);
+
+
+    printf("\nD-TREE (Merkle diff):\n");
+
+    merkle_test("AVL   ", AVL_TREE_DEFAULT);
+    merkle_test("WAVL  ", AVL_TREE_WAVL);
+    assert(avl_set_merkle(ptree = avl_init(int_compare, NULL, AVL_TREE_LAZY), rec_hash) == AVL_ERROR);
+    assert(avl_diff(ptree, ptree, rec_diff, NULL) == -1);
+    avl_free(ptree);
+
+
+    printf("\nF-TREE (teardown):\n");
+
+    free_test("FREE  ", AVL_TREE_DEFAULT, 0);
+    free_test("STEP  ", AVL_TREE_DEFAULT, 1);
+    free_test("LAZY  ", AVL_TREE_LAZY, 1);
+    free_test("ASYNC ", AVL_TREE_DEFAULT, 2);
+    range_free_test("RANGE ", AVL_TREE_DEFAULT);
+    range_free_test("WAVL  ", AVL_TREE_WAVL);
+    range_free_test("LAZY  ", AVL_TREE_LAZY);
+    assert(avl_free_step(avl_init(int_compare, NULL, 0), 1) == 0);
+
+
+    printf("\nU-TREE (k-way merge):\n");
+
+    for (i = 0; i < NNN; i++) ndata[i] = i;
+    merge_test("AVL   ", AVL_TREE_DEFAULT);
+    merge_test("WAVL  ", AVL_TREE_WAVL);
+    assert(avl_merge_init(NULL, 0, int_compare, NULL, NULL) == NULL);
+
+
+    printf("\nX-TREE (contiguous clone):\n");
+
+    clone_test("PTR   ", AVL_TREE_DEFAULT, 0, 0);
+    clone_test("PAR   ", AVL_TREE_DEFAULT, 0, 1);
+    clone_test("INLINE", AVL_TREE_DEFAULT, 1, 1);
+    clone_test("LAZY  ", AVL_TREE_LAZY, 0, 1);
+    clone_test("WAVL  ", AVL_TREE_WAVL, 1, 0);
+    assert(avl_clone(itree = avl_init(intr_compare, NULL, AVL_TREE_INTRUSIVE), 0) == NULL);
+    avl_free(itree);
+
+
+    printf("\nROTATIONS (delete-heavy churn):\n");
+
+    rotation_bench("AVL   ", AVL_TREE_DEFAULT);
+    rotation_bench("WAVL  ", AVL_TREE_WAVL);
+    printf("\n");
 
     return 0;
 }